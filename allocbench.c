@@ -0,0 +1,376 @@
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <vulkan/vulkan.h>
+
+#include "registry.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+/* Allocate, map, write, and free HOST_VISIBLE memories of several sizes with
+ * the vkmemfd layer disabled and then enabled, and check the registry of the
+ * layer heap the way another process would.
+ */
+
+static const VkDeviceSize allocbench_sizes[] = {
+	4096,
+	64 * 1024,
+	1024 * 1024,
+	4 * 1024 * 1024,
+};
+
+struct allocbench_result {
+	/* per memory, in us */
+	double alloc_us;
+	double free_us;
+	double write_gbps;
+};
+
+struct allocbench {
+	struct {
+		int count;
+		int round_count;
+	} config;
+
+	bool use_layer;
+
+	VkInstance instance;
+	VkPhysicalDevice physical_dev;
+	VkDevice dev;
+	uint32_t mem_type;
+
+	VkDeviceMemory *mems;
+
+	/* the registry of the layer heap, or NULL */
+	const struct registry_header *registry;
+	struct registry_allocation *allocs;
+	/* sizes with memories missing from the registry */
+	int missing_count;
+};
+
+static void allocbench_fatal(const char *msg)
+{
+	printf("ALLOCBENCH-FATAL: %s\n", msg);
+	abort();
+}
+
+static void allocbench_vk(VkResult result, const char *msg)
+{
+	if (result != VK_SUCCESS)
+		allocbench_fatal(msg);
+}
+
+static uint64_t allocbench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void allocbench_init_vk(struct allocbench *bench)
+{
+	/* the loader reads the environment when the instance is created */
+	if (bench->use_layer) {
+		setenv("VKMEMFD_LAYER", "1", 1);
+		unsetenv("VKMEMFD_LAYER_DISABLE");
+	} else {
+		unsetenv("VKMEMFD_LAYER");
+		setenv("VKMEMFD_LAYER_DISABLE", "1", 1);
+	}
+
+	const VkApplicationInfo app_info = {
+		.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
+		.pApplicationName = "vkmemfd-allocbench",
+		.apiVersion = VK_API_VERSION_1_1,
+	};
+	VkResult result = vkCreateInstance(
+			&(VkInstanceCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO,
+				.pApplicationInfo = &app_info,
+			}, NULL, &bench->instance);
+	allocbench_vk(result, "failed to create instance");
+
+	uint32_t count = 1;
+	result = vkEnumeratePhysicalDevices(bench->instance, &count,
+			&bench->physical_dev);
+	if (result < VK_SUCCESS || !count)
+		allocbench_fatal("no physical device");
+
+	const float priority = 1.0f;
+	result = vkCreateDevice(bench->physical_dev,
+			&(VkDeviceCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+				.queueCreateInfoCount = 1,
+				.pQueueCreateInfos = &(VkDeviceQueueCreateInfo) {
+					.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
+					.queueFamilyIndex = 0,
+					.queueCount = 1,
+					.pQueuePriorities = &priority,
+				},
+			}, NULL, &bench->dev);
+	allocbench_vk(result, "failed to create device");
+
+	VkPhysicalDeviceMemoryProperties props;
+	vkGetPhysicalDeviceMemoryProperties(bench->physical_dev, &props);
+
+	const VkMemoryPropertyFlags flags =
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+		VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+	bench->mem_type = 0;
+	while (bench->mem_type < props.memoryTypeCount &&
+			(props.memoryTypes[bench->mem_type].propertyFlags &
+			 flags) != flags)
+		bench->mem_type++;
+	if (bench->mem_type == props.memoryTypeCount)
+		allocbench_fatal("no HOST_VISIBLE memory type");
+}
+
+static void allocbench_fini_vk(struct allocbench *bench)
+{
+	vkDestroyDevice(bench->dev, NULL);
+	vkDestroyInstance(bench->instance, NULL);
+}
+
+/* find the layer heap in our fds and map it read-only, through /proc as
+ * another process would
+ */
+static void allocbench_init_registry(struct allocbench *bench)
+{
+	bench->registry = NULL;
+
+	DIR *dir = opendir("/proc/self/fd");
+	if (!dir)
+		return;
+
+	const struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		char path[sizeof("/proc/self/fd/") + sizeof(ent->d_name)];
+		char target[64];
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", ent->d_name);
+
+		const ssize_t len = readlink(path, target, sizeof(target) - 1);
+		if (len < 0)
+			continue;
+		target[len] = '\0';
+		if (strncmp(target, "/memfd:vkmemfd-layer", 20))
+			continue;
+
+		const int fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+		const void *ptr = mmap(NULL, sizeof(*bench->registry),
+				PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (ptr == MAP_FAILED)
+			continue;
+
+		bench->registry = ptr;
+		if (bench->registry->magic == REGISTRY_MAGIC)
+			break;
+
+		munmap((void *) bench->registry, sizeof(*bench->registry));
+		bench->registry = NULL;
+	}
+
+	closedir(dir);
+}
+
+static void allocbench_fini_registry(struct allocbench *bench)
+{
+	if (bench->registry) {
+		munmap((void *) bench->registry, sizeof(*bench->registry));
+		bench->registry = NULL;
+	}
+}
+
+/* return how many of the memories are in the registry */
+static int allocbench_check_registry(const struct allocbench *bench,
+		VkDeviceSize size)
+{
+	int count;
+	do {
+		count = registry_read(bench->registry, bench->allocs);
+	} while (count < 0);
+
+	int found = 0;
+	for (int i = 0; i < count; i++) {
+		const struct registry_allocation *alloc = &bench->allocs[i];
+		if (alloc->size < size || alloc->memory_type != bench->mem_type)
+			continue;
+
+		for (int j = 0; j < bench->config.count; j++) {
+			if (alloc->memory == (uint64_t) bench->mems[j]) {
+				found++;
+				break;
+			}
+		}
+	}
+
+	return found;
+}
+
+static void allocbench_run_size(struct allocbench *bench, VkDeviceSize size,
+		struct allocbench_result *result, int *registered)
+{
+	uint64_t alloc_total = 0;
+	uint64_t write_total = 0;
+	uint64_t free_total = 0;
+
+	for (int r = 0; r < bench->config.round_count; r++) {
+		const uint64_t t0 = allocbench_now();
+		for (int i = 0; i < bench->config.count; i++) {
+			VkResult ret = vkAllocateMemory(bench->dev,
+					&(VkMemoryAllocateInfo) {
+						.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+						.allocationSize = size,
+						.memoryTypeIndex = bench->mem_type,
+					}, NULL, &bench->mems[i]);
+			allocbench_vk(ret, "failed to allocate memory");
+		}
+
+		const uint64_t t1 = allocbench_now();
+		for (int i = 0; i < bench->config.count; i++) {
+			void *ptr;
+			VkResult ret = vkMapMemory(bench->dev, bench->mems[i],
+					0, VK_WHOLE_SIZE, 0, &ptr);
+			allocbench_vk(ret, "failed to map memory");
+			memset(ptr, r + 1, size);
+			vkUnmapMemory(bench->dev, bench->mems[i]);
+		}
+
+		const uint64_t t2 = allocbench_now();
+		if (!r && bench->registry)
+			*registered = allocbench_check_registry(bench, size);
+
+		const uint64_t t3 = allocbench_now();
+		for (int i = 0; i < bench->config.count; i++)
+			vkFreeMemory(bench->dev, bench->mems[i], NULL);
+		const uint64_t t4 = allocbench_now();
+
+		alloc_total += t1 - t0;
+		write_total += t2 - t1;
+		free_total += t4 - t3;
+	}
+
+	const double count = (double) bench->config.count *
+		bench->config.round_count;
+	result->alloc_us = alloc_total / count / 1e3;
+	result->free_us = free_total / count / 1e3;
+	result->write_gbps = size * count / write_total;
+}
+
+static bool allocbench_run(struct allocbench *bench,
+		struct allocbench_result *results)
+{
+	allocbench_init_vk(bench);
+	allocbench_init_registry(bench);
+
+	if (bench->use_layer && !bench->registry) {
+		allocbench_fini_vk(bench);
+		return false;
+	}
+
+	for (uint32_t i = 0; i < ARRAY_SIZE(allocbench_sizes); i++) {
+		int registered = -1;
+		allocbench_run_size(bench, allocbench_sizes[i], &results[i],
+				&registered);
+
+		if (registered >= 0 && registered != bench->config.count) {
+			printf("%d of %d memories of %llu bytes in the "
+					"registry\n", registered,
+					bench->config.count,
+					(unsigned long long) allocbench_sizes[i]);
+			bench->missing_count++;
+		}
+	}
+
+	allocbench_fini_registry(bench);
+	allocbench_fini_vk(bench);
+
+	return true;
+}
+
+static void allocbench_usage(const char *argv0)
+{
+	printf("Usage: %s [count=N] [rounds=N]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct allocbench bench = {
+		.config = {
+			.count = 32,
+			.round_count = 20,
+		},
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "count=", 6)) {
+			bench.config.count = atoi(argv[i] + 6);
+			if (bench.config.count <= 0)
+				allocbench_usage(argv[0]);
+		} else if (!strncmp(argv[i], "rounds=", 7)) {
+			bench.config.round_count = atoi(argv[i] + 7);
+			if (bench.config.round_count <= 0)
+				allocbench_usage(argv[0]);
+		} else {
+			allocbench_usage(argv[0]);
+		}
+	}
+
+	bench.mems = malloc(sizeof(bench.mems[0]) * bench.config.count);
+	bench.allocs = malloc(sizeof(bench.allocs[0]) *
+			REGISTRY_ALLOCATION_MAX);
+	if (!bench.mems || !bench.allocs)
+		allocbench_fatal("failed to allocate arrays");
+
+	struct allocbench_result native[ARRAY_SIZE(allocbench_sizes)];
+	struct allocbench_result layer[ARRAY_SIZE(allocbench_sizes)];
+
+	bench.use_layer = false;
+	allocbench_run(&bench, native);
+
+	bench.use_layer = true;
+	const bool has_layer = allocbench_run(&bench, layer);
+	if (!has_layer)
+		printf("no heap of the vkmemfd layer; only native results\n");
+
+	printf("%-10s %-7s %12s %12s %12s\n", "size", "", "alloc (us)",
+			"free (us)", "write GB/s");
+	for (uint32_t i = 0; i < ARRAY_SIZE(allocbench_sizes); i++) {
+		const VkDeviceSize size = allocbench_sizes[i];
+
+		printf("%-10llu %-7s %12.2f %12.2f %12.2f\n",
+				(unsigned long long) size, "native",
+				native[i].alloc_us, native[i].free_us,
+				native[i].write_gbps);
+		if (!has_layer)
+			continue;
+
+		printf("%-10s %-7s %12.2f %12.2f %12.2f\n", "", "layer",
+				layer[i].alloc_us, layer[i].free_us,
+				layer[i].write_gbps);
+		printf("%-10s %-7s %+11.1f%% %+11.1f%% %+11.1f%%\n", "",
+				"change",
+				(layer[i].alloc_us / native[i].alloc_us - 1) * 100,
+				(layer[i].free_us / native[i].free_us - 1) * 100,
+				(layer[i].write_gbps / native[i].write_gbps - 1) *
+				100);
+	}
+
+	free(bench.allocs);
+	free(bench.mems);
+
+	/* the layer is what is measured */
+	return has_layer && !bench.missing_count ? 0 : 1;
+}
@@ -0,0 +1,75 @@
+#include "attach.h"
+
+#include <string.h>
+
+size_t attach_header_size(int output_count)
+{
+	return sizeof(struct attach_header) +
+		sizeof(struct attach_output) * output_count;
+}
+
+void attach_begin_write(struct attach_header *hdr, int output)
+{
+	struct attach_output *out = &hdr->outputs[output];
+	const unsigned seq = atomic_load_explicit(&out->seq,
+			memory_order_relaxed);
+
+	atomic_store_explicit(&out->seq, seq + 1, memory_order_relaxed);
+	/* the odd seq is visible before the request that writes the output */
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+void attach_end_write(struct attach_header *hdr, int output,
+		uint32_t generation)
+{
+	struct attach_output *out = &hdr->outputs[output];
+	const unsigned seq = atomic_load_explicit(&out->seq,
+			memory_order_relaxed);
+
+	if (generation) {
+		atomic_store_explicit(&out->generation, generation,
+				memory_order_relaxed);
+	}
+	atomic_store_explicit(&out->seq, seq + 1, memory_order_release);
+
+	if (generation) {
+		atomic_store_explicit(&hdr->latest,
+				(uint64_t) generation << 32 | output,
+				memory_order_release);
+	}
+}
+
+enum attach_read_result attach_read(const struct attach_header *hdr,
+		const void *heap, void *dst, uint32_t last_generation,
+		uint32_t *generation)
+{
+	const uint64_t latest = atomic_load_explicit(&hdr->latest,
+			memory_order_acquire);
+	const uint32_t output = (uint32_t) latest;
+	if ((uint32_t) (latest >> 32) == last_generation ||
+			output >= hdr->output_count)
+		return ATTACH_READ_NONE;
+
+	/* the output may have been requested again since, and its frame is
+	 * lost to us
+	 */
+	const struct attach_output *out = &hdr->outputs[output];
+	const unsigned seq = atomic_load_explicit(&out->seq,
+			memory_order_acquire);
+	if (seq & 1)
+		return ATTACH_READ_NONE;
+
+	const uint32_t gen = atomic_load_explicit(&out->generation,
+			memory_order_relaxed);
+	memcpy(dst, (const char *) heap + hdr->output_offset +
+			hdr->output_stride * output, hdr->frame_size);
+
+	/* the copy is done before seq is checked again */
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&out->seq, memory_order_relaxed) != seq)
+		return ATTACH_READ_RETRY;
+
+	*generation = gen;
+
+	return ATTACH_READ_OK;
+}
@@ -0,0 +1,80 @@
+#ifndef ATTACH_H
+#define ATTACH_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ATTACH_MAGIC 0x666d6b76
+
+/* seq is odd while the output is being written, and generation is the frame
+ * number of its contents, or 0 before its first frame
+ */
+struct attach_output {
+	atomic_uint seq;
+	atomic_uint generation;
+	/* one cache line per output */
+	uint32_t pad[14];
+};
+
+/* At a page-aligned offset in the heap.  Only the main process writes it;
+ * readers map the heap read-only.
+ */
+struct attach_header {
+	uint32_t magic;
+	uint32_t output_count;
+	/* enum vkmemfd_output_layout */
+	uint32_t layout;
+	/* of the frames, which are the ROIs when there are ROIs */
+	uint32_t width;
+	uint32_t height;
+	uint32_t row_pitch;
+	uint32_t tile_size;
+	uint32_t pad;
+	/* the bytes of a frame, at the start of its output */
+	uint64_t frame_size;
+	/* of the first output in the heap, and between the outputs */
+	uint64_t output_offset;
+	uint64_t output_stride;
+	/* the generation of the last completed frame in the high 32 bits, and
+	 * its output in the low 32 bits
+	 */
+	atomic_ullong latest;
+	struct attach_output outputs[];
+};
+
+/* sent by a reader about once per second, counting from its last report */
+struct attach_report {
+	uint64_t frame_count;
+	/* torn reads */
+	uint64_t retry_count;
+	uint64_t byte_count;
+	/* in ns */
+	uint64_t duration;
+};
+
+enum attach_read_result {
+	/* there is no frame newer than the last one that can be read */
+	ATTACH_READ_NONE,
+	ATTACH_READ_OK,
+	/* the read was torn by a write to the output; try again */
+	ATTACH_READ_RETRY,
+};
+
+size_t attach_header_size(int output_count);
+
+/* around the GPU writes to an output; generation is 0 when the output was not
+ * written after all
+ */
+void attach_begin_write(struct attach_header *hdr, int output);
+void attach_end_write(struct attach_header *hdr, int output,
+		uint32_t generation);
+
+/* Copy the latest frame to dst, unless its generation is last_generation.
+ * heap is where the heap is mapped.  The producer is never waited for.
+ */
+enum attach_read_result attach_read(const struct attach_header *hdr,
+		const void *heap, void *dst, uint32_t last_generation,
+		uint32_t *generation);
+
+#endif /* ATTACH_H */
@@ -0,0 +1,1398 @@
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "convert.h"
+#include "dmabuf.h"
+#include "layout.h"
+#include "readback.h"
+#include "renderer.h"
+#include "trace.h"
+#include "upload.h"
+#include "verify.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+enum bench_transport {
+	BENCH_TRANSPORT_MEMFD,
+	BENCH_TRANSPORT_UDMABUF,
+	BENCH_TRANSPORT_SHM_OPEN,
+	BENCH_TRANSPORT_SYSV,
+	BENCH_TRANSPORT_EXPORT,
+	BENCH_TRANSPORT_COUNT,
+};
+
+static const struct {
+	const char *name;
+	enum vkmemfd_heap_type heap_type;
+} bench_transports[BENCH_TRANSPORT_COUNT] = {
+	[BENCH_TRANSPORT_MEMFD] = { "memfd", VKMEMFD_HEAP_MEMFD },
+	[BENCH_TRANSPORT_UDMABUF] = { "udmabuf", VKMEMFD_HEAP_UDMABUF },
+	/* a shm_open fd is imported the same way a memfd is */
+	[BENCH_TRANSPORT_SHM_OPEN] = { "shm_open", VKMEMFD_HEAP_MEMFD },
+	[BENCH_TRANSPORT_SYSV] = { "sysv", VKMEMFD_HEAP_SYSV },
+	[BENCH_TRANSPORT_EXPORT] = { "export", VKMEMFD_HEAP_EXPORT },
+};
+
+struct bench {
+	struct {
+		const char *name;
+		int width;
+		int height;
+		int output_count;
+		int frame_count;
+		size_t heap_size;
+		/* linear outputs except when replaying */
+		enum vkmemfd_output_layout layout;
+		int row_align;
+		uint32_t preview_levels;
+	} config;
+
+	enum bench_transport transport;
+
+	struct {
+		int fd;
+		int shmid;
+		void *base;
+	} heap;
+
+	struct {
+		pid_t pid;
+		int in;
+		int out;
+	} renderer;
+
+	struct {
+		size_t heap_skip;
+		size_t ubo_size;
+		size_t output_size;
+		size_t ubo_stride;
+	} layout;
+
+	/* memories exported by the renderer; index 0 is the UBO */
+	struct {
+		int *fds;
+		void **ptrs;
+	} exports;
+
+	/* pointers into the heap or the exported memories */
+	struct {
+		void *ubo;
+		const void **outputs;
+	} mems;
+
+	size_t img_size;
+	void *staging;
+};
+
+struct bench_result {
+	double setup_ms;
+	double frame_min_ms;
+	double frame_avg_ms;
+	double frame_max_ms;
+	/* 0 when the method is not supported */
+	double readback_gbps[READBACK_METHOD_COUNT];
+	double flush_ms;
+	/* with only a quarter of the output damaged */
+	double damage_ms;
+	/* outputs per second, one per submit and batched */
+	double bulk_fps;
+	double batch_fps;
+	/* of the outputs */
+	bool is_cached;
+};
+
+struct bench_replay_result {
+	int request_count;
+	int dropped_count;
+	/* from the first request to the last reply */
+	double duration_ms;
+	/* completed outputs per second */
+	double fps;
+	/* from the request to the reply of the completed outputs */
+	double latency_avg_ms;
+	double latency_max_ms;
+};
+
+/* the requests in flight during a replay */
+struct bench_replay {
+	bool *inflight;
+	uint64_t *request_times;
+	int inflight_count;
+
+	/* batched requests not sent yet */
+	struct vkmemfd_request reqs[16];
+	int queued_count;
+
+	int completed_count;
+	uint64_t latency_total;
+	uint64_t latency_max;
+};
+
+/* results are compared against a baseline by name */
+struct bench_metrics {
+	struct {
+		char name[64];
+		double value;
+		bool higher_is_better;
+	} entries[128];
+	int count;
+};
+
+static void bench_fatal(const char *msg)
+{
+	printf("BENCH-FATAL: %s\n", msg);
+	abort();
+}
+
+static uint64_t bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool bench_init_heap(struct bench *bench)
+{
+	bench->heap.fd = -1;
+	bench->heap.shmid = -1;
+	bench->heap.base = NULL;
+
+	switch (bench->transport) {
+	case BENCH_TRANSPORT_MEMFD:
+	case BENCH_TRANSPORT_UDMABUF:
+		bench->heap.fd = memfd_create(bench->config.name,
+				MFD_CLOEXEC | MFD_ALLOW_SEALING);
+		if (bench->heap.fd < 0)
+			return false;
+		if (ftruncate(bench->heap.fd, bench->config.heap_size) < 0)
+			return false;
+		/* udmabuf requires F_SEAL_SHRINK */
+		if (fcntl(bench->heap.fd, F_ADD_SEALS, F_SEAL_SEAL |
+					F_SEAL_SHRINK |
+					F_SEAL_GROW) < 0)
+			return false;
+		break;
+	case BENCH_TRANSPORT_SHM_OPEN: {
+		char name[64];
+		snprintf(name, sizeof(name), "/%s-%d", bench->config.name,
+				(int) getpid());
+		bench->heap.fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL |
+				O_CLOEXEC, 0600);
+		if (bench->heap.fd < 0)
+			return false;
+		shm_unlink(name);
+		if (ftruncate(bench->heap.fd, bench->config.heap_size) < 0)
+			return false;
+		break;
+	}
+	case BENCH_TRANSPORT_SYSV:
+		bench->heap.shmid = shmget(IPC_PRIVATE, bench->config.heap_size,
+				IPC_CREAT | SHM_NORESERVE | 0600);
+		if (bench->heap.shmid < 0)
+			return false;
+		bench->heap.base = shmat(bench->heap.shmid, NULL, 0);
+		if (bench->heap.base == (void *) -1) {
+			bench->heap.base = NULL;
+			return false;
+		}
+		return true;
+	case BENCH_TRANSPORT_EXPORT:
+		return true;
+	default:
+		return false;
+	}
+
+	bench->heap.base = mmap(NULL, bench->config.heap_size,
+			PROT_READ | PROT_WRITE, MAP_SHARED, bench->heap.fd, 0);
+	if (bench->heap.base == MAP_FAILED) {
+		bench->heap.base = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static bool bench_init_renderer(struct bench *bench)
+{
+	int pipes[2];
+	int socks[2];
+
+	/* the renderer sends fds back when it exports the memories */
+	if (pipe(pipes) < 0)
+		bench_fatal("failed to create pipes");
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0)
+		bench_fatal("failed to create sockets");
+
+	bench->renderer.in = socks[0];
+	bench->renderer.out = pipes[1];
+
+	/* do not duplicate buffered output in the child */
+	fflush(stdout);
+
+	bench->renderer.pid = fork();
+	if (bench->renderer.pid < 0)
+		bench_fatal("failed to fork the renderer");
+
+	if (bench->renderer.pid > 0) {
+		close(pipes[0]);
+		close(socks[1]);
+		return true;
+	}
+
+	/* in the child now; there is no X connection or Vulkan instance to
+	 * worry about so there is no need to exec
+	 */
+
+	close(bench->renderer.in);
+	close(bench->renderer.out);
+
+	/* the damaged frames need the outputs to keep their contents */
+	const int heap = bench->transport == BENCH_TRANSPORT_SYSV ?
+		bench->heap.shmid : bench->heap.fd;
+	_exit(renderer(bench->config.width, bench->config.height,
+				bench->config.output_count, pipes[0], socks[1],
+				heap, bench_transports[bench->transport].heap_type,
+				bench->config.layout, bench->config.row_align,
+				bench->config.preview_levels, true));
+}
+
+/* return false when the renderer is gone */
+static bool bench_recv(const struct bench *bench, uint32_t *val)
+{
+	return vkmemfd_recv_value(bench->renderer.in, val);
+}
+
+static bool bench_send(const struct bench *bench,
+		const struct vkmemfd_request *req)
+{
+	return vkmemfd_submit(bench->renderer.out, req, 1);
+}
+
+static bool bench_init_exports(struct bench *bench)
+{
+	const int count = 1 + bench->config.output_count;
+
+	bench->exports.fds = malloc(sizeof(bench->exports.fds[0]) * count);
+	bench->exports.ptrs = calloc(count, sizeof(bench->exports.ptrs[0]));
+	if (!bench->exports.fds || !bench->exports.ptrs)
+		bench_fatal("failed to allocate export arrays");
+
+	for (int i = 0; i < count; i++)
+		bench->exports.fds[i] = -1;
+
+	for (int i = 0; i < count; i++) {
+		uint32_t is_dmabuf;
+		bench->exports.fds[i] = vkmemfd_recv_fd(bench->renderer.in,
+				&is_dmabuf);
+		/* only dma-bufs can be mapped */
+		if (bench->exports.fds[i] < 0 || !is_dmabuf)
+			return false;
+
+		const size_t size = i ? bench->layout.output_size :
+			bench->layout.ubo_size;
+		void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED, bench->exports.fds[i], 0);
+		if (ptr == MAP_FAILED)
+			return false;
+		bench->exports.ptrs[i] = ptr;
+	}
+
+	return true;
+}
+
+static bool bench_init_memories(struct bench *bench)
+{
+	bench->mems.outputs = malloc(sizeof(bench->mems.outputs[0]) *
+			bench->config.output_count);
+	if (!bench->mems.outputs)
+		bench_fatal("failed to allocate output pointers");
+
+	if (bench->layout.ubo_stride < sizeof(struct renderer_params) ||
+			bench->layout.ubo_size < bench->layout.ubo_stride *
+			bench->config.output_count)
+		bench_fatal("invalid ubo size");
+	if (bench->layout.output_size < bench->img_size)
+		bench_fatal("invalid output size");
+
+	if (bench->transport == BENCH_TRANSPORT_EXPORT) {
+		if (!bench_init_exports(bench))
+			return false;
+
+		bench->mems.ubo = bench->exports.ptrs[0];
+		for (int i = 0; i < bench->config.output_count; i++)
+			bench->mems.outputs[i] = bench->exports.ptrs[1 + i];
+
+		return true;
+	}
+
+	void *ptr = bench->heap.base + bench->layout.heap_skip;
+
+	bench->mems.ubo = ptr;
+	ptr += bench->layout.ubo_size;
+
+	for (int i = 0; i < bench->config.output_count; i++) {
+		bench->mems.outputs[i] = ptr;
+		ptr += bench->layout.output_size;
+	}
+
+	if (ptr - bench->heap.base > bench->config.heap_size)
+		bench_fatal("heap size too small");
+
+	return true;
+}
+
+static void bench_upload_params(const struct bench *bench, int output,
+		const struct renderer_params *params)
+{
+	const bool sync = bench->transport == BENCH_TRANSPORT_EXPORT;
+
+	if (sync && dmabuf_sync_start(bench->exports.fds[0], true))
+		bench_fatal("failed to start UBO access");
+	memcpy(bench->mems.ubo + bench->layout.ubo_stride * output, params,
+			sizeof(*params));
+	if (sync && dmabuf_sync_end(bench->exports.fds[0], true))
+		bench_fatal("failed to end UBO access");
+}
+
+/* a damaged frame redraws only the center quarter of the output */
+static void bench_write_params(const struct bench *bench, int output,
+		const float rgba[4], bool damaged)
+{
+	const struct renderer_params params = {
+		.color = { rgba[0], rgba[1], rgba[2], rgba[3] },
+		.draw = {
+			.vertex_count = 3,
+			.instance_count = 1,
+		},
+		.damage_count = damaged ? 1 : 0,
+		.damage[0] = {
+			.x = bench->config.width / 4,
+			.y = bench->config.height / 4,
+			.width = bench->config.width / 2,
+			.height = bench->config.height / 2,
+		},
+	};
+	bench_upload_params(bench, output, &params);
+}
+
+static bool bench_render_frame(const struct bench *bench, int output,
+		const float rgba[4], bool damaged)
+{
+	bench_write_params(bench, output, rgba, damaged);
+
+	/* without a deadline, the renderer never drops */
+	const struct vkmemfd_request req = { .output = output };
+	uint32_t val;
+	if (!bench_send(bench, &req) || !vkmemfd_wait(bench->renderer.in, &val))
+		return false;
+	if (val != output)
+		bench_fatal("unexpected renderer output");
+
+	return true;
+}
+
+/* from 0 for the first output to 1 for the last one */
+static float bench_output_shade(const struct bench *bench, int output)
+{
+	const int count = bench->config.output_count;
+	return count > 1 ? (float) output / (count - 1) : 1.0f;
+}
+
+/* Render every output in rounds, sending as many requests as the renderer
+ * queues at once, and return the outputs per second.
+ */
+static bool bench_render_bulk(const struct bench *bench, uint32_t flags,
+		int round_count, double *fps)
+{
+	const int count = bench->config.output_count;
+	for (int i = 0; i < count; i++) {
+		float rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		rgba[i % 3] = bench_output_shade(bench, i);
+		bench_write_params(bench, i, rgba, false);
+	}
+
+	/* the renderer queues up to 16 requests */
+	struct vkmemfd_request reqs[16];
+	const uint64_t begin = bench_now();
+	for (int r = 0; r < round_count; r++) {
+		for (int first = 0; first < count; first += ARRAY_SIZE(reqs)) {
+			const int n = count - first < ARRAY_SIZE(reqs) ?
+				count - first : ARRAY_SIZE(reqs);
+			for (int i = 0; i < n; i++) {
+				reqs[i] = (struct vkmemfd_request) {
+					.output = first + i,
+					.flags = flags,
+				};
+			}
+
+			if (!vkmemfd_submit(bench->renderer.out, reqs, n))
+				return false;
+			for (int i = 0; i < n; i++) {
+				uint32_t val;
+				if (!vkmemfd_wait(bench->renderer.in, &val))
+					return false;
+				if (val & VKMEMFD_REPLY_DROPPED)
+					bench_fatal("unexpected dropped output");
+			}
+		}
+	}
+	const uint64_t end = bench_now();
+
+	*fps = (double) count * round_count * 1e9 / (end - begin);
+
+	return true;
+}
+
+/* the cache maintenance main does for incoherent heaps */
+static void bench_flush_frame(const struct bench *bench, int output)
+{
+	if (bench->transport == BENCH_TRANSPORT_EXPORT) {
+		if (dmabuf_sync_start(bench->exports.fds[1 + output], false) ||
+				dmabuf_sync_end(bench->exports.fds[1 + output],
+					false))
+			bench_fatal("failed to sync output");
+		return;
+	}
+
+	const void *ptr = bench->mems.outputs[output];
+	const void *end = ptr + bench->img_size;
+	while (ptr < end) {
+		__builtin_ia32_clflush(ptr);
+		ptr += 64;
+	}
+	__builtin_ia32_mfence();
+}
+
+static void bench_readback_frame(const struct bench *bench, int output,
+		readback_func func)
+{
+	const bool sync = bench->transport == BENCH_TRANSPORT_EXPORT;
+
+	if (sync && dmabuf_sync_start(bench->exports.fds[1 + output], false))
+		bench_fatal("failed to start output access");
+	func(bench->staging, bench->mems.outputs[output], bench->img_size);
+	if (sync && dmabuf_sync_end(bench->exports.fds[1 + output], false))
+		bench_fatal("failed to end output access");
+}
+
+static void bench_fini(struct bench *bench)
+{
+	if (bench->renderer.pid > 0) {
+		/* the renderer exits when the control pipe is closed */
+		close(bench->renderer.in);
+		close(bench->renderer.out);
+		waitpid(bench->renderer.pid, NULL, 0);
+	}
+
+	if (bench->exports.fds) {
+		for (int i = 0; i < 1 + bench->config.output_count; i++) {
+			const size_t size = i ? bench->layout.output_size :
+				bench->layout.ubo_size;
+			if (bench->exports.ptrs[i])
+				munmap(bench->exports.ptrs[i], size);
+			if (bench->exports.fds[i] >= 0)
+				close(bench->exports.fds[i]);
+		}
+		free(bench->exports.fds);
+		free(bench->exports.ptrs);
+	}
+
+	if (bench->heap.shmid >= 0) {
+		if (bench->heap.base)
+			shmdt(bench->heap.base);
+		shmctl(bench->heap.shmid, IPC_RMID, NULL);
+	} else if (bench->heap.base) {
+		munmap(bench->heap.base, bench->config.heap_size);
+	}
+	if (bench->heap.fd >= 0)
+		close(bench->heap.fd);
+
+	free(bench->mems.outputs);
+	free(bench->staging);
+}
+
+/* spawn the renderer and map the memories; is_cached is whether all outputs
+ * are host-cached
+ */
+static bool bench_init_session(struct bench *bench, bool *is_cached)
+{
+	if (!bench_init_heap(bench) || !bench_init_renderer(bench))
+		return false;
+
+	/* the row pitch and the tile size of linear outputs are implied; the
+	 * planes and previews of replays are never read
+	 */
+	struct vkmemfd_layout layout;
+	if (!vkmemfd_recv_layout(bench->renderer.in, &layout))
+		return false;
+	bench->layout.heap_skip = layout.base_skip;
+	bench->layout.ubo_size = layout.ubo_size;
+	bench->layout.output_size = layout.output_size;
+	bench->layout.ubo_stride = layout.ubo_stride;
+
+	/* the renderer has attached to the segment */
+	if (bench->heap.shmid >= 0)
+		shmctl(bench->heap.shmid, IPC_RMID, NULL);
+
+	if (!bench_init_memories(bench))
+		return false;
+
+	/* the memory property flags of the outputs */
+	*is_cached = true;
+	for (int i = 0; i < bench->config.output_count; i++) {
+		uint32_t mem_flags;
+		if (!bench_recv(bench, &mem_flags))
+			return false;
+		if (readback_pick_method(mem_flags) != READBACK_METHOD_PREFETCH)
+			*is_cached = false;
+	}
+
+	return true;
+}
+
+static bool bench_run(struct bench *bench, struct bench_result *result)
+{
+	const uint64_t setup_begin = bench_now();
+
+	if (!bench_init_session(bench, &result->is_cached))
+		return false;
+
+	/* the first frame waits for the renderer to finish initialization */
+	const float warmup[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	if (!bench_render_frame(bench, 0, warmup, false))
+		return false;
+
+	result->setup_ms = (bench_now() - setup_begin) / 1e6;
+
+	uint64_t frame_min = UINT64_MAX;
+	uint64_t frame_max = 0;
+	uint64_t frame_total = 0;
+	uint64_t readback_totals[READBACK_METHOD_COUNT] = { 0 };
+	int readback_counts[READBACK_METHOD_COUNT] = { 0 };
+	uint64_t flush_total = 0;
+	for (int i = 0; i < bench->config.frame_count; i++) {
+		const int output = i % bench->config.output_count;
+		float rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		rgba[i % 3] = bench_output_shade(bench, output);
+
+		const uint64_t frame_begin = bench_now();
+		if (!bench_render_frame(bench, output, rgba, false))
+			return false;
+		const uint64_t frame_end = bench_now();
+		/* take turns */
+		const enum readback_method method = i % READBACK_METHOD_COUNT;
+		const readback_func func = readback_get_func(method);
+		if (func)
+			bench_readback_frame(bench, output, func);
+		const uint64_t readback_end = bench_now();
+		bench_flush_frame(bench, output);
+		flush_total += bench_now() - readback_end;
+
+		const uint64_t frame = frame_end - frame_begin;
+		if (frame_min > frame)
+			frame_min = frame;
+		if (frame_max < frame)
+			frame_max = frame;
+		frame_total += frame;
+		if (func) {
+			readback_totals[method] += readback_end - frame_end;
+			readback_counts[method]++;
+		}
+	}
+
+	result->frame_min_ms = frame_min / 1e6;
+	result->frame_avg_ms = frame_total / 1e6 / bench->config.frame_count;
+	result->frame_max_ms = frame_max / 1e6;
+	for (int m = 0; m < READBACK_METHOD_COUNT; m++) {
+		result->readback_gbps[m] = readback_counts[m] ?
+			(double) bench->img_size * readback_counts[m] /
+			readback_totals[m] : 0.0;
+	}
+	result->flush_ms = flush_total / 1e6 / bench->config.frame_count;
+
+	/* incremental frames, a quarter of the frames as many */
+	const int damage_count = bench->config.frame_count / 4 ?
+		bench->config.frame_count / 4 : 1;
+	const uint64_t damage_begin = bench_now();
+	for (int i = 0; i < damage_count; i++) {
+		const int output = i % bench->config.output_count;
+		float rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		rgba[i % 3] = bench_output_shade(bench, output);
+		if (!bench_render_frame(bench, output, rgba, true))
+			return false;
+	}
+	result->damage_ms = (bench_now() - damage_begin) / 1e6 / damage_count;
+
+	/* bulk generation, as many outputs as frames */
+	int round_count = bench->config.frame_count / bench->config.output_count;
+	if (!round_count)
+		round_count = 1;
+	if (!bench_render_bulk(bench, 0, round_count, &result->bulk_fps) ||
+			!bench_render_bulk(bench, VKMEMFD_REQUEST_BATCH,
+				round_count, &result->batch_fps))
+		return false;
+
+	return true;
+}
+
+static bool bench_replay_flush(const struct bench *bench,
+		struct bench_replay *replay)
+{
+	if (!replay->queued_count)
+		return true;
+	if (!vkmemfd_submit(bench->renderer.out, replay->reqs,
+				replay->queued_count))
+		return false;
+	replay->queued_count = 0;
+	return true;
+}
+
+static bool bench_replay_wait(const struct bench *bench,
+		struct bench_replay *replay, struct bench_replay_result *result)
+{
+	/* queued requests would never be replied to */
+	if (!bench_replay_flush(bench, replay))
+		return false;
+
+	uint32_t val;
+	if (!vkmemfd_wait(bench->renderer.in, &val))
+		return false;
+	const uint32_t output = val & ~VKMEMFD_REPLY_DROPPED;
+	if (output >= (uint32_t) bench->config.output_count ||
+			!replay->inflight[output])
+		bench_fatal("unexpected renderer output");
+
+	if (val & VKMEMFD_REPLY_DROPPED) {
+		result->dropped_count++;
+	} else {
+		const uint64_t latency = bench_now() -
+			replay->request_times[output];
+		if (replay->latency_max < latency)
+			replay->latency_max = latency;
+		replay->latency_total += latency;
+		replay->completed_count++;
+	}
+
+	replay->inflight[output] = false;
+	replay->inflight_count--;
+
+	return true;
+}
+
+/* Send the requests of a trace as they were recorded: with the same params,
+ * deadlines, batches, and pipeline depth, and at the recorded times unless
+ * max_speed.  An output is not requested again before its reply.
+ */
+static bool bench_replay(struct bench *bench, struct trace_reader *trace,
+		bool max_speed, struct bench_replay_result *result)
+{
+	bool is_cached;
+	if (!bench_init_session(bench, &is_cached))
+		return false;
+
+	/* the first frame waits for the renderer to finish initialization */
+	const float warmup[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	if (!bench_render_frame(bench, 0, warmup, false))
+		return false;
+
+	struct bench_replay replay = {
+		.inflight = calloc(bench->config.output_count,
+				sizeof(replay.inflight[0])),
+		.request_times = calloc(bench->config.output_count,
+				sizeof(replay.request_times[0])),
+	};
+	if (!replay.inflight || !replay.request_times)
+		bench_fatal("failed to allocate replay state");
+
+	/* the renderer queues up to 16 requests */
+	const int batch_size = trace->header.batch_size > 1 ?
+		trace->header.batch_size : 1;
+	int pipeline_depth = trace->header.pipeline_depth;
+	if (pipeline_depth < batch_size)
+		pipeline_depth = batch_size;
+	if (pipeline_depth > (int) ARRAY_SIZE(replay.reqs))
+		pipeline_depth = ARRAY_SIZE(replay.reqs);
+	if (pipeline_depth > bench->config.output_count)
+		pipeline_depth = bench->config.output_count;
+
+	memset(result, 0, sizeof(*result));
+
+	bool ok = true;
+	const uint64_t begin = bench_now();
+	uint64_t request_time = begin;
+	struct trace_request treq;
+	while (ok && trace_read(trace, &treq)) {
+		while (ok && (replay.inflight_count >= pipeline_depth ||
+					replay.inflight[treq.output]))
+			ok = bench_replay_wait(bench, &replay, result);
+		if (!ok)
+			break;
+
+		/* fall behind rather than catch up in a burst */
+		request_time += treq.delay;
+		uint64_t now = bench_now();
+		if (!max_speed && request_time > now) {
+			const struct timespec ts = {
+				.tv_sec = request_time / 1000000000,
+				.tv_nsec = request_time % 1000000000,
+			};
+			clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts,
+					NULL);
+			now = bench_now();
+		} else if (request_time < now) {
+			request_time = now;
+		}
+
+		bench_upload_params(bench, treq.output, &treq.params);
+
+		const struct vkmemfd_request req = {
+			.output = treq.output,
+			.flags = treq.flags,
+			.deadline = treq.deadline ? now + treq.deadline : 0,
+		};
+		replay.inflight[req.output] = true;
+		replay.inflight_count++;
+		replay.request_times[req.output] = now;
+		result->request_count++;
+
+		replay.reqs[replay.queued_count++] = req;
+		if (!(req.flags & VKMEMFD_REQUEST_BATCH) ||
+				replay.queued_count == batch_size)
+			ok = bench_replay_flush(bench, &replay);
+	}
+	while (ok && replay.inflight_count)
+		ok = bench_replay_wait(bench, &replay, result);
+	const uint64_t end = bench_now();
+
+	if (ok) {
+		result->duration_ms = (end - begin) / 1e6;
+		result->fps = end > begin ?
+			replay.completed_count * 1e9 / (end - begin) : 0.0;
+		result->latency_avg_ms = replay.completed_count ?
+			replay.latency_total / 1e6 / replay.completed_count :
+			0.0;
+		result->latency_max_ms = replay.latency_max / 1e6;
+	}
+
+	free(replay.inflight);
+	free(replay.request_times);
+
+	return ok;
+}
+
+/* return GB/s of source pixels */
+static double bench_convert_func(convert_func func, void *dst, const void *src,
+		size_t count, int iters)
+{
+	/* warm up */
+	func(dst, src, count);
+
+	const uint64_t begin = bench_now();
+	for (int i = 0; i < iters; i++)
+		func(dst, src, count);
+	const uint64_t end = bench_now();
+
+	return (double) count * 4 * iters / (end - begin);
+}
+
+static void bench_memcpy(void *dst, const void *src, size_t count)
+{
+	memcpy(dst, src, count * 4);
+}
+
+static void bench_add_metric(struct bench_metrics *metrics, const char *name,
+		double value, bool higher_is_better)
+{
+	if (metrics->count >= ARRAY_SIZE(metrics->entries))
+		bench_fatal("too many metrics");
+
+	snprintf(metrics->entries[metrics->count].name,
+			sizeof(metrics->entries[0].name), "%s", name);
+	metrics->entries[metrics->count].value = value;
+	metrics->entries[metrics->count].higher_is_better = higher_is_better;
+	metrics->count++;
+}
+
+static void bench_add_result(struct bench_metrics *metrics,
+		const char *transport, const struct bench_result *result)
+{
+	char name[64];
+
+	snprintf(name, sizeof(name), "%s.setup_ms", transport);
+	bench_add_metric(metrics, name, result->setup_ms, false);
+	snprintf(name, sizeof(name), "%s.frame_ms", transport);
+	bench_add_metric(metrics, name, result->frame_avg_ms, false);
+	for (int m = 0; m < READBACK_METHOD_COUNT; m++) {
+		if (!result->readback_gbps[m])
+			continue;
+		snprintf(name, sizeof(name), "%s.readback_%s_gbps", transport,
+				readback_method_name(m));
+		bench_add_metric(metrics, name, result->readback_gbps[m], true);
+	}
+	snprintf(name, sizeof(name), "%s.flush_ms", transport);
+	bench_add_metric(metrics, name, result->flush_ms, false);
+	snprintf(name, sizeof(name), "%s.damage_ms", transport);
+	bench_add_metric(metrics, name, result->damage_ms, false);
+	snprintf(name, sizeof(name), "%s.bulk_fps", transport);
+	bench_add_metric(metrics, name, result->bulk_fps, true);
+	snprintf(name, sizeof(name), "%s.batch_fps", transport);
+	bench_add_metric(metrics, name, result->batch_fps, true);
+}
+
+static void bench_write_json(const struct bench_metrics *metrics,
+		const char *path)
+{
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+		bench_fatal("failed to open the json file");
+
+	fprintf(fp, "{\n");
+	for (int i = 0; i < metrics->count; i++) {
+		fprintf(fp, "  \"%s\": %.6g%s\n", metrics->entries[i].name,
+				metrics->entries[i].value,
+				i + 1 < metrics->count ? "," : "");
+	}
+	fprintf(fp, "}\n");
+
+	if (fclose(fp))
+		bench_fatal("failed to write the json file");
+}
+
+/* The baseline is a flat JSON object of numbers, as written by
+ * bench_write_json.  Return the number of regressions, counting the metrics
+ * missing from this run, e.g., of transports that became unavailable.
+ */
+static int bench_compare_baseline(const struct bench_metrics *metrics,
+		const char *path, double tolerance)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		bench_fatal("failed to open the baseline");
+
+	int regression_count = 0;
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		char name[64];
+		double baseline;
+		if (sscanf(line, " \"%63[^\"]\" : %lf", name, &baseline) != 2)
+			continue;
+
+		int i;
+		for (i = 0; i < metrics->count; i++) {
+			if (!strcmp(metrics->entries[i].name, name))
+				break;
+		}
+		if (i == metrics->count) {
+			printf("%-40s %12.3f %12s %9s  REGRESSION\n", name,
+					baseline, "missing", "");
+			regression_count++;
+			continue;
+		}
+		if (baseline <= 0.0)
+			continue;
+
+		const double value = metrics->entries[i].value;
+		const double change = (value - baseline) / baseline * 100.0;
+		const bool regressed = metrics->entries[i].higher_is_better ?
+			-change > tolerance : change > tolerance;
+		if (regressed)
+			regression_count++;
+
+		printf("%-40s %12.3f %12.3f %+8.1f%%%s\n", name, baseline, value,
+				change, regressed ? "  REGRESSION" : "");
+	}
+	fclose(fp);
+
+	return regression_count;
+}
+
+static void bench_convert(const struct bench *bench,
+		struct bench_metrics *metrics)
+{
+	const size_t count = (size_t) bench->config.width * bench->config.height;
+	const int iters = bench->config.frame_count;
+	uint32_t *src = malloc(count * 4);
+	void *dst = malloc(count * 4);
+	if (!src || !dst)
+		bench_fatal("failed to allocate conversion buffers");
+
+	for (size_t i = 0; i < count; i++)
+		src[i] = i * 2654435761u;
+
+	const double memcpy_gbps =
+		bench_convert_func(bench_memcpy, dst, src, count, iters);
+	printf("%-20s %10.2f GB/s\n", "memcpy", memcpy_gbps);
+	bench_add_metric(metrics, "convert.memcpy_gbps", memcpy_gbps, true);
+
+	for (int f = 0; f < CONVERT_FORMAT_COUNT; f++) {
+		/* a plain memcpy */
+		if (f == CONVERT_FORMAT_XRGB8888)
+			continue;
+
+		printf("%-20s", convert_format_name(f));
+		for (int isa = 0; isa < CONVERT_ISA_COUNT; isa++) {
+			const convert_func func = convert_get_func(f, isa);
+			if (!func) {
+				printf(" %8s n/a", convert_isa_name(isa));
+				continue;
+			}
+			const double gbps = bench_convert_func(func, dst, src,
+					count, iters);
+			printf(" %8s %5.2f", convert_isa_name(isa), gbps);
+
+			char name[64];
+			snprintf(name, sizeof(name), "convert.%s.%s_gbps",
+					convert_format_name(f),
+					convert_isa_name(isa));
+			bench_add_metric(metrics, name, gbps, true);
+		}
+		printf(" GB/s\n");
+	}
+
+	printf("%-20s", "verify");
+	for (int isa = 0; isa < CONVERT_ISA_COUNT; isa++) {
+		const verify_func func = verify_get_func(isa);
+		if (!func) {
+			printf(" %8s n/a", convert_isa_name(isa));
+			continue;
+		}
+
+		/* every pixel is bad, so nothing is optimized away */
+		size_t bad = func(src, 0, count);
+		const uint64_t begin = bench_now();
+		for (int i = 0; i < iters; i++)
+			bad += func(src, 0, count);
+		const uint64_t end = bench_now();
+		if (!bad)
+			bench_fatal("verify found nothing");
+
+		const double gbps = (double) count * 4 * iters / (end - begin);
+		printf(" %8s %5.2f", convert_isa_name(isa), gbps);
+
+		char name[64];
+		snprintf(name, sizeof(name), "verify.%s_gbps",
+				convert_isa_name(isa));
+		bench_add_metric(metrics, name, gbps, true);
+	}
+	printf(" GB/s\n");
+
+	free(src);
+	free(dst);
+}
+
+static void bench_upload(struct bench_metrics *metrics)
+{
+	const size_t max_size = 64 << 20;
+	void *dst = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	void *src = malloc(max_size);
+	if (dst == MAP_FAILED || !src)
+		bench_fatal("failed to allocate upload buffers");
+	memset(src, 0x5a, max_size);
+
+	printf("%-12s %16s %16s\n", "upload size", "copy (us/MB)",
+			"stream (us/MB)");
+	for (size_t size = 4096; size <= max_size; size *= 4) {
+		const double copy = upload_measure(dst, src, size, false) / 1e3;
+		const double stream = upload_measure(dst, src, size, true) / 1e3;
+		printf("%-12zu %16.1f %16.1f\n", size, copy, stream);
+
+		char name[64];
+		snprintf(name, sizeof(name), "upload.%zu.copy_us_per_mb", size);
+		bench_add_metric(metrics, name, copy, false);
+		snprintf(name, sizeof(name), "upload.%zu.stream_us_per_mb", size);
+		bench_add_metric(metrics, name, stream, false);
+	}
+
+	munmap(dst, max_size);
+	free(src);
+
+	/* main writes the params of one output at a time */
+	const size_t threshold = upload_calibrate(
+			sizeof(struct renderer_params),
+			sizeof(struct renderer_params));
+	if (threshold == UPLOAD_NEVER)
+		printf("calibrated threshold: never stream\n");
+	else
+		printf("calibrated threshold: %zu bytes\n", threshold);
+}
+
+static uint64_t bench_sum(const uint32_t *pixels, size_t count)
+{
+	uint64_t sum = 0;
+	for (size_t i = 0; i < count; i++)
+		sum += pixels[i];
+	return sum;
+}
+
+/* read 64x64 blocks, as tile-based consumers do; this is also the memory order
+ * of tiled outputs
+ */
+static uint64_t bench_scan_blocks(const struct layout *layout, const void *src)
+{
+	const int size = 64;
+	uint64_t sum = 0;
+	for (int by = 0; by < layout->height; by += size) {
+		for (int bx = 0; bx < layout->width; bx += size) {
+			const int width = layout->width - bx < size ?
+				layout->width - bx : size;
+			const int height = layout->height - by < size ?
+				layout->height - by : size;
+			for (int y = by; y < by + height; y++) {
+				sum += bench_sum((const void *) ((const char *) src +
+							layout_offset(layout, bx, y)),
+						width);
+			}
+		}
+	}
+	return sum;
+}
+
+/* read every pixel in the memory order of the layout */
+static uint64_t bench_scan_layout(const struct layout *layout, const void *src)
+{
+	if (layout->type == VKMEMFD_OUTPUT_TILED)
+		return bench_scan_blocks(layout, src);
+
+	uint64_t sum = 0;
+	for (int y = 0; y < layout->height; y++) {
+		sum += bench_sum((const void *) ((const char *) src +
+					layout->row_pitch * y), layout->width);
+	}
+	return sum;
+}
+
+static void bench_layout(const struct bench *bench,
+		struct bench_metrics *metrics)
+{
+	const int width = bench->config.width;
+	const int height = bench->config.height;
+	const int iters = bench->config.frame_count;
+	const struct {
+		const char *name;
+		enum vkmemfd_output_layout type;
+		int row_align;
+	} layouts[] = {
+		{ "linear", VKMEMFD_OUTPUT_LINEAR, 4 },
+		{ "pitch64", VKMEMFD_OUTPUT_PITCHED, 64 },
+		{ "pitch4096", VKMEMFD_OUTPUT_PITCHED, 4096 },
+		{ "tiled", VKMEMFD_OUTPUT_TILED, 0 },
+	};
+
+	void *linear = malloc((size_t) width * height * 4);
+	if (!linear)
+		bench_fatal("failed to allocate layout buffers");
+
+	printf("%-12s %12s %12s %16s\n", "layout", "scan GB/s", "block GB/s",
+			"linearize GB/s");
+	for (int i = 0; i < ARRAY_SIZE(layouts); i++) {
+		struct layout layout = {
+			.type = layouts[i].type,
+			.width = width,
+			.height = height,
+		};
+		if (layout.type == VKMEMFD_OUTPUT_TILED) {
+			layout.tile_size = VKMEMFD_TILE_SIZE;
+			layout.row_pitch = VKMEMFD_TILE_SIZE * 4;
+		} else {
+			const size_t align = layouts[i].row_align;
+			layout.row_pitch = ((size_t) width * 4 + align - 1) /
+				align * align;
+		}
+
+		/* page-aligned, as the outputs are */
+		const size_t size = layout_size(&layout);
+		void *src = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (src == MAP_FAILED)
+			bench_fatal("failed to allocate layout buffers");
+		memset(src, 0x5a, size);
+
+		/* the sums are checked so that nothing is optimized away */
+		const uint64_t expected = bench_scan_layout(&layout, src);
+		const double pixel_bytes = (double) width * height * 4 * iters;
+
+		uint64_t begin = bench_now();
+		for (int it = 0; it < iters; it++) {
+			if (bench_scan_layout(&layout, src) != expected)
+				bench_fatal("layout scan mismatch");
+		}
+		const double scan = pixel_bytes / (bench_now() - begin);
+
+		begin = bench_now();
+		for (int it = 0; it < iters; it++) {
+			if (bench_scan_blocks(&layout, src) != expected)
+				bench_fatal("layout scan mismatch");
+		}
+		const double block = pixel_bytes / (bench_now() - begin);
+
+		begin = bench_now();
+		for (int it = 0; it < iters; it++)
+			layout_linearize(&layout, linear, src);
+		const double linearize = pixel_bytes / (bench_now() - begin);
+
+		printf("%-12s %12.2f %12.2f %16.2f\n", layouts[i].name, scan,
+				block, linearize);
+
+		char name[64];
+		snprintf(name, sizeof(name), "layout.%s.scan_gbps",
+				layouts[i].name);
+		bench_add_metric(metrics, name, scan, true);
+		snprintf(name, sizeof(name), "layout.%s.block_gbps",
+				layouts[i].name);
+		bench_add_metric(metrics, name, block, true);
+		snprintf(name, sizeof(name), "layout.%s.linearize_gbps",
+				layouts[i].name);
+		bench_add_metric(metrics, name, linearize, true);
+
+		munmap(src, size);
+	}
+
+	free(linear);
+}
+
+/* replay over a memfd, the default transport of vkmemfd */
+static void bench_replay_trace(const struct bench *bench, const char *path,
+		bool max_speed, struct bench_metrics *metrics)
+{
+	struct trace_reader trace;
+	if (!trace_reader_init(&trace, path))
+		bench_fatal("failed to open the trace");
+
+	const struct trace_header *hdr = &trace.header;
+	struct bench run = {
+		.config = bench->config,
+		.transport = BENCH_TRANSPORT_MEMFD,
+	};
+	run.config.width = hdr->width;
+	run.config.height = hdr->height;
+	run.config.output_count = hdr->output_count;
+	run.config.layout = hdr->layout;
+	run.config.row_align = hdr->row_align;
+	run.config.preview_levels = hdr->preview_levels;
+	/* leave room for padded rows, tiles, and previews too */
+	run.config.heap_size = ((size_t) hdr->width * hdr->height * 4 * 2 +
+			65536) * (hdr->output_count + 1);
+
+	printf("\nreplaying %s: %ux%u, %u outputs, pipeline %u, batch %u, "
+			"%s speed\n", path, hdr->width, hdr->height,
+			hdr->output_count, hdr->pipeline_depth,
+			hdr->batch_size > 1 ? hdr->batch_size : 1,
+			max_speed ? "max" : "recorded");
+
+	struct bench_replay_result result;
+	if (bench_replay(&run, &trace, max_speed, &result)) {
+		printf("%12s %12s %14s %12s %12s %12s\n", "requests",
+				"dropped", "duration (ms)", "fps",
+				"avg (ms)", "max (ms)");
+		printf("%12d %12d %14.1f %12.1f %12.3f %12.3f\n",
+				result.request_count, result.dropped_count,
+				result.duration_ms, result.fps,
+				result.latency_avg_ms, result.latency_max_ms);
+
+		bench_add_metric(metrics, "replay.fps", result.fps, true);
+		bench_add_metric(metrics, "replay.latency_ms",
+				result.latency_avg_ms, false);
+		bench_add_metric(metrics, "replay.dropped",
+				result.dropped_count, false);
+	} else {
+		printf("replay failed\n");
+	}
+
+	bench_fini(&run);
+	trace_reader_fini(&trace);
+}
+
+static void bench_usage(const char *argv0)
+{
+	printf("Usage: %s [frames=N] [size=WxH] [memfd] [udmabuf] [shm_open] "
+			"[sysv] [export] [convert] [upload] [layout] [replay=PATH] "
+			"[replay-speed=recorded|max] [json=PATH] "
+			"[baseline=PATH] [tolerance=PCT]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct bench bench = {
+		.config = {
+			.name = "vkmemfd-bench",
+			.width = 600,
+			.height = 600,
+			.output_count = 64,
+			.frame_count = 1000,
+		},
+	};
+	bool transports[BENCH_TRANSPORT_COUNT] = { false };
+	bool has_transport = false;
+	bool convert = false;
+	bool uploads = false;
+	bool layouts = false;
+	const char *replay_path = NULL;
+	bool replay_max_speed = false;
+	const char *json_path = NULL;
+	const char *baseline_path = NULL;
+	double tolerance = 20.0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "frames=", 7)) {
+			bench.config.frame_count = atoi(argv[i] + 7);
+			if (bench.config.frame_count <= 0)
+				bench_usage(argv[0]);
+			continue;
+		} else if (!strncmp(argv[i], "size=", 5)) {
+			if (sscanf(argv[i] + 5, "%dx%d", &bench.config.width,
+						&bench.config.height) != 2 ||
+					bench.config.width <= 0 ||
+					bench.config.height <= 0)
+				bench_usage(argv[0]);
+			continue;
+		} else if (!strcmp(argv[i], "convert")) {
+			convert = true;
+			continue;
+		} else if (!strcmp(argv[i], "upload")) {
+			uploads = true;
+			continue;
+		} else if (!strcmp(argv[i], "layout")) {
+			layouts = true;
+			continue;
+		} else if (!strncmp(argv[i], "replay=", 7)) {
+			replay_path = argv[i] + 7;
+			continue;
+		} else if (!strcmp(argv[i], "replay-speed=recorded")) {
+			replay_max_speed = false;
+			continue;
+		} else if (!strcmp(argv[i], "replay-speed=max")) {
+			replay_max_speed = true;
+			continue;
+		} else if (!strncmp(argv[i], "json=", 5)) {
+			json_path = argv[i] + 5;
+			continue;
+		} else if (!strncmp(argv[i], "baseline=", 9)) {
+			baseline_path = argv[i] + 9;
+			continue;
+		} else if (!strncmp(argv[i], "tolerance=", 10)) {
+			tolerance = atof(argv[i] + 10);
+			if (tolerance <= 0.0)
+				bench_usage(argv[0]);
+			continue;
+		}
+
+		int t;
+		for (t = 0; t < BENCH_TRANSPORT_COUNT; t++) {
+			if (!strcmp(argv[i], bench_transports[t].name))
+				break;
+		}
+		if (t == BENCH_TRANSPORT_COUNT)
+			bench_usage(argv[0]);
+
+		transports[t] = true;
+		has_transport = true;
+	}
+
+	/* leave room for the alignment of every buffer */
+	bench.config.heap_size = ((size_t) bench.config.width *
+			bench.config.height * 4 + 65536) *
+		(bench.config.output_count + 1);
+
+	static struct bench_metrics metrics;
+
+	if (convert)
+		bench_convert(&bench, &metrics);
+	if (uploads)
+		bench_upload(&metrics);
+	if (layouts)
+		bench_layout(&bench, &metrics);
+
+	/* CPU-only benchmarks and replays skip the transports unless asked */
+	const bool skip_transports = (convert || uploads || layouts ||
+			replay_path) && !has_transport;
+
+	/* a dead renderer is reported rather than fatal */
+	signal(SIGPIPE, SIG_IGN);
+
+	if (!skip_transports) {
+		printf("%-10s %12s %12s %12s %12s", "transport",
+				"setup (ms)", "min (ms)", "avg (ms)", "max (ms)");
+		for (int m = 0; m < READBACK_METHOD_COUNT; m++) {
+			char name[32];
+			snprintf(name, sizeof(name), "%s GB/s",
+					readback_method_name(m));
+			printf(" %14s", name);
+		}
+		printf(" %12s %12s %12s %12s %9s\n", "flush (ms)",
+				"damage (ms)", "bulk (fps)", "batch (fps)",
+				"memory");
+	}
+	for (int t = 0; t < BENCH_TRANSPORT_COUNT; t++) {
+		if (skip_transports || (has_transport && !transports[t]))
+			continue;
+
+		struct bench run = {
+			.config = bench.config,
+			.transport = t,
+			.img_size = (size_t) bench.config.width *
+				bench.config.height * 4,
+		};
+		run.staging = malloc(run.img_size);
+		if (!run.staging)
+			bench_fatal("failed to allocate staging buffer");
+
+		struct bench_result result;
+		if (bench_run(&run, &result)) {
+			printf("%-10s %12.2f %12.3f %12.3f %12.3f",
+					bench_transports[t].name,
+					result.setup_ms, result.frame_min_ms,
+					result.frame_avg_ms, result.frame_max_ms);
+			for (int m = 0; m < READBACK_METHOD_COUNT; m++)
+				printf(" %14.2f", result.readback_gbps[m]);
+			printf(" %12.3f %12.3f %12.1f %12.1f %9s\n",
+					result.flush_ms, result.damage_ms,
+					result.bulk_fps, result.batch_fps,
+					result.is_cached ? "cached" : "uncached");
+			bench_add_result(&metrics, bench_transports[t].name,
+					&result);
+		} else {
+			printf("%-10s %12s\n", bench_transports[t].name,
+					"unavailable");
+		}
+
+		bench_fini(&run);
+	}
+
+	if (replay_path)
+		bench_replay_trace(&bench, replay_path, replay_max_speed, &metrics);
+
+	if (json_path)
+		bench_write_json(&metrics, json_path);
+
+	if (baseline_path) {
+		printf("\n%-40s %12s %12s %9s\n", "metric", "baseline", "now",
+				"change");
+		const int regression_count =
+			bench_compare_baseline(&metrics, baseline_path,
+					tolerance);
+		if (regression_count) {
+			printf("%d metrics regressed beyond %.1f%% or missing\n",
+					regression_count, tolerance);
+			return 1;
+		}
+	}
+
+	return 0;
+}
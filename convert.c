@@ -0,0 +1,527 @@
+#include "convert.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+/* scalar */
+
+static inline uint32_t convert_bswap32_scalar(uint32_t x)
+{
+	return __builtin_bswap32(x);
+}
+
+static inline uint32_t convert_565_scalar(uint32_t x)
+{
+	return ((x >> 8) & 0xf800) | ((x >> 5) & 0x07e0) | ((x >> 3) & 0x001f);
+}
+
+static inline uint32_t convert_bswap16_scalar(uint32_t x)
+{
+	return ((x << 8) & 0xff00) | ((x >> 8) & 0x00ff);
+}
+
+static inline uint32_t convert_2101010_scalar(uint32_t x)
+{
+	const uint32_t r = (x >> 16) & 0xff;
+	const uint32_t g = (x >> 8) & 0xff;
+	const uint32_t b = x & 0xff;
+
+	/* replicate the top bits */
+	return ((r << 2 | r >> 6) << 20) | ((g << 2 | g >> 6) << 10) |
+		(b << 2 | b >> 6);
+}
+
+static void convert_xrgb8888(void *dst, const void *src, size_t count)
+{
+	memcpy(dst, src, count * 4);
+}
+
+static void convert_xrgb8888_swapped_scalar(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	for (size_t i = 0; i < count; i++)
+		d[i] = convert_bswap32_scalar(s[i]);
+}
+
+static void convert_rgb565_scalar(void *dst, const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	for (size_t i = 0; i < count; i++)
+		d[i] = convert_565_scalar(s[i]);
+}
+
+static void convert_rgb565_swapped_scalar(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	for (size_t i = 0; i < count; i++)
+		d[i] = convert_bswap16_scalar(convert_565_scalar(s[i]));
+}
+
+static void convert_xrgb2101010_scalar(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	for (size_t i = 0; i < count; i++)
+		d[i] = convert_2101010_scalar(s[i]);
+}
+
+static void convert_xrgb2101010_swapped_scalar(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	for (size_t i = 0; i < count; i++)
+		d[i] = convert_bswap32_scalar(convert_2101010_scalar(s[i]));
+}
+
+/* SSE2; 4 pixels at a time */
+
+static inline __m128i convert_bswap16_sse2(__m128i x)
+{
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+static inline __m128i convert_bswap32_sse2(__m128i x)
+{
+	/* no pshufb; swap the bytes and then the words */
+	x = convert_bswap16_sse2(x);
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, 0xb1), 0xb1);
+}
+
+static inline __m128i convert_565_sse2(__m128i x)
+{
+	const __m128i r = _mm_and_si128(_mm_srli_epi32(x, 8), _mm_set1_epi32(0xf800));
+	const __m128i g = _mm_and_si128(_mm_srli_epi32(x, 5), _mm_set1_epi32(0x07e0));
+	const __m128i b = _mm_and_si128(_mm_srli_epi32(x, 3), _mm_set1_epi32(0x001f));
+	return _mm_or_si128(_mm_or_si128(r, g), b);
+}
+
+static inline __m128i convert_pack16_sse2(__m128i lo, __m128i hi)
+{
+	/* sign-extend such that the saturating pack keeps the bits */
+	lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+	hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+	return _mm_packs_epi32(lo, hi);
+}
+
+static inline __m128i convert_2101010_sse2(__m128i x)
+{
+	const __m128i mask = _mm_set1_epi32(0xff);
+	__m128i r = _mm_and_si128(_mm_srli_epi32(x, 16), mask);
+	__m128i g = _mm_and_si128(_mm_srli_epi32(x, 8), mask);
+	__m128i b = _mm_and_si128(x, mask);
+	r = _mm_or_si128(_mm_slli_epi32(r, 2), _mm_srli_epi32(r, 6));
+	g = _mm_or_si128(_mm_slli_epi32(g, 2), _mm_srli_epi32(g, 6));
+	b = _mm_or_si128(_mm_slli_epi32(b, 2), _mm_srli_epi32(b, 6));
+	return _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 20),
+				_mm_slli_epi32(g, 10)), b);
+}
+
+static void convert_xrgb8888_swapped_sse2(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *) (s + i));
+		_mm_storeu_si128((__m128i *) (d + i), convert_bswap32_sse2(x));
+	}
+	convert_xrgb8888_swapped_scalar(d + i, s + i, count - i);
+}
+
+static void convert_rgb565_sse2(void *dst, const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m128i lo = _mm_loadu_si128((const __m128i *) (s + i));
+		const __m128i hi = _mm_loadu_si128((const __m128i *) (s + i + 4));
+		_mm_storeu_si128((__m128i *) (d + i), convert_pack16_sse2(
+					convert_565_sse2(lo), convert_565_sse2(hi)));
+	}
+	convert_rgb565_scalar(d + i, s + i, count - i);
+}
+
+static void convert_rgb565_swapped_sse2(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m128i lo = _mm_loadu_si128((const __m128i *) (s + i));
+		const __m128i hi = _mm_loadu_si128((const __m128i *) (s + i + 4));
+		const __m128i x = convert_pack16_sse2(convert_565_sse2(lo),
+				convert_565_sse2(hi));
+		_mm_storeu_si128((__m128i *) (d + i), convert_bswap16_sse2(x));
+	}
+	convert_rgb565_swapped_scalar(d + i, s + i, count - i);
+}
+
+static void convert_xrgb2101010_sse2(void *dst, const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *) (s + i));
+		_mm_storeu_si128((__m128i *) (d + i), convert_2101010_sse2(x));
+	}
+	convert_xrgb2101010_scalar(d + i, s + i, count - i);
+}
+
+static void convert_xrgb2101010_swapped_sse2(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *) (s + i));
+		_mm_storeu_si128((__m128i *) (d + i),
+				convert_bswap32_sse2(convert_2101010_sse2(x)));
+	}
+	convert_xrgb2101010_swapped_scalar(d + i, s + i, count - i);
+}
+
+/* AVX2; 8 pixels at a time */
+
+#define CONVERT_AVX2 __attribute__((target("avx2")))
+
+CONVERT_AVX2 static inline __m256i convert_bswap16_avx2(__m256i x)
+{
+	return _mm256_or_si256(_mm256_slli_epi16(x, 8), _mm256_srli_epi16(x, 8));
+}
+
+CONVERT_AVX2 static inline __m256i convert_bswap32_avx2(__m256i x)
+{
+	const __m256i idx = _mm256_setr_epi8(
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+			3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	return _mm256_shuffle_epi8(x, idx);
+}
+
+CONVERT_AVX2 static inline __m256i convert_565_avx2(__m256i x)
+{
+	const __m256i r = _mm256_and_si256(_mm256_srli_epi32(x, 8), _mm256_set1_epi32(0xf800));
+	const __m256i g = _mm256_and_si256(_mm256_srli_epi32(x, 5), _mm256_set1_epi32(0x07e0));
+	const __m256i b = _mm256_and_si256(_mm256_srli_epi32(x, 3), _mm256_set1_epi32(0x001f));
+	return _mm256_or_si256(_mm256_or_si256(r, g), b);
+}
+
+CONVERT_AVX2 static inline __m256i convert_pack16_avx2(__m256i lo, __m256i hi)
+{
+	/* the values fit in 16 bits, and packus does not saturate them */
+	const __m256i x = _mm256_packus_epi32(lo, hi);
+	/* packus works within 128-bit lanes */
+	return _mm256_permute4x64_epi64(x, 0xd8);
+}
+
+CONVERT_AVX2 static inline __m256i convert_2101010_avx2(__m256i x)
+{
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	__m256i r = _mm256_and_si256(_mm256_srli_epi32(x, 16), mask);
+	__m256i g = _mm256_and_si256(_mm256_srli_epi32(x, 8), mask);
+	__m256i b = _mm256_and_si256(x, mask);
+	r = _mm256_or_si256(_mm256_slli_epi32(r, 2), _mm256_srli_epi32(r, 6));
+	g = _mm256_or_si256(_mm256_slli_epi32(g, 2), _mm256_srli_epi32(g, 6));
+	b = _mm256_or_si256(_mm256_slli_epi32(b, 2), _mm256_srli_epi32(b, 6));
+	return _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 20),
+				_mm256_slli_epi32(g, 10)), b);
+}
+
+CONVERT_AVX2 static void convert_xrgb8888_swapped_avx2(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *) (s + i));
+		_mm256_storeu_si256((__m256i *) (d + i), convert_bswap32_avx2(x));
+	}
+	convert_xrgb8888_swapped_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX2 static void convert_rgb565_avx2(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m256i lo = _mm256_loadu_si256((const __m256i *) (s + i));
+		const __m256i hi = _mm256_loadu_si256((const __m256i *) (s + i + 8));
+		_mm256_storeu_si256((__m256i *) (d + i), convert_pack16_avx2(
+					convert_565_avx2(lo), convert_565_avx2(hi)));
+	}
+	convert_rgb565_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX2 static void convert_rgb565_swapped_avx2(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m256i lo = _mm256_loadu_si256((const __m256i *) (s + i));
+		const __m256i hi = _mm256_loadu_si256((const __m256i *) (s + i + 8));
+		const __m256i x = convert_pack16_avx2(convert_565_avx2(lo),
+				convert_565_avx2(hi));
+		_mm256_storeu_si256((__m256i *) (d + i), convert_bswap16_avx2(x));
+	}
+	convert_rgb565_swapped_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX2 static void convert_xrgb2101010_avx2(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *) (s + i));
+		_mm256_storeu_si256((__m256i *) (d + i), convert_2101010_avx2(x));
+	}
+	convert_xrgb2101010_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX2 static void convert_xrgb2101010_swapped_avx2(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *) (s + i));
+		_mm256_storeu_si256((__m256i *) (d + i),
+				convert_bswap32_avx2(convert_2101010_avx2(x)));
+	}
+	convert_xrgb2101010_swapped_scalar(d + i, s + i, count - i);
+}
+
+/* AVX-512; 16 pixels at a time */
+
+#define CONVERT_AVX512 __attribute__((target("avx512f,avx512bw")))
+
+CONVERT_AVX512 static inline __m512i convert_bswap32_avx512(__m512i x)
+{
+	const __m512i idx = _mm512_broadcast_i32x4(_mm_setr_epi8(
+				3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12));
+	return _mm512_shuffle_epi8(x, idx);
+}
+
+CONVERT_AVX512 static inline __m512i convert_565_avx512(__m512i x)
+{
+	const __m512i r = _mm512_and_si512(_mm512_srli_epi32(x, 8), _mm512_set1_epi32(0xf800));
+	const __m512i g = _mm512_and_si512(_mm512_srli_epi32(x, 5), _mm512_set1_epi32(0x07e0));
+	const __m512i b = _mm512_and_si512(_mm512_srli_epi32(x, 3), _mm512_set1_epi32(0x001f));
+	return _mm512_or_si512(_mm512_or_si512(r, g), b);
+}
+
+CONVERT_AVX512 static inline __m512i convert_2101010_avx512(__m512i x)
+{
+	const __m512i mask = _mm512_set1_epi32(0xff);
+	__m512i r = _mm512_and_si512(_mm512_srli_epi32(x, 16), mask);
+	__m512i g = _mm512_and_si512(_mm512_srli_epi32(x, 8), mask);
+	__m512i b = _mm512_and_si512(x, mask);
+	r = _mm512_or_si512(_mm512_slli_epi32(r, 2), _mm512_srli_epi32(r, 6));
+	g = _mm512_or_si512(_mm512_slli_epi32(g, 2), _mm512_srli_epi32(g, 6));
+	b = _mm512_or_si512(_mm512_slli_epi32(b, 2), _mm512_srli_epi32(b, 6));
+	return _mm512_or_si512(_mm512_or_si512(_mm512_slli_epi32(r, 20),
+				_mm512_slli_epi32(g, 10)), b);
+}
+
+CONVERT_AVX512 static void convert_xrgb8888_swapped_avx512(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m512i x = _mm512_loadu_si512(s + i);
+		_mm512_storeu_si512(d + i, convert_bswap32_avx512(x));
+	}
+	convert_xrgb8888_swapped_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX512 static void convert_rgb565_avx512(void *dst, const void *src,
+		size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m512i x = _mm512_loadu_si512(s + i);
+		_mm256_storeu_si256((__m256i *) (d + i),
+				_mm512_cvtepi32_epi16(convert_565_avx512(x)));
+	}
+	convert_rgb565_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX512 static void convert_rgb565_swapped_avx512(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint16_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		__m512i x = convert_565_avx512(_mm512_loadu_si512(s + i));
+		/* the values are in the low 16 bits */
+		x = _mm512_or_si512(_mm512_and_si512(_mm512_slli_epi32(x, 8),
+					_mm512_set1_epi32(0xff00)),
+				_mm512_srli_epi32(x, 8));
+		_mm256_storeu_si256((__m256i *) (d + i),
+				_mm512_cvtepi32_epi16(x));
+	}
+	convert_rgb565_swapped_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX512 static void convert_xrgb2101010_avx512(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m512i x = _mm512_loadu_si512(s + i);
+		_mm512_storeu_si512(d + i, convert_2101010_avx512(x));
+	}
+	convert_xrgb2101010_scalar(d + i, s + i, count - i);
+}
+
+CONVERT_AVX512 static void convert_xrgb2101010_swapped_avx512(void *dst,
+		const void *src, size_t count)
+{
+	const uint32_t *s = src;
+	uint32_t *d = dst;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m512i x = _mm512_loadu_si512(s + i);
+		_mm512_storeu_si512(d + i,
+				convert_bswap32_avx512(convert_2101010_avx512(x)));
+	}
+	convert_xrgb2101010_swapped_scalar(d + i, s + i, count - i);
+}
+
+static const convert_func convert_funcs[CONVERT_ISA_COUNT][CONVERT_FORMAT_COUNT] = {
+	[CONVERT_ISA_SCALAR] = {
+		convert_xrgb8888,
+		convert_xrgb8888_swapped_scalar,
+		convert_rgb565_scalar,
+		convert_rgb565_swapped_scalar,
+		convert_xrgb2101010_scalar,
+		convert_xrgb2101010_swapped_scalar,
+	},
+	[CONVERT_ISA_SSE2] = {
+		convert_xrgb8888,
+		convert_xrgb8888_swapped_sse2,
+		convert_rgb565_sse2,
+		convert_rgb565_swapped_sse2,
+		convert_xrgb2101010_sse2,
+		convert_xrgb2101010_swapped_sse2,
+	},
+	[CONVERT_ISA_AVX2] = {
+		convert_xrgb8888,
+		convert_xrgb8888_swapped_avx2,
+		convert_rgb565_avx2,
+		convert_rgb565_swapped_avx2,
+		convert_xrgb2101010_avx2,
+		convert_xrgb2101010_swapped_avx2,
+	},
+	[CONVERT_ISA_AVX512] = {
+		convert_xrgb8888,
+		convert_xrgb8888_swapped_avx512,
+		convert_rgb565_avx512,
+		convert_rgb565_swapped_avx512,
+		convert_xrgb2101010_avx512,
+		convert_xrgb2101010_swapped_avx512,
+	},
+};
+
+const char *convert_format_name(enum convert_format format)
+{
+	switch (format) {
+	case CONVERT_FORMAT_XRGB8888:
+		return "xrgb8888";
+	case CONVERT_FORMAT_XRGB8888_SWAPPED:
+		return "xrgb8888-swapped";
+	case CONVERT_FORMAT_RGB565:
+		return "rgb565";
+	case CONVERT_FORMAT_RGB565_SWAPPED:
+		return "rgb565-swapped";
+	case CONVERT_FORMAT_XRGB2101010:
+		return "xrgb2101010";
+	case CONVERT_FORMAT_XRGB2101010_SWAPPED:
+		return "xrgb2101010-swapped";
+	default:
+		return "unknown";
+	}
+}
+
+const char *convert_isa_name(enum convert_isa isa)
+{
+	switch (isa) {
+	case CONVERT_ISA_SCALAR:
+		return "scalar";
+	case CONVERT_ISA_SSE2:
+		return "sse2";
+	case CONVERT_ISA_AVX2:
+		return "avx2";
+	case CONVERT_ISA_AVX512:
+		return "avx512";
+	default:
+		return "unknown";
+	}
+}
+
+bool convert_isa_supported(enum convert_isa isa)
+{
+	__builtin_cpu_init();
+
+	switch (isa) {
+	case CONVERT_ISA_SCALAR:
+		return true;
+	case CONVERT_ISA_SSE2:
+		return __builtin_cpu_supports("sse2");
+	case CONVERT_ISA_AVX2:
+		return __builtin_cpu_supports("avx2");
+	case CONVERT_ISA_AVX512:
+		return __builtin_cpu_supports("avx512f") &&
+			__builtin_cpu_supports("avx512bw");
+	default:
+		return false;
+	}
+}
+
+enum convert_isa convert_detect_isa(void)
+{
+	for (int isa = CONVERT_ISA_COUNT - 1; isa > CONVERT_ISA_SCALAR; isa--) {
+		if (convert_isa_supported(isa))
+			return isa;
+	}
+
+	return CONVERT_ISA_SCALAR;
+}
+
+convert_func convert_get_func(enum convert_format format,
+		enum convert_isa isa)
+{
+	if (format >= CONVERT_FORMAT_COUNT || isa >= CONVERT_ISA_COUNT ||
+			!convert_isa_supported(isa))
+		return NULL;
+
+	return convert_funcs[isa][format];
+}
@@ -0,0 +1,41 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* destination formats; the source is always B8G8R8A8 */
+enum convert_format {
+	/* depth 24 or 32, LSBFirst; same as the source */
+	CONVERT_FORMAT_XRGB8888,
+	CONVERT_FORMAT_XRGB8888_SWAPPED,
+	/* depth 16 */
+	CONVERT_FORMAT_RGB565,
+	CONVERT_FORMAT_RGB565_SWAPPED,
+	/* depth 30 */
+	CONVERT_FORMAT_XRGB2101010,
+	CONVERT_FORMAT_XRGB2101010_SWAPPED,
+	CONVERT_FORMAT_COUNT,
+};
+
+enum convert_isa {
+	CONVERT_ISA_SCALAR,
+	CONVERT_ISA_SSE2,
+	CONVERT_ISA_AVX2,
+	CONVERT_ISA_AVX512,
+	CONVERT_ISA_COUNT,
+};
+
+typedef void (*convert_func)(void *dst, const void *src, size_t count);
+
+const char *convert_format_name(enum convert_format format);
+
+const char *convert_isa_name(enum convert_isa isa);
+bool convert_isa_supported(enum convert_isa isa);
+enum convert_isa convert_detect_isa(void);
+
+/* return NULL when the ISA is not supported by the CPU */
+convert_func convert_get_func(enum convert_format format,
+		enum convert_isa isa);
+
+#endif /* CONVERT_H */
@@ -0,0 +1,36 @@
+#include "dmabuf.h"
+
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+
+#define DMA_BUF_SYNC_READ (1 << 0)
+#define DMA_BUF_SYNC_WRITE (2 << 0)
+#define DMA_BUF_SYNC_START (0 << 2)
+#define DMA_BUF_SYNC_END (1 << 2)
+struct dma_buf_sync {
+	uint64_t flags;
+};
+
+#define DMA_BUF_IOCTL_SYNC _IOW('b', 0, struct dma_buf_sync)
+
+static int dmabuf_sync(int fd, uint64_t flags)
+{
+	struct dma_buf_sync sync = {
+		.flags = flags,
+	};
+
+	return ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync);
+}
+
+int dmabuf_sync_start(int fd, bool write)
+{
+	return dmabuf_sync(fd, DMA_BUF_SYNC_START |
+			(write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ));
+}
+
+int dmabuf_sync_end(int fd, bool write)
+{
+	return dmabuf_sync(fd, DMA_BUF_SYNC_END |
+			(write ? DMA_BUF_SYNC_WRITE : DMA_BUF_SYNC_READ));
+}
@@ -0,0 +1,9 @@
+#ifndef DMABUF_H
+#define DMABUF_H
+
+#include <stdbool.h>
+
+int dmabuf_sync_start(int fd, bool write);
+int dmabuf_sync_end(int fd, bool write);
+
+#endif /* DMABUF_H */
@@ -0,0 +1,798 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vulkan/vk_layer.h>
+#include <vulkan/vulkan.h>
+
+#include "registry.h"
+#include "vkmemfd_vulkan.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+#define LAYER_EXPORT __attribute__((visibility("default")))
+
+/* An implicit layer that carves the memories of HOST_VISIBLE types out of a
+ * memfd heap per device and imports them, so that other processes can map
+ * them.  The heap starts with a registry of the memories.
+ */
+
+struct layer_instance {
+	void *key;
+
+	PFN_vkGetInstanceProcAddr get_instance_proc_addr;
+	PFN_vkDestroyInstance destroy_instance;
+	PFN_vkCreateDevice create_device;
+	PFN_vkEnumerateDeviceExtensionProperties
+		enumerate_device_extension_properties;
+	PFN_vkGetPhysicalDeviceMemoryProperties
+		get_physical_device_memory_properties;
+	PFN_vkGetPhysicalDeviceProperties2 get_physical_device_properties2;
+	PFN_vkGetPhysicalDeviceImageFormatProperties2
+		get_physical_device_image_format_properties2;
+
+	struct layer_instance *next;
+};
+
+struct layer_device {
+	void *key;
+
+	PFN_vkGetDeviceProcAddr get_device_proc_addr;
+	PFN_vkDestroyDevice destroy_device;
+	PFN_vkAllocateMemory allocate_memory;
+	PFN_vkFreeMemory free_memory;
+	PFN_vkCreateBuffer create_buffer;
+	PFN_vkCreateImage create_image;
+	PFN_vkDestroyImage destroy_image;
+	PFN_vkBindImageMemory bind_image_memory;
+	PFN_vkBindImageMemory2 bind_image_memory2;
+
+	VkPhysicalDevice physical_dev;
+	PFN_vkGetPhysicalDeviceImageFormatProperties2
+		get_physical_device_image_format_properties2;
+	VkPhysicalDeviceMemoryProperties mem_props;
+
+	/* false when the heap cannot be imported; every call is passed down */
+	bool enabled;
+	struct vkmemfd_heap heap;
+	struct vkmemfd_import import;
+	struct registry_header *registry;
+	/* memory types that are not carved: the imports turned out not to
+	 * support them, or images that cannot be bound to imports were bound
+	 * to carved memories of them
+	 */
+	atomic_uint unsupported_types;
+	pthread_mutex_t mutex;
+	/* the images that cannot be bound to imports */
+	VkImage *unimportable_imgs;
+	uint32_t unimportable_count;
+	uint32_t unimportable_capacity;
+
+	struct layer_device *next;
+};
+
+static struct {
+	pthread_mutex_t mutex;
+	struct layer_instance *instances;
+	struct layer_device *devices;
+} layer = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static void layer_log(const char *msg)
+{
+	fprintf(stderr, "vkmemfd-layer: %s\n", msg);
+}
+
+static void *layer_key(const void *handle)
+{
+	return *(void *const *) handle;
+}
+
+static struct layer_instance *layer_find_instance(const void *handle)
+{
+	void *key = layer_key(handle);
+
+	pthread_mutex_lock(&layer.mutex);
+	struct layer_instance *inst = layer.instances;
+	while (inst && inst->key != key)
+		inst = inst->next;
+	pthread_mutex_unlock(&layer.mutex);
+
+	return inst;
+}
+
+static struct layer_device *layer_find_device(const void *handle)
+{
+	void *key = layer_key(handle);
+
+	pthread_mutex_lock(&layer.mutex);
+	struct layer_device *dev = layer.devices;
+	while (dev && dev->key != key)
+		dev = dev->next;
+	pthread_mutex_unlock(&layer.mutex);
+
+	return dev;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_CreateInstance(
+		const VkInstanceCreateInfo *info,
+		const VkAllocationCallbacks *alloc, VkInstance *instance)
+{
+	VkLayerInstanceCreateInfo *chain = (VkLayerInstanceCreateInfo *)
+		info->pNext;
+	while (chain && !(chain->sType ==
+				VK_STRUCTURE_TYPE_LOADER_INSTANCE_CREATE_INFO &&
+				chain->function == VK_LAYER_LINK_INFO))
+		chain = (VkLayerInstanceCreateInfo *) chain->pNext;
+	if (!chain)
+		return VK_ERROR_INITIALIZATION_FAILED;
+
+	PFN_vkGetInstanceProcAddr gipa =
+		chain->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+	chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+
+	PFN_vkCreateInstance create_instance = (PFN_vkCreateInstance)
+		gipa(VK_NULL_HANDLE, "vkCreateInstance");
+	VkResult result = create_instance(info, alloc, instance);
+	if (result != VK_SUCCESS)
+		return result;
+
+	struct layer_instance *inst = calloc(1, sizeof(*inst));
+	if (!inst) {
+		PFN_vkDestroyInstance destroy_instance = (PFN_vkDestroyInstance)
+			gipa(*instance, "vkDestroyInstance");
+		destroy_instance(*instance, alloc);
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
+
+	inst->key = layer_key(*instance);
+	inst->get_instance_proc_addr = gipa;
+#define GET(name, proc) \
+	inst->name = (PFN_vk##proc) gipa(*instance, "vk" #proc)
+	GET(destroy_instance, DestroyInstance);
+	GET(create_device, CreateDevice);
+	GET(enumerate_device_extension_properties,
+			EnumerateDeviceExtensionProperties);
+	GET(get_physical_device_memory_properties,
+			GetPhysicalDeviceMemoryProperties);
+	GET(get_physical_device_properties2, GetPhysicalDeviceProperties2);
+	GET(get_physical_device_image_format_properties2,
+			GetPhysicalDeviceImageFormatProperties2);
+#undef GET
+	if (!inst->get_physical_device_properties2) {
+		inst->get_physical_device_properties2 =
+			(PFN_vkGetPhysicalDeviceProperties2)
+			gipa(*instance, "vkGetPhysicalDeviceProperties2KHR");
+	}
+	if (!inst->get_physical_device_image_format_properties2) {
+		inst->get_physical_device_image_format_properties2 =
+			(PFN_vkGetPhysicalDeviceImageFormatProperties2)
+			gipa(*instance,
+				"vkGetPhysicalDeviceImageFormatProperties2KHR");
+	}
+
+	pthread_mutex_lock(&layer.mutex);
+	inst->next = layer.instances;
+	layer.instances = inst;
+	pthread_mutex_unlock(&layer.mutex);
+
+	return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL layer_DestroyInstance(VkInstance instance,
+		const VkAllocationCallbacks *alloc)
+{
+	if (!instance)
+		return;
+
+	void *key = layer_key(instance);
+
+	pthread_mutex_lock(&layer.mutex);
+	struct layer_instance **link = &layer.instances;
+	while (*link && (*link)->key != key)
+		link = &(*link)->next;
+	struct layer_instance *inst = *link;
+	if (inst)
+		*link = inst->next;
+	pthread_mutex_unlock(&layer.mutex);
+
+	if (!inst)
+		return;
+
+	inst->destroy_instance(instance, alloc);
+	free(inst);
+}
+
+static enum vkmemfd_heap_type layer_heap_type(void)
+{
+	const char *val = getenv("VKMEMFD_LAYER_HEAP");
+
+	return val && !strcmp(val, "udmabuf") ? VKMEMFD_HEAP_UDMABUF :
+		VKMEMFD_HEAP_MEMFD;
+}
+
+static size_t layer_heap_size(void)
+{
+	const char *val = getenv("VKMEMFD_LAYER_HEAP_SIZE");
+	const long mb = val ? atol(val) : 0;
+
+	return (size_t) (mb > 0 ? mb : 256) * 1024 * 1024;
+}
+
+/* the extensions the imports need, and their dependencies */
+static const char *const layer_host_ptr_exts[] = {
+	"VK_KHR_external_memory",
+	"VK_EXT_external_memory_host",
+};
+static const char *const layer_udmabuf_exts[] = {
+	"VK_KHR_external_memory",
+	"VK_KHR_external_memory_fd",
+	"VK_EXT_external_memory_dma_buf",
+};
+
+static bool layer_has_ext(const char *const *names, uint32_t count,
+		const char *name)
+{
+	for (uint32_t i = 0; i < count; i++) {
+		if (!strcmp(names[i], name))
+			return true;
+	}
+
+	return false;
+}
+
+/* Return the extensions of info plus the ones in exts, or NULL when the
+ * physical device does not support them.  The count is returned in
+ * ext_count.
+ */
+static const char **layer_device_exts(const struct layer_instance *inst,
+		VkPhysicalDevice physical_dev, const VkDeviceCreateInfo *info,
+		const char *const *exts, uint32_t count, uint32_t *ext_count)
+{
+	uint32_t prop_count = 0;
+	if (inst->enumerate_device_extension_properties(physical_dev, NULL,
+				&prop_count, NULL) != VK_SUCCESS)
+		return NULL;
+	VkExtensionProperties *props = malloc(sizeof(*props) * prop_count);
+	const char **names = malloc(sizeof(*names) *
+			(info->enabledExtensionCount + count));
+	if (!props || !names || inst->enumerate_device_extension_properties(
+				physical_dev, NULL, &prop_count,
+				props) < VK_SUCCESS) {
+		free(props);
+		free(names);
+		return NULL;
+	}
+
+	*ext_count = info->enabledExtensionCount;
+	for (uint32_t i = 0; i < *ext_count; i++)
+		names[i] = info->ppEnabledExtensionNames[i];
+
+	for (uint32_t i = 0; i < count; i++) {
+		if (layer_has_ext(names, *ext_count, exts[i]))
+			continue;
+
+		uint32_t j = 0;
+		while (j < prop_count && strcmp(props[j].extensionName,
+					exts[i]))
+			j++;
+		if (j == prop_count) {
+			free(props);
+			free(names);
+			return NULL;
+		}
+
+		names[(*ext_count)++] = exts[i];
+	}
+
+	free(props);
+
+	return names;
+}
+
+static void layer_init_heap(struct layer_device *dev,
+		const struct layer_instance *inst, VkPhysicalDevice physical_dev,
+		enum vkmemfd_heap_type heap_type)
+{
+	const size_t size = layer_heap_size();
+	if (!vkmemfd_heap_create(&dev->heap, "vkmemfd-layer", size)) {
+		layer_log("failed to create memfd heap");
+		return;
+	}
+
+	const struct vkmemfd_dispatch dispatch = {
+		.get_physical_device_properties2 =
+			inst->get_physical_device_properties2,
+		.get_device_proc_addr = dev->get_device_proc_addr,
+		.allocate_memory = dev->allocate_memory,
+	};
+	if (!dispatch.get_physical_device_properties2 ||
+			vkmemfd_import_init_dispatch(&dev->import, &dispatch,
+				physical_dev, heap_type, dev->heap.fd,
+				dev->heap.base) != VK_SUCCESS) {
+		layer_log("failed to initialize heap import");
+		vkmemfd_heap_destroy(&dev->heap);
+		return;
+	}
+
+	/* the first aligned offset past the registry */
+	const VkDeviceSize align = dev->import.align;
+	VkDeviceSize begin = dev->import.base_skip;
+	if (begin < sizeof(struct registry_header)) {
+		begin += (sizeof(struct registry_header) - begin + align - 1) /
+			align * align;
+	}
+
+	if (begin >= size || !vkmemfd_heap_seal(&dev->heap, false)) {
+		layer_log("failed to initialize memfd heap");
+		vkmemfd_import_fini(&dev->import);
+		vkmemfd_heap_destroy(&dev->heap);
+		return;
+	}
+
+	dev->registry = dev->heap.base;
+	registry_init(dev->registry, size, begin, align);
+	pthread_mutex_init(&dev->mutex, NULL);
+	dev->enabled = true;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_CreateDevice(
+		VkPhysicalDevice physical_dev, const VkDeviceCreateInfo *info,
+		const VkAllocationCallbacks *alloc, VkDevice *device)
+{
+	VkLayerDeviceCreateInfo *chain = (VkLayerDeviceCreateInfo *)
+		info->pNext;
+	while (chain && !(chain->sType ==
+				VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO &&
+				chain->function == VK_LAYER_LINK_INFO))
+		chain = (VkLayerDeviceCreateInfo *) chain->pNext;
+
+	struct layer_instance *inst = layer_find_instance(physical_dev);
+	if (!chain || !inst)
+		return VK_ERROR_INITIALIZATION_FAILED;
+
+	PFN_vkGetDeviceProcAddr gdpa =
+		chain->u.pLayerInfo->pfnNextGetDeviceProcAddr;
+	chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+
+	const enum vkmemfd_heap_type heap_type = layer_heap_type();
+	const char *const *exts = heap_type == VKMEMFD_HEAP_UDMABUF ?
+		layer_udmabuf_exts : layer_host_ptr_exts;
+	const uint32_t count = heap_type == VKMEMFD_HEAP_UDMABUF ?
+		ARRAY_SIZE(layer_udmabuf_exts) : ARRAY_SIZE(layer_host_ptr_exts);
+
+	/* the device is created as asked when the imports are unsupported */
+	uint32_t ext_count;
+	const char **ext_names = layer_device_exts(inst, physical_dev, info,
+			exts, count, &ext_count);
+	if (!ext_names)
+		layer_log("missing import extensions");
+
+	VkDeviceCreateInfo dev_info = *info;
+	if (ext_names) {
+		dev_info.enabledExtensionCount = ext_count;
+		dev_info.ppEnabledExtensionNames = ext_names;
+	}
+
+	VkResult result = inst->create_device(physical_dev, &dev_info, alloc,
+			device);
+	free(ext_names);
+	if (result != VK_SUCCESS)
+		return result;
+
+	struct layer_device *dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		PFN_vkDestroyDevice destroy_device = (PFN_vkDestroyDevice)
+			gdpa(*device, "vkDestroyDevice");
+		destroy_device(*device, alloc);
+		return VK_ERROR_OUT_OF_HOST_MEMORY;
+	}
+
+	dev->key = layer_key(*device);
+	dev->get_device_proc_addr = gdpa;
+#define GET(name, proc) \
+	dev->name = (PFN_vk##proc) gdpa(*device, "vk" #proc)
+	GET(destroy_device, DestroyDevice);
+	GET(allocate_memory, AllocateMemory);
+	GET(free_memory, FreeMemory);
+	GET(create_buffer, CreateBuffer);
+	GET(create_image, CreateImage);
+	GET(destroy_image, DestroyImage);
+	GET(bind_image_memory, BindImageMemory);
+	GET(bind_image_memory2, BindImageMemory2);
+	if (!dev->bind_image_memory2)
+		GET(bind_image_memory2, BindImageMemory2KHR);
+#undef GET
+	dev->physical_dev = physical_dev;
+	dev->get_physical_device_image_format_properties2 =
+		inst->get_physical_device_image_format_properties2;
+	inst->get_physical_device_memory_properties(physical_dev,
+			&dev->mem_props);
+
+	if (ext_names)
+		layer_init_heap(dev, inst, physical_dev, heap_type);
+
+	pthread_mutex_lock(&layer.mutex);
+	dev->next = layer.devices;
+	layer.devices = dev;
+	pthread_mutex_unlock(&layer.mutex);
+
+	return VK_SUCCESS;
+}
+
+static VKAPI_ATTR void VKAPI_CALL layer_DestroyDevice(VkDevice device,
+		const VkAllocationCallbacks *alloc)
+{
+	if (!device)
+		return;
+
+	void *key = layer_key(device);
+
+	pthread_mutex_lock(&layer.mutex);
+	struct layer_device **link = &layer.devices;
+	while (*link && (*link)->key != key)
+		link = &(*link)->next;
+	struct layer_device *dev = *link;
+	if (dev)
+		*link = dev->next;
+	pthread_mutex_unlock(&layer.mutex);
+
+	if (!dev)
+		return;
+
+	dev->destroy_device(device, alloc);
+
+	if (dev->enabled) {
+		vkmemfd_import_fini(&dev->import);
+		vkmemfd_heap_destroy(&dev->heap);
+		pthread_mutex_destroy(&dev->mutex);
+	}
+	free(dev->unimportable_imgs);
+	free(dev);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_AllocateMemory(VkDevice device,
+		const VkMemoryAllocateInfo *info,
+		const VkAllocationCallbacks *alloc, VkDeviceMemory *mem)
+{
+	struct layer_device *dev = layer_find_device(device);
+	const uint32_t type = info->memoryTypeIndex;
+
+	/* memories that are imported, exported, dedicated, or otherwise
+	 * special are left alone
+	 */
+	if (!dev->enabled || info->pNext ||
+			type >= dev->mem_props.memoryTypeCount ||
+			!(dev->mem_props.memoryTypes[type].propertyFlags &
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) ||
+			(atomic_load(&dev->unsupported_types) & (1u << type)))
+		return dev->allocate_memory(device, info, alloc, mem);
+
+	const VkDeviceSize align = dev->import.align;
+	const VkDeviceSize size = (info->allocationSize + align - 1) / align *
+		align;
+
+	pthread_mutex_lock(&dev->mutex);
+
+	const uint64_t offset = registry_find(dev->registry, size);
+	VkResult result = VK_ERROR_OUT_OF_DEVICE_MEMORY;
+	if (offset) {
+		uint32_t mem_type;
+		result = vkmemfd_import_memory(&dev->import, device,
+				1u << type, VK_NULL_HANDLE, offset, size, mem,
+				&mem_type);
+		if (result == VK_ERROR_INVALID_EXTERNAL_HANDLE)
+			atomic_fetch_or(&dev->unsupported_types, 1u << type);
+	}
+
+	if (result == VK_SUCCESS) {
+		const struct registry_allocation entry = {
+			.offset = offset,
+			.size = size,
+			.memory = (uint64_t) *mem,
+			.memory_type = type,
+			.property_flags =
+				dev->mem_props.memoryTypes[type].propertyFlags,
+		};
+		registry_insert(dev->registry, &entry);
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+
+	/* the heap is full, or the type cannot be imported */
+	if (result != VK_SUCCESS)
+		result = dev->allocate_memory(device, info, alloc, mem);
+
+	return result;
+}
+
+static VKAPI_ATTR void VKAPI_CALL layer_FreeMemory(VkDevice device,
+		VkDeviceMemory mem, const VkAllocationCallbacks *alloc)
+{
+	struct layer_device *dev = layer_find_device(device);
+	if (!dev->enabled || mem == VK_NULL_HANDLE) {
+		dev->free_memory(device, mem, alloc);
+		return;
+	}
+
+	/* the handle may be reused as soon as it is freed */
+	pthread_mutex_lock(&dev->mutex);
+	dev->free_memory(device, mem, alloc);
+	registry_remove(dev->registry, (uint64_t) mem);
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_CreateBuffer(VkDevice device,
+		const VkBufferCreateInfo *info,
+		const VkAllocationCallbacks *alloc, VkBuffer *buf)
+{
+	struct layer_device *dev = layer_find_device(device);
+	if (!dev->enabled)
+		return dev->create_buffer(device, info, alloc, buf);
+
+	const VkBaseInStructure *s = info->pNext;
+	while (s && s->sType !=
+			VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO)
+		s = s->pNext;
+	if (s)
+		return dev->create_buffer(device, info, alloc, buf);
+
+	/* buffers may be bound to imported memories */
+	const VkExternalMemoryBufferCreateInfo ext_info = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO,
+		.pNext = info->pNext,
+		.handleTypes = dev->import.handle_type,
+	};
+	VkBufferCreateInfo buf_info = *info;
+	buf_info.pNext = &ext_info;
+
+	return dev->create_buffer(device, &buf_info, alloc, buf);
+}
+
+/* whether images like this one can be bound to imported memories */
+static bool layer_image_importable(const struct layer_device *dev,
+		const VkImageCreateInfo *info)
+{
+	/* DRM format modifiers would need to be part of the query */
+	if (!dev->get_physical_device_image_format_properties2 ||
+			info->tiling == VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT)
+		return false;
+
+	VkExternalImageFormatProperties ext_props = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES,
+	};
+	const VkResult result =
+		dev->get_physical_device_image_format_properties2(
+			dev->physical_dev,
+			&(VkPhysicalDeviceImageFormatInfo2) {
+				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2,
+				.pNext = &(VkPhysicalDeviceExternalImageFormatInfo) {
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO,
+					.handleType = dev->import.handle_type,
+				},
+				.format = info->format,
+				.type = info->imageType,
+				.tiling = info->tiling,
+				.usage = info->usage,
+				.flags = info->flags,
+			},
+			&(VkImageFormatProperties2) {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2,
+				.pNext = &ext_props,
+			});
+
+	return result == VK_SUCCESS &&
+		(ext_props.externalMemoryProperties.externalMemoryFeatures &
+		 VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT);
+}
+
+/* Images that can be bound to imported memories are created importable.  The
+ * others are remembered until they are bound.
+ */
+static VkResult layer_create_image(struct layer_device *dev,
+		VkDevice device, const VkImageCreateInfo *info,
+		const VkAllocationCallbacks *alloc, VkImage *img)
+{
+	const bool importable = layer_image_importable(dev, info);
+	const VkExternalMemoryImageCreateInfo ext_info = {
+		.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+		.pNext = info->pNext,
+		.handleTypes = dev->import.handle_type,
+	};
+	VkImageCreateInfo img_info = *info;
+	if (importable)
+		img_info.pNext = &ext_info;
+
+	VkResult result = dev->create_image(device, &img_info, alloc, img);
+	if (result != VK_SUCCESS || importable)
+		return result;
+
+	pthread_mutex_lock(&dev->mutex);
+	if (dev->unimportable_count == dev->unimportable_capacity) {
+		const uint32_t capacity = dev->unimportable_capacity ?
+			dev->unimportable_capacity * 2 : 16;
+		VkImage *imgs = realloc(dev->unimportable_imgs,
+				sizeof(imgs[0]) * capacity);
+		if (!imgs) {
+			pthread_mutex_unlock(&dev->mutex);
+			dev->destroy_image(device, *img, alloc);
+			return VK_ERROR_OUT_OF_HOST_MEMORY;
+		}
+		dev->unimportable_imgs = imgs;
+		dev->unimportable_capacity = capacity;
+	}
+	dev->unimportable_imgs[dev->unimportable_count++] = *img;
+	pthread_mutex_unlock(&dev->mutex);
+
+	return VK_SUCCESS;
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_CreateImage(VkDevice device,
+		const VkImageCreateInfo *info,
+		const VkAllocationCallbacks *alloc, VkImage *img)
+{
+	struct layer_device *dev = layer_find_device(device);
+	if (!dev->enabled)
+		return dev->create_image(device, info, alloc, img);
+
+	const VkBaseInStructure *s = info->pNext;
+	while (s && s->sType !=
+			VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO)
+		s = s->pNext;
+	if (s)
+		return dev->create_image(device, info, alloc, img);
+
+	return layer_create_image(dev, device, info, alloc, img);
+}
+
+static VKAPI_ATTR void VKAPI_CALL layer_DestroyImage(VkDevice device,
+		VkImage img, const VkAllocationCallbacks *alloc)
+{
+	struct layer_device *dev = layer_find_device(device);
+	if (!dev->enabled || img == VK_NULL_HANDLE) {
+		dev->destroy_image(device, img, alloc);
+		return;
+	}
+
+	/* the handle may be reused as soon as it is destroyed */
+	pthread_mutex_lock(&dev->mutex);
+	dev->destroy_image(device, img, alloc);
+	for (uint32_t i = 0; i < dev->unimportable_count; i++) {
+		if (dev->unimportable_imgs[i] == img) {
+			dev->unimportable_imgs[i] =
+				dev->unimportable_imgs[--dev->unimportable_count];
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+/* Stop carving the memory type of a carved memory that an unimportable image
+ * is bound to.  The bind itself is still passed down; drivers whose imports
+ * are plain host memory do not mind.
+ */
+static void layer_check_image_bind(struct layer_device *dev, VkImage img,
+		VkDeviceMemory mem)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	uint32_t i = 0;
+	while (i < dev->unimportable_count && dev->unimportable_imgs[i] != img)
+		i++;
+	const struct registry_allocation *entry =
+		i < dev->unimportable_count ?
+		registry_lookup(dev->registry, (uint64_t) mem) : NULL;
+	if (entry) {
+		const uint32_t bit = 1u << entry->memory_type;
+		if (!(atomic_fetch_or(&dev->unsupported_types, bit) & bit))
+			layer_log("unimportable image bound to a carved memory; "
+					"no longer carving its memory type");
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_BindImageMemory(VkDevice device,
+		VkImage img, VkDeviceMemory mem, VkDeviceSize offset)
+{
+	struct layer_device *dev = layer_find_device(device);
+	if (dev->enabled)
+		layer_check_image_bind(dev, img, mem);
+
+	return dev->bind_image_memory(device, img, mem, offset);
+}
+
+static VKAPI_ATTR VkResult VKAPI_CALL layer_BindImageMemory2(VkDevice device,
+		uint32_t count, const VkBindImageMemoryInfo *infos)
+{
+	struct layer_device *dev = layer_find_device(device);
+	for (uint32_t i = 0; dev->enabled && i < count; i++)
+		layer_check_image_bind(dev, infos[i].image, infos[i].memory);
+
+	return dev->bind_image_memory2(device, count, infos);
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL layer_GetInstanceProcAddr(
+		VkInstance instance, const char *name);
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL layer_GetDeviceProcAddr(
+		VkDevice device, const char *name);
+
+static const struct {
+	const char *name;
+	PFN_vkVoidFunction func;
+	bool is_device;
+} layer_funcs[] = {
+#define FUNC(proc, is_device) \
+	{ "vk" #proc, (PFN_vkVoidFunction) layer_##proc, is_device }
+	FUNC(GetInstanceProcAddr, false),
+	FUNC(CreateInstance, false),
+	FUNC(DestroyInstance, false),
+	FUNC(CreateDevice, false),
+	FUNC(GetDeviceProcAddr, true),
+	FUNC(DestroyDevice, true),
+	FUNC(AllocateMemory, true),
+	FUNC(FreeMemory, true),
+	FUNC(CreateBuffer, true),
+	FUNC(CreateImage, true),
+	FUNC(DestroyImage, true),
+	FUNC(BindImageMemory, true),
+	FUNC(BindImageMemory2, true),
+	{ "vkBindImageMemory2KHR", (PFN_vkVoidFunction) layer_BindImageMemory2,
+		true },
+#undef FUNC
+};
+
+static PFN_vkVoidFunction layer_find_func(const char *name, bool is_device)
+{
+	for (uint32_t i = 0; i < ARRAY_SIZE(layer_funcs); i++) {
+		if ((!is_device || layer_funcs[i].is_device) &&
+				!strcmp(layer_funcs[i].name, name))
+			return layer_funcs[i].func;
+	}
+
+	return NULL;
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL layer_GetDeviceProcAddr(
+		VkDevice device, const char *name)
+{
+	PFN_vkVoidFunction func = layer_find_func(name, true);
+	if (func)
+		return func;
+
+	struct layer_device *dev = layer_find_device(device);
+
+	return dev ? dev->get_device_proc_addr(device, name) : NULL;
+}
+
+static VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL layer_GetInstanceProcAddr(
+		VkInstance instance, const char *name)
+{
+	PFN_vkVoidFunction func = layer_find_func(name, false);
+	if (func || !instance)
+		return func;
+
+	struct layer_instance *inst = layer_find_instance(instance);
+
+	return inst ? inst->get_instance_proc_addr(instance, name) : NULL;
+}
+
+LAYER_EXPORT VKAPI_ATTR VkResult VKAPI_CALL
+vkmemfd_layer_NegotiateLoaderLayerInterfaceVersion(
+		VkNegotiateLayerInterface *iface)
+{
+	if (iface->loaderLayerInterfaceVersion < 2)
+		return VK_ERROR_INITIALIZATION_FAILED;
+
+	iface->loaderLayerInterfaceVersion = 2;
+	iface->pfnGetInstanceProcAddr = layer_GetInstanceProcAddr;
+	iface->pfnGetDeviceProcAddr = layer_GetDeviceProcAddr;
+	iface->pfnGetPhysicalDeviceProcAddr = NULL;
+
+	return VK_SUCCESS;
+}
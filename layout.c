@@ -0,0 +1,88 @@
+#include "layout.h"
+
+#include <string.h>
+
+const char *layout_name(enum vkmemfd_output_layout type)
+{
+	switch (type) {
+	case VKMEMFD_OUTPUT_LINEAR:
+		return "linear";
+	case VKMEMFD_OUTPUT_PITCHED:
+		return "pitched";
+	case VKMEMFD_OUTPUT_TILED:
+		return "tiled";
+	case VKMEMFD_OUTPUT_NV12:
+		return "nv12";
+	case VKMEMFD_OUTPUT_I420:
+		return "i420";
+	default:
+		return "unknown";
+	}
+}
+
+bool layout_is_yuv(enum vkmemfd_output_layout type)
+{
+	return type == VKMEMFD_OUTPUT_NV12 || type == VKMEMFD_OUTPUT_I420;
+}
+
+static int layout_tiles_x(const struct layout *layout)
+{
+	return (layout->width + layout->tile_size - 1) / layout->tile_size;
+}
+
+static int layout_tiles_y(const struct layout *layout)
+{
+	return (layout->height + layout->tile_size - 1) / layout->tile_size;
+}
+
+size_t layout_size(const struct layout *layout)
+{
+	/* the chroma planes are a half of the Y plane together */
+	if (layout_is_yuv(layout->type))
+		return layout->row_pitch * layout->height * 3 / 2;
+
+	if (layout->type != VKMEMFD_OUTPUT_TILED)
+		return layout->row_pitch * layout->height;
+
+	/* the edge tiles are padded */
+	return layout->row_pitch * layout->tile_size *
+		layout_tiles_x(layout) * layout_tiles_y(layout);
+}
+
+size_t layout_offset(const struct layout *layout, int x, int y)
+{
+	if (layout->type != VKMEMFD_OUTPUT_TILED)
+		return layout->row_pitch * y + (size_t) x * 4;
+
+	const int size = layout->tile_size;
+	const size_t tile = (size_t) (y / size) * layout_tiles_x(layout) + x / size;
+
+	return (tile * size + y % size) * layout->row_pitch + (size_t) (x % size) * 4;
+}
+
+void layout_linearize(const struct layout *layout, void *dst, const void *src)
+{
+	const size_t dst_pitch = (size_t) layout->width * 4;
+
+	if (layout->type != VKMEMFD_OUTPUT_TILED) {
+		for (int y = 0; y < layout->height; y++) {
+			memcpy((char *) dst + dst_pitch * y,
+					(const char *) src + layout->row_pitch * y,
+					dst_pitch);
+		}
+		return;
+	}
+
+	/* every tile has a contiguous run of pixels in each row */
+	const int size = layout->tile_size;
+	for (int y = 0; y < layout->height; y++) {
+		for (int x = 0; x < layout->width; x += size) {
+			const int count = layout->width - x < size ?
+				layout->width - x : size;
+			memcpy((char *) dst + dst_pitch * y + (size_t) x * 4,
+					(const char *) src +
+					layout_offset(layout, x, y),
+					(size_t) count * 4);
+		}
+	}
+}
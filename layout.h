@@ -0,0 +1,33 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "renderer.h"
+
+/* how B8G8R8A8 pixels, or YUV planes, are stored in an output */
+struct layout {
+	enum vkmemfd_output_layout type;
+	int width;
+	int height;
+	/* bytes between rows, of the output, of a tile, or of the Y plane */
+	size_t row_pitch;
+	/* pixels on a tile side, or 0 when not tiled */
+	int tile_size;
+};
+
+const char *layout_name(enum vkmemfd_output_layout type);
+bool layout_is_yuv(enum vkmemfd_output_layout type);
+
+/* the bytes an output in the layout spans */
+size_t layout_size(const struct layout *layout);
+
+/* the byte offset of a pixel; not for YUV layouts */
+size_t layout_offset(const struct layout *layout, int x, int y);
+
+/* copy an output out into tightly packed rows; not for YUV layouts */
+void layout_linearize(const struct layout *layout, void *dst, const void *src);
+
+#endif /* LAYOUT_H */
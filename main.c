@@ -1,17 +1,55 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
+#include <xcb/bigreq.h>
+#include <xcb/present.h>
+#include <xcb/shm.h>
 #include <xcb/xcb.h>
 #include <xcb/xproto.h>
 
+#include "attach.h"
+#include "convert.h"
+#include "dmabuf.h"
+#include "layout.h"
+#include "readback.h"
 #include "renderer.h"
+#include "trace.h"
+#include "upload.h"
+#include "verify.h"
+
+struct app;
+
+struct app_sink {
+	const char *name;
+	/* whether the pixels are read by a CPU, be it ours or the X server's */
+	bool needs_cpu_access;
+	/* whether the pixels are read by us */
+	bool reads_pixels;
+	/* whether the lowest preview is read instead of the output */
+	bool reads_preview;
+	/* whether the sink is given as NAME=PATH rather than NAME */
+	bool takes_path;
+
+	void (*init)(struct app *app);
+	/* pixels are the output, or a copy of it */
+	void (*present)(struct app *app, int output, const void *pixels);
+	/* optional */
+	void (*report)(const struct app *app);
+};
 
 struct app {
 	struct {
@@ -22,13 +60,90 @@ struct app {
 		int output_count;
 		size_t heap_size;
 		bool is_coherent;
-		bool use_udmabuf;
+		enum vkmemfd_heap_type heap_type;
+		const struct app_sink *sink;
+		const char *sink_path;
+		/* present from a separate thread */
+		bool async;
+		/* drop queued frames superseded by newer ones */
+		bool latest_wins;
+		/* render requests in flight */
+		int pipeline_depth;
+		/* relative to the request time, in ns, or 0 for none */
+		uint64_t deadline;
+		/* verify every Nth row of every output, or 0 for none */
+		int verify_row_step;
+		/* heap writes at least this big use streaming stores, or 0 to
+		 * calibrate
+		 */
+		size_t upload_threshold;
+		/* let the renderer skip outputs requested in their last colors */
+		bool skip_unchanged;
+		/* requests sent and submitted together */
+		int batch_size;
+		enum vkmemfd_output_layout layout;
+		/* of the row pitch in VKMEMFD_OUTPUT_PITCHED */
+		int row_align;
+		/* bit N asks for a preview of mip level N */
+		uint32_t preview_levels;
+		/* where readers attach to the heap, or NULL */
+		const char *attach_path;
+		/* where the requests are recorded, or NULL */
+		const char *record_path;
+		/* the part of the outputs that is copied and presented; the whole
+		 * outputs by default
+		 */
+		struct {
+			int x;
+			int y;
+			int width;
+			int height;
+		} roi;
 	} config;
 
+	/* B8G8R8A8 */
+	size_t img_size;
+	/* the bytes copied into an output every frame */
+	size_t frame_size;
+	/* the ROI tightly packed, as the sinks see it */
+	size_t roi_size;
+	/* the part of an output read by the CPU: the frame, or the preview the
+	 * sink reads
+	 */
+	size_t read_offset;
+	size_t read_size;
+
+	/* of the outputs, and where they are copied to tightly packed rows
+	 * when they are not linear
+	 */
+	struct layout layout;
+	void *linear;
+
+	/* of YUV outputs */
 	struct {
-		int memfd;
-		void *base;
-	} heap;
+		int count;
+		struct {
+			size_t offset;
+			size_t row_pitch;
+		} planes[3];
+	} yuv;
+
+	/* downscaled copies after the outputs, largest first */
+	struct {
+		int count;
+		struct {
+			size_t offset;
+			int width;
+			int height;
+		} levels[VKMEMFD_PREVIEW_LEVEL_MAX];
+	} preview;
+
+	struct vkmemfd_heap heap;
+
+	/* memories exported by the renderer; index 0 is the UBO */
+	struct {
+		int *fds;
+	} exports;
 
 	struct {
 		int in;
@@ -39,43 +154,188 @@ struct app {
 		xcb_connection_t *conn;
 		xcb_window_t win;
 		xcb_gcontext_t gc;
-		size_t img_size;
+
+		/* the root visual and how outputs are converted for it */
+		uint8_t depth;
+		enum convert_format format;
+		enum convert_isa isa;
+		convert_func convert;
+		size_t stride;
+		void *converted;
+
+		/* rows per PutImage request for the x11 sink */
+		int band_height;
+		int band_count;
+		/* one per output for the x11-shm sink */
+		xcb_shm_seg_t *shm_segs;
 	} xcb;
 
+	/* for the x11-present sink */
+	struct {
+		xcb_special_event_t *events;
+		xcb_pixmap_t pixmaps[3];
+		/* until IdleNotify */
+		bool busy[3];
+		/* of the last PresentPixmap and the last CompleteNotify; as
+		 * many presents as pixmaps may be pending
+		 */
+		uint32_t serial;
+		uint32_t complete_serial;
+		/* when the pending presents were made, by serial */
+		uint64_t submit_times[3];
+		uint64_t target_msc;
+
+		uint64_t msc;
+		uint64_t ust;
+		/* estimated vblank interval and render time, in ns */
+		uint64_t interval;
+		uint64_t work;
+		/* when app_present_x11_present last returned */
+		uint64_t work_begin;
+
+		int complete_count;
+		int missed_count;
+		uint64_t latency_total;
+	} present;
+
+	struct {
+		int fd;
+	} file;
+
+	struct {
+		uint64_t value;
+	} checksum;
+
+	struct {
+		uint64_t begin;
+		int frame_count;
+	} stats;
+
+	/* for checking the outputs against the requested colors */
+	struct {
+		verify_func func;
+		uint32_t *colors;
+		int row_offset;
+
+		int frame_count;
+		int bad_frame_count;
+		size_t bad_pixel_count;
+		bool dumped;
+	} verify;
+
+	/* the requests, for replaying with vkmemfd-bench */
+	struct trace_writer trace;
+
+	/* the colors the outputs were last rendered in */
+	struct {
+		float (*colors)[4];
+		bool *valid;
+	} skip;
+
+	/* for presenting asynchronously */
+	struct {
+		pthread_t thread;
+
+		/* a single-producer single-consumer ring of outputs */
+		int ring[3];
+		atomic_uint head;
+		atomic_uint tail;
+		sem_t free_count;
+		sem_t ready_count;
+
+		/* the only queued output when the latest frame wins, or -1 */
+		atomic_int latest;
+
+		/* whether an output is queued or being presented; idle is
+		 * signaled when the present thread clears one
+		 */
+		atomic_bool *busy;
+		pthread_mutex_t mutex;
+		pthread_cond_t idle;
+
+		atomic_int presented_count;
+		atomic_int dropped_count;
+	} async;
+
 	/* pointers into the heap */
 	struct {
-		float *ubo;
+		void *ubo;
+		size_t ubo_stride;
 		const void **outputs;
 	} mems;
+
+	/* outputs that are not host-cached are copied out before they are
+	 * read
+	 */
+	struct {
+		bool *uncached;
+		readback_func stream;
+		void *staging;
+	} readback;
+
+	/* for other processes reading the outputs */
+	struct {
+		int listen_fd;
+		/* read-only, for the readers */
+		int fd;
+		size_t offset;
+		struct attach_header *header;
+		uint32_t generation;
+
+		int reader_count;
+		struct {
+			int fd;
+			pid_t pid;
+			struct attach_report report;
+		} readers[16];
+	} attach;
+
+	/* batched requests not sent yet */
+	struct {
+		struct vkmemfd_request reqs[16];
+		int count;
+	} batch;
+
+	/* outputs requested but not replied yet */
+	struct {
+		bool *outputs;
+		int count;
+	} inflight;
 };
 
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
 static void app_fatal(const char *msg)
 {
 	printf("APP-FATAL: %s\n", msg);
 	abort();
 }
 
-static void app_init_heap(struct app *app)
+static uint64_t app_now(void)
 {
-	app->heap.memfd = memfd_create(app->config.name,
-			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-	if (app->heap.memfd < 0)
-		app_fatal("failed to create memfd");
+static void app_init_heap(struct app *app)
+{
+	/* the renderer allocates the memories */
+	if (app->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		app->heap.fd = -1;
+		app->heap.base = NULL;
+		return;
+	}
 
-	if (ftruncate(app->heap.memfd, app->config.heap_size) < 0)
-		app_fatal("failed to set memfd size");
+	if (!vkmemfd_heap_create(&app->heap, app->config.name,
+				app->config.heap_size))
+		app_fatal("failed to create memfd heap");
 
-	if (fcntl(app->heap.memfd, F_ADD_SEALS, F_SEAL_SEAL |
-				F_SEAL_SHRINK |
-				F_SEAL_GROW) < 0)
+	/* future writes are sealed too when readers can attach, once the
+	 * renderer has mapped the heap
+	 */
+	if (!app->config.attach_path && !vkmemfd_heap_seal(&app->heap, false))
 		app_fatal("failed to seal memfd");
-
-	app->heap.base = mmap(NULL, app->config.heap_size,
-			PROT_READ | PROT_WRITE, MAP_SHARED,
-			app->heap.memfd, 0);
-	if (app->heap.base == MAP_FAILED)
-		app_fatal("failed to map memfd");
 }
 
 static void app_init_renderer(struct app *app)
@@ -85,7 +345,9 @@ static void app_init_renderer(struct app *app)
 	int child_in;
 	int child_out;
 
-	if (pipe(pipes[0]) < 0 || pipe(pipes[1]) < 0)
+	/* the renderer sends fds back when it exports the memories */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, pipes[0]) < 0 ||
+			pipe(pipes[1]) < 0)
 		app_fatal("failed to create pipes");
 
 	app->renderer.in = pipes[0][0];
@@ -108,10 +370,12 @@ static void app_init_renderer(struct app *app)
 	close(app->renderer.in);
 	close(app->renderer.out);
 
-	int child_memfd;
-	child_memfd = dup(app->heap.memfd);
-	if (child_memfd < 0)
-		app_fatal("failed to dup memfd");
+	int child_memfd = -1;
+	if (app->heap.fd >= 0) {
+		child_memfd = dup(app->heap.fd);
+		if (child_memfd < 0)
+			app_fatal("failed to dup memfd");
+	}
 
 	char child_renderer[32];
 	if (snprintf(child_renderer, sizeof(child_renderer),
@@ -119,91 +383,362 @@ static void app_init_renderer(struct app *app)
 				child_memfd) >= sizeof(child_renderer))
 		app_fatal("failed to format the renderer string");
 
-	const char *child_argv[] = {
-		app->config.argv0,
-		child_renderer,
-		app->config.use_udmabuf ? "udmabuf" : "memfd",
-		NULL,
-	};
+	char child_size[32];
+	snprintf(child_size, sizeof(child_size), "size=%dx%d",
+			app->config.width, app->config.height);
+
+	char child_layout[32];
+	if (app->config.layout == VKMEMFD_OUTPUT_PITCHED) {
+		snprintf(child_layout, sizeof(child_layout), "pitch=%d",
+				app->config.row_align);
+	} else {
+		snprintf(child_layout, sizeof(child_layout), "%s",
+				layout_name(app->config.layout));
+	}
+
+	char child_preview[64] = "preview=";
+	for (int level = 1; level <= VKMEMFD_PREVIEW_LEVEL_MAX; level++) {
+		if (!(app->config.preview_levels & (1u << level)))
+			continue;
+		const size_t len = strlen(child_preview);
+		snprintf(child_preview + len, sizeof(child_preview) - len,
+				"%s%d", child_preview[len - 1] == '=' ? "" : ",",
+				1 << level);
+	}
+
+	const char *child_argv[8];
+	int argc = 0;
+	child_argv[argc++] = app->config.argv0;
+	child_argv[argc++] = child_renderer;
+	child_argv[argc++] = renderer_heap_type_name(app->config.heap_type);
+	child_argv[argc++] = child_size;
+	child_argv[argc++] = child_layout;
+	if (app->config.preview_levels)
+		child_argv[argc++] = child_preview;
+	/* the outputs keep their contents only for skipped frames */
+	if (app->config.skip_unchanged)
+		child_argv[argc++] = "skip-unchanged";
+	child_argv[argc] = NULL;
 
 	if (execv(app->config.argv0, (char **) child_argv) < 0)
 		app_fatal("failed to exec the renderer");
 }
 
-static void app_init_xcb(struct app *app)
+static uint32_t app_recv(const struct app *app);
+static int app_recv_fd(const struct app *app, uint32_t *val);
+
+static void *app_map_export(const struct app *app, int fd, size_t size)
 {
-	const xcb_screen_t *screen;
+	void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (ptr == MAP_FAILED)
+		app_fatal("failed to map exported memory");
 
-	app->xcb.conn = xcb_connect(NULL, NULL);
-	if (xcb_connection_has_error(app->xcb.conn))
-		app_fatal("failed to connect to X");
+	return ptr;
+}
 
-	screen = xcb_setup_roots_iterator(xcb_get_setup(app->xcb.conn)).data;
+static void app_init_exports(struct app *app,
+		const struct vkmemfd_layout *layout)
+{
+	app->exports.fds = malloc(sizeof(app->exports.fds[0]) *
+			(1 + app->config.output_count));
+	if (!app->exports.fds)
+		app_fatal("failed to allocate export fds");
 
-	app->xcb.win = xcb_generate_id(app->xcb.conn);
-	xcb_create_window(app->xcb.conn, XCB_COPY_FROM_PARENT, app->xcb.win,
-			screen->root, 0, 0, app->config.width,
-			app->config.height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
-			screen->root_visual, 0, NULL);
+	for (int i = 0; i < 1 + app->config.output_count; i++) {
+		uint32_t is_dmabuf;
+		app->exports.fds[i] = app_recv_fd(app, &is_dmabuf);
+		/* only dma-bufs can be mapped */
+		if (!is_dmabuf)
+			app_fatal("exported memory is not a dma-buf");
+	}
 
-	app->xcb.gc = xcb_generate_id(app->xcb.conn);
-	xcb_create_gc(app->xcb.conn, app->xcb.gc, app->xcb.win, 0, NULL);
+	app->mems.ubo = app_map_export(app, app->exports.fds[0],
+			layout->ubo_size);
+	for (int i = 0; i < app->config.output_count; i++) {
+		app->mems.outputs[i] = app_map_export(app,
+				app->exports.fds[1 + i], layout->output_size);
+	}
+}
 
-	xcb_flush(app->xcb.conn);
+static void app_init_layout(struct app *app,
+		const struct vkmemfd_layout *layout)
+{
+	const size_t row_pitch = layout->row_pitch;
+	const int tile_size = layout->tile_size;
+	app->layout = (struct layout) {
+		.type = app->config.layout,
+		.width = app->config.width,
+		.height = app->config.height,
+		.row_pitch = row_pitch,
+		.tile_size = tile_size,
+	};
+	const int cpp = layout_is_yuv(app->layout.type) ? 1 : 4;
+	if ((app->layout.type == VKMEMFD_OUTPUT_TILED) != (tile_size > 0) ||
+			row_pitch < (size_t) (tile_size ? tile_size :
+				app->config.width) * cpp)
+		app_fatal("invalid output layout");
 
-	/* B8G8R8A8 */
-	app->xcb.img_size = app->config.width * app->config.height * 4;
-	if (app->xcb.img_size >
-			xcb_get_maximum_request_length(app->xcb.conn) / 2)
-		app_fatal("image size too big");
+	/* only linear outputs have ROIs */
+	app->frame_size = app->config.layout == VKMEMFD_OUTPUT_LINEAR ?
+		app->roi_size : layout_size(&app->layout);
+	/* the sinks see the planes as they are */
+	if (layout_is_yuv(app->layout.type))
+		app->roi_size = app->frame_size;
+	app->read_offset = 0;
+	app->read_size = app->frame_size;
+
+	if (app->config.layout != VKMEMFD_OUTPUT_LINEAR &&
+			!layout_is_yuv(app->config.layout)) {
+		app->linear = malloc(app->img_size);
+		if (!app->linear)
+			app_fatal("failed to allocate linear staging");
+	}
+
+	printf("outputs are %s with a row pitch of %zu bytes\n",
+			layout_name(app->layout.type), row_pitch);
 }
 
-static void app_init_memories(struct app *app, size_t heap_skip,
-		size_t ubo_size, size_t output_size)
+static void app_init_yuv(struct app *app, const struct vkmemfd_layout *layout)
 {
-	void *ptr = app->heap.base + heap_skip;
+	app->yuv.count = layout->plane_count;
+	const int expected = app->layout.type == VKMEMFD_OUTPUT_NV12 ? 2 :
+		app->layout.type == VKMEMFD_OUTPUT_I420 ? 3 : 0;
+	if (app->yuv.count != expected)
+		app_fatal("invalid plane count");
 
-	app->mems.ubo = ptr;
-	ptr += ubo_size;
+	for (int i = 0; i < app->yuv.count; i++) {
+		app->yuv.planes[i].offset = layout->planes[i].offset;
+		app->yuv.planes[i].row_pitch = layout->planes[i].row_pitch;
+
+		/* the Y plane is followed by the chroma planes at half height */
+		const int height = i ? app->config.height / 2 : app->config.height;
+		if (app->yuv.planes[i].offset + app->yuv.planes[i].row_pitch *
+				height > layout_size(&app->layout))
+			app_fatal("invalid plane layout");
+
+		printf("plane %d at offset %zu with a row pitch of %zu bytes\n", i,
+				app->yuv.planes[i].offset,
+				app->yuv.planes[i].row_pitch);
+	}
+}
+
+static void app_init_preview(struct app *app,
+		const struct vkmemfd_layout *layout)
+{
+	app->preview.count = layout->preview_count;
+	if (app->preview.count != __builtin_popcount(app->config.preview_levels))
+		app_fatal("invalid preview count");
 
+	size_t end = layout_size(&app->layout);
+	int level = 0;
+	for (int i = 0; i < app->preview.count; i++) {
+		app->preview.levels[i].offset = layout->previews[i].offset;
+		app->preview.levels[i].width = layout->previews[i].width;
+		app->preview.levels[i].height = layout->previews[i].height;
+
+		/* the previews are in the order of their levels */
+		while (!(app->config.preview_levels & (1u << ++level)))
+			;
+		if (app->preview.levels[i].offset < end ||
+				app->preview.levels[i].offset % 4 ||
+				app->preview.levels[i].width !=
+				app->config.width >> level ||
+				app->preview.levels[i].height !=
+				app->config.height >> level)
+			app_fatal("invalid preview layout");
+		end = app->preview.levels[i].offset +
+			(size_t) app->preview.levels[i].width *
+			app->preview.levels[i].height * 4;
+
+		printf("preview %dx%d at offset %zu\n",
+				app->preview.levels[i].width,
+				app->preview.levels[i].height,
+				app->preview.levels[i].offset);
+	}
+}
+
+static void app_init_memories(struct app *app,
+		const struct vkmemfd_layout *layout)
+{
 	app->mems.outputs = malloc(sizeof(app->mems.outputs[0]) *
 			app->config.output_count);
-	if (!app->mems.outputs)
+	app->inflight.outputs = calloc(app->config.output_count,
+			sizeof(app->inflight.outputs[0]));
+	if (!app->mems.outputs || !app->inflight.outputs)
 		app_fatal("failed to allocate output pointers");
 
+	app->mems.ubo_stride = layout->ubo_stride;
+	if (layout->ubo_stride < sizeof(struct renderer_params) ||
+			layout->ubo_size < (size_t) layout->ubo_stride *
+			app->config.output_count)
+		app_fatal("invalid ubo size");
+	const size_t used_size = app->preview.count ?
+		app->preview.levels[app->preview.count - 1].offset +
+		(size_t) app->preview.levels[app->preview.count - 1].width *
+		app->preview.levels[app->preview.count - 1].height * 4 :
+		layout_size(&app->layout);
+	if (layout->output_size < used_size)
+		app_fatal("invalid output size");
+
+	if (app->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		app_init_exports(app, layout);
+		return;
+	}
+
+	void *ptr = app->heap.base + layout->base_skip;
+
+	app->mems.ubo = ptr;
+	ptr += layout->ubo_size;
+
 	for (int i = 0; i < app->config.output_count; i++) {
 		app->mems.outputs[i] = ptr;
-		ptr += output_size;
+		ptr += layout->output_size;
 	}
 
-	if (ubo_size < sizeof(float[4]))
-		app_fatal("invalid ubo size");
-	if (output_size < app->xcb.img_size)
-		app_fatal("invalid output size");
 	if (ptr - app->heap.base > app->config.heap_size)
 		app_fatal("heap size too small");
 }
 
+static void app_init_attach(struct app *app,
+		const struct vkmemfd_layout *layout)
+{
+	const size_t output_offset = layout->base_skip + layout->ubo_size;
+
+	/* past the memories of the renderer */
+	app->attach.offset = (output_offset + (size_t) layout->output_size *
+			app->config.output_count + 4095) & ~(size_t) 4095;
+	if (app->attach.offset + attach_header_size(app->config.output_count) >
+			app->config.heap_size)
+		app_fatal("heap size too small");
+
+	/* only linear outputs have ROIs */
+	const bool has_roi = app->layout.type == VKMEMFD_OUTPUT_LINEAR;
+	struct attach_header *hdr = app->heap.base + app->attach.offset;
+	hdr->magic = ATTACH_MAGIC;
+	hdr->output_count = app->config.output_count;
+	hdr->layout = app->layout.type;
+	hdr->width = has_roi ? app->config.roi.width : app->config.width;
+	hdr->height = has_roi ? app->config.roi.height : app->config.height;
+	hdr->row_pitch = has_roi ? app->config.roi.width * 4 :
+		app->layout.row_pitch;
+	hdr->tile_size = app->layout.tile_size;
+	hdr->frame_size = app->frame_size;
+	hdr->output_offset = output_offset;
+	hdr->output_stride = layout->output_size;
+	app->attach.header = hdr;
+
+	/* Readers get a read-only fd.  With future writes sealed, not even
+	 * reopening it through /proc makes the heap writable to them.  The
+	 * existing mappings of the renderer and ours stay writable.
+	 */
+	app->attach.fd = vkmemfd_heap_open_read_only(&app->heap);
+	if (app->attach.fd < 0)
+		app_fatal("failed to reopen memfd read-only");
+
+	if (!vkmemfd_heap_seal(&app->heap, true))
+		app_fatal("failed to seal memfd writes");
+
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(app->config.attach_path) >= sizeof(addr.sun_path))
+		app_fatal("attach path too long");
+	strcpy(addr.sun_path, app->config.attach_path);
+	unlink(addr.sun_path);
+
+	/* readers are accepted and heard from without ever blocking */
+	app->attach.listen_fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK |
+			SOCK_CLOEXEC, 0);
+	if (app->attach.listen_fd < 0 ||
+			bind(app->attach.listen_fd, (const struct sockaddr *) &addr,
+				sizeof(addr)) < 0 ||
+			listen(app->attach.listen_fd,
+				ARRAY_SIZE(app->attach.readers)) < 0)
+		app_fatal("failed to listen for readers");
+
+	printf("attach: readers attach at %s, header at offset %zu\n",
+			app->config.attach_path, app->attach.offset);
+}
+
 static uint32_t app_recv(const struct app *app)
 {
 	uint32_t val;
-	if (read(app->renderer.in, &val, sizeof(val)) != sizeof(val))
+	if (!vkmemfd_recv_value(app->renderer.in, &val))
 		app_fatal("failed to receive a value");
 
 	return val;
 }
 
-static void app_send(const struct app *app, uint32_t val)
+static int app_recv_fd(const struct app *app, uint32_t *val)
+{
+	const int fd = vkmemfd_recv_fd(app->renderer.in, val);
+	if (fd < 0)
+		app_fatal("failed to receive an fd");
+
+	return fd;
+}
+
+static void app_send(const struct app *app,
+		const struct vkmemfd_request *reqs, int count)
+{
+	if (!vkmemfd_submit(app->renderer.out, reqs, count))
+		app_fatal("failed to send requests");
+}
+
+static void app_flush_requests(struct app *app)
 {
-	if (write(app->renderer.out, &val, sizeof(val)) != sizeof(val))
-		app_fatal("failed to send a value");
+	if (!app->batch.count)
+		return;
 
+	app_send(app, app->batch.reqs, app->batch.count);
+	app->batch.count = 0;
 }
 
-static void app_render_frame(const struct app *app, int output,
+static void app_request_frame(struct app *app, int output,
 		const float rgba[4])
 {
-	memcpy(app->mems.ubo, rgba, sizeof(float) * 4);
+	void *ubo = app->mems.ubo + app->mems.ubo_stride * output;
+
+	bool skip = false;
+	if (app->skip.colors) {
+		skip = app->skip.valid[output] &&
+			!memcmp(app->skip.colors[output], rgba,
+					sizeof(app->skip.colors[output]));
+		memcpy(app->skip.colors[output], rgba,
+				sizeof(app->skip.colors[output]));
+		app->skip.valid[output] = true;
+	}
+
+	struct renderer_params params = {
+		.color = { rgba[0], rgba[1], rgba[2], rgba[3] },
+		/* the triangle */
+		.draw = {
+			.vertex_count = 3,
+			.instance_count = 1,
+		},
+		.skip = skip,
+	};
+	/* the whole output is copied with a prerecorded command buffer */
+	if (app->config.roi.width < app->config.width ||
+			app->config.roi.height < app->config.height) {
+		params.roi.x = app->config.roi.x;
+		params.roi.y = app->config.roi.y;
+		params.roi.width = app->config.roi.width;
+		params.roi.height = app->config.roi.height;
+	}
+
+	/* exported dma-bufs have well-defined CPU access */
+	if (app->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		if (dmabuf_sync_start(app->exports.fds[0], true))
+			app_fatal("failed to start UBO access");
+		upload(ubo, &params, sizeof(params),
+				app->config.upload_threshold);
+		if (dmabuf_sync_end(app->exports.fds[0], true))
+			app_fatal("failed to end UBO access");
+	} else {
+		upload(ubo, &params, sizeof(params),
+				app->config.upload_threshold);
+	}
 
 	/* The heap coherency is platform-defined.  When it is incoherent, we
 	 * need to simulate vkFlushMappedMemoryRanges
@@ -211,27 +746,922 @@ static void app_render_frame(const struct app *app, int output,
 	 * This needs a platform requirement and/or a Vulkan exntesion to be
 	 * properly handled.
 	 */
-	if (!app->config.is_coherent) {
+	if (!app->config.is_coherent &&
+			app->config.heap_type != VKMEMFD_HEAP_EXPORT) {
 		__builtin_ia32_mfence();
-		__builtin_ia32_clflush(app->mems.ubo);
+		/* the params span several cache lines */
+		for (size_t off = 0; off < sizeof(params); off += 64)
+			__builtin_ia32_clflush(ubo + off);
+		__builtin_ia32_clflush(ubo + sizeof(params) - 1);
+	}
+
+	if (app->verify.colors)
+		app->verify.colors[output] = verify_pack_color(rgba);
+
+	if (app->attach.header)
+		attach_begin_write(app->attach.header, output);
+
+	const uint64_t now = app_now();
+	const struct vkmemfd_request req = {
+		.output = output,
+		.flags = app->config.batch_size > 1 ? VKMEMFD_REQUEST_BATCH : 0,
+		.deadline = app->config.deadline ?
+			now + app->config.deadline : 0,
+	};
+	if (app->trace.fp && !trace_write(&app->trace, now, &req, &params))
+		app_fatal("failed to record the request");
+
+	if (app->config.batch_size > 1) {
+		app->batch.reqs[app->batch.count++] = req;
+		if (app->batch.count == app->config.batch_size)
+			app_flush_requests(app);
+	} else {
+		app_send(app, &req, 1);
 	}
 
-	app_send(app, output);
-	if (app_recv(app) != output)
+	app->inflight.outputs[output] = true;
+	app->inflight.count++;
+}
+
+/* return the output, or -1 when the renderer dropped the request */
+static int app_complete_frame(struct app *app)
+{
+	uint32_t reply;
+	if (!vkmemfd_wait(app->renderer.in, &reply))
+		app_fatal("failed to receive a reply");
+
+	const uint32_t output = reply & ~VKMEMFD_REPLY_DROPPED;
+	if (output >= app->config.output_count || !app->inflight.outputs[output])
 		app_fatal("unexpected renderer output");
+
+	app->inflight.outputs[output] = false;
+	app->inflight.count--;
+
+	if (app->attach.header) {
+		attach_end_write(app->attach.header, output,
+				(reply & VKMEMFD_REPLY_DROPPED) ? 0 :
+				++app->attach.generation);
+	}
+
+	if (!(reply & VKMEMFD_REPLY_DROPPED))
+		return output;
+
+	/* the output was not rendered in the requested color */
+	if (app->skip.valid)
+		app->skip.valid[output] = false;
+
+	return -1;
+}
+
+static void app_init_xcb_format(struct app *app, const xcb_setup_t *setup,
+		const xcb_screen_t *screen)
+{
+	const xcb_visualtype_t *visual = NULL;
+	for (xcb_depth_iterator_t d = xcb_screen_allowed_depths_iterator(screen);
+			d.rem && !visual; xcb_depth_next(&d)) {
+		for (xcb_visualtype_iterator_t v = xcb_depth_visuals_iterator(d.data);
+				v.rem; xcb_visualtype_next(&v)) {
+			if (v.data->visual_id == screen->root_visual) {
+				visual = v.data;
+				break;
+			}
+		}
+	}
+	if (!visual)
+		app_fatal("failed to find the root visual");
+
+	const xcb_format_t *format = NULL;
+	for (xcb_format_iterator_t f = xcb_setup_pixmap_formats_iterator(setup);
+			f.rem; xcb_format_next(&f)) {
+		if (f.data->depth == screen->root_depth) {
+			format = f.data;
+			break;
+		}
+	}
+	if (!format)
+		app_fatal("failed to find the root pixmap format");
+
+	const struct {
+		uint8_t depth;
+		uint8_t bpp;
+		uint32_t red_mask;
+		uint32_t green_mask;
+		uint32_t blue_mask;
+		enum convert_format format;
+	} format_table[] = {
+		{ 24, 32, 0xff0000, 0x00ff00, 0x0000ff, CONVERT_FORMAT_XRGB8888 },
+		{ 32, 32, 0xff0000, 0x00ff00, 0x0000ff, CONVERT_FORMAT_XRGB8888 },
+		{ 16, 16, 0xf800, 0x07e0, 0x001f, CONVERT_FORMAT_RGB565 },
+		{ 30, 32, 0x3ff00000, 0x000ffc00, 0x000003ff, CONVERT_FORMAT_XRGB2101010 },
+	};
+	int i;
+	for (i = 0; i < ARRAY_SIZE(format_table); i++) {
+		if (format_table[i].depth == format->depth &&
+				format_table[i].bpp == format->bits_per_pixel &&
+				format_table[i].red_mask == visual->red_mask &&
+				format_table[i].green_mask == visual->green_mask &&
+				format_table[i].blue_mask == visual->blue_mask)
+			break;
+	}
+	if (i == ARRAY_SIZE(format_table))
+		app_fatal("unsupported root visual");
+
+	app->xcb.depth = format->depth;
+	app->xcb.format = format_table[i].format;
+	/* the swapped formats immediately follow the unswapped ones */
+	if (setup->image_byte_order == XCB_IMAGE_ORDER_MSB_FIRST)
+		app->xcb.format++;
+
+	const size_t pad = format->scanline_pad / 8;
+	app->xcb.stride = app->config.roi.width * format->bits_per_pixel / 8;
+	app->xcb.stride = (app->xcb.stride + pad - 1) / pad * pad;
+
+	app->xcb.isa = convert_detect_isa();
+	app->xcb.convert = convert_get_func(app->xcb.format, app->xcb.isa);
+	if (app->xcb.format == CONVERT_FORMAT_XRGB8888 &&
+			app->xcb.stride == app->config.roi.width * 4) {
+		/* put the outputs directly */
+		app->xcb.converted = NULL;
+	} else {
+		app->xcb.converted = malloc(app->xcb.stride *
+				app->config.roi.height);
+		if (!app->xcb.converted)
+			app_fatal("failed to allocate conversion buffer");
+	}
+
+	printf("x11: depth %d, %s, %s conversion\n", app->xcb.depth,
+			convert_format_name(app->xcb.format),
+			app->xcb.converted ? convert_isa_name(app->xcb.isa) :
+			"no");
 }
 
-static void app_present_frame(const struct app *app, int output)
+static void app_init_xcb(struct app *app)
 {
+	const xcb_screen_t *screen;
+
+	app->xcb.conn = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(app->xcb.conn))
+		app_fatal("failed to connect to X");
+
+	/* xcb enables BIG-REQUESTS when it is present */
+	xcb_prefetch_extension_data(app->xcb.conn, &xcb_big_requests_id);
+	xcb_prefetch_maximum_request_length(app->xcb.conn);
+
+	if (layout_is_yuv(app->layout.type))
+		app_fatal("x11 sinks require RGB outputs");
+
+	const xcb_setup_t *setup = xcb_get_setup(app->xcb.conn);
+	screen = xcb_setup_roots_iterator(setup).data;
+
+	app_init_xcb_format(app, setup, screen);
+
+	app->xcb.win = xcb_generate_id(app->xcb.conn);
+	xcb_create_window(app->xcb.conn, XCB_COPY_FROM_PARENT, app->xcb.win,
+			screen->root, 0, 0, app->config.width,
+			app->config.height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+			screen->root_visual, 0, NULL);
+
+	app->xcb.gc = xcb_generate_id(app->xcb.conn);
+	xcb_create_gc(app->xcb.conn, app->xcb.gc, app->xcb.win, 0, NULL);
+
+	xcb_map_window(app->xcb.conn, app->xcb.win);
+	xcb_flush(app->xcb.conn);
+}
+
+static void app_poll_xcb(const struct app *app)
+{
+	if (xcb_poll_for_event(app->xcb.conn))
+		app_fatal("unexpected XCB event");
+}
+
+static void app_init_bands(struct app *app)
+{
+	const xcb_query_extension_reply_t *ext =
+		xcb_get_extension_data(app->xcb.conn, &xcb_big_requests_id);
+	const bool has_big_requests = ext && ext->present;
+
+	/* in 4-byte units; a PutImage request has a 24-byte header, plus 4
+	 * more bytes when it is a big request
+	 */
+	const size_t max_size =
+		(size_t) xcb_get_maximum_request_length(app->xcb.conn) * 4;
+	const size_t header_size = has_big_requests ? 28 : 24;
+	const size_t stride = app->xcb.stride;
+	if (max_size < header_size + stride)
+		app_fatal("image row too big");
+
+	app->xcb.band_height = (max_size - header_size) / stride;
+	if (app->xcb.band_height > app->config.roi.height)
+		app->xcb.band_height = app->config.roi.height;
+	app->xcb.band_count = (app->config.roi.height +
+			app->xcb.band_height - 1) / app->xcb.band_height;
+
+	printf("x11: BIG-REQUESTS %s, %d requests per frame\n",
+			has_big_requests ? "enabled" : "missing",
+			app->xcb.band_count);
+}
+
+/* only the ROI is put, at its place */
+static void app_put_image(const struct app *app, xcb_drawable_t drawable,
+		const void *pixels)
+{
+	const int width = app->config.roi.width;
+	const int height = app->config.roi.height;
+	const size_t stride = app->xcb.stride;
+	if (app->xcb.converted) {
+		for (int y = 0; y < height; y++) {
+			app->xcb.convert((uint8_t *) app->xcb.converted + stride * y,
+					(const uint8_t *) pixels +
+					(size_t) width * 4 * y, width);
+		}
+		pixels = app->xcb.converted;
+	}
+
+	/* split the image into row bands when it exceeds the maximum request
+	 * length; the bands are flushed together
+	 */
+	for (int y = 0; y < height; y += app->xcb.band_height) {
+		int band_height = height - y;
+		if (band_height > app->xcb.band_height)
+			band_height = app->xcb.band_height;
+
+		xcb_put_image(app->xcb.conn, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				drawable, app->xcb.gc, width, band_height,
+				app->config.roi.x, app->config.roi.y + y, 0,
+				app->xcb.depth, stride * band_height,
+				(const uint8_t *) pixels + stride * y);
+	}
+}
+
+static void app_init_x11(struct app *app)
+{
+	app_init_xcb(app);
+	app_init_bands(app);
+}
+
+static void app_present_x11(struct app *app, int output,
+		const void *pixels)
+{
+	app_poll_xcb(app);
+
+	app_put_image(app, app->xcb.win, pixels);
+	xcb_flush(app->xcb.conn);
+
+	usleep(1000 * 1000 / 60);
+}
+
+static void app_report_x11(const struct app *app)
+{
+	printf("x11: %d requests per frame\n", app->xcb.band_count);
+}
+
+static void app_init_x11_shm(struct app *app)
+{
+	app_init_xcb(app);
+
+	/* the X server reads the outputs directly */
+	if (app->xcb.converted)
+		app_fatal("x11-shm requires a visual matching the outputs");
+	if (app->layout.type == VKMEMFD_OUTPUT_TILED)
+		app_fatal("x11-shm requires untiled outputs");
+
+	const xcb_query_extension_reply_t *ext =
+		xcb_get_extension_data(app->xcb.conn, &xcb_shm_id);
+	if (!ext || !ext->present)
+		app_fatal("no MIT-SHM support");
+
+	xcb_shm_query_version_reply_t *ver = xcb_shm_query_version_reply(
+			app->xcb.conn, xcb_shm_query_version(app->xcb.conn), NULL);
+	if (!ver || ver->major_version < 1 ||
+			(ver->major_version == 1 && ver->minor_version < 2))
+		app_fatal("no MIT-SHM 1.2 support");
+	free(ver);
+
+	app->xcb.shm_segs = malloc(sizeof(app->xcb.shm_segs[0]) *
+			app->config.output_count);
+	if (!app->xcb.shm_segs)
+		app_fatal("failed to allocate shm segments");
+
+	/* The X server maps the heap, or the exported memories, directly.  xcb
+	 * takes the ownership of the fds.
+	 */
+	for (int i = 0; i < app->config.output_count; i++) {
+		if (app->config.heap_type != VKMEMFD_HEAP_EXPORT && i) {
+			app->xcb.shm_segs[i] = app->xcb.shm_segs[0];
+			continue;
+		}
+
+		const int fd = dup(app->config.heap_type == VKMEMFD_HEAP_EXPORT ?
+				app->exports.fds[1 + i] : app->heap.fd);
+		if (fd < 0)
+			app_fatal("failed to dup shm fd");
+
+		app->xcb.shm_segs[i] = xcb_generate_id(app->xcb.conn);
+		xcb_generic_error_t *err = xcb_request_check(app->xcb.conn,
+				xcb_shm_attach_fd_checked(app->xcb.conn,
+					app->xcb.shm_segs[i], fd, true));
+		if (err)
+			app_fatal("failed to attach shm fd");
+	}
+}
+
+static void app_present_x11_shm(struct app *app, int output,
+		const void *pixels)
+{
+	app_poll_xcb(app);
+
+	const uint32_t offset = app->config.heap_type == VKMEMFD_HEAP_EXPORT ?
+		0 : (const char *) app->mems.outputs[output] -
+		(const char *) app->heap.base;
+	/* the server skips the padding of pitched rows */
+	const int total_width = app->layout.type == VKMEMFD_OUTPUT_PITCHED ?
+		app->layout.row_pitch / 4 : app->config.roi.width;
+	xcb_shm_put_image(app->xcb.conn, app->xcb.win, app->xcb.gc,
+			total_width, app->config.roi.height, 0, 0,
+			app->config.roi.width, app->config.roi.height,
+			app->config.roi.x, app->config.roi.y, app->xcb.depth,
+			XCB_IMAGE_FORMAT_Z_PIXMAP, false,
+			app->xcb.shm_segs[output], offset);
+
+	/* the server reads the output asynchronously; a round trip makes sure
+	 * it is done before the output is reused
+	 */
+	free(xcb_get_input_focus_reply(app->xcb.conn,
+				xcb_get_input_focus(app->xcb.conn), NULL));
+
+	usleep(1000 * 1000 / 60);
+}
+
+static void app_init_x11_present(struct app *app)
+{
+	app_init_xcb(app);
+	app_init_bands(app);
+
+	const xcb_query_extension_reply_t *ext =
+		xcb_get_extension_data(app->xcb.conn, &xcb_present_id);
+	if (!ext || !ext->present)
+		app_fatal("no Present support");
+
+	xcb_present_query_version_reply_t *ver = xcb_present_query_version_reply(
+			app->xcb.conn, xcb_present_query_version(app->xcb.conn,
+				1, 0), NULL);
+	if (!ver)
+		app_fatal("failed to query Present version");
+	free(ver);
+
+	const xcb_present_event_t eid = xcb_generate_id(app->xcb.conn);
+	xcb_present_select_input(app->xcb.conn, eid, app->xcb.win,
+			XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY |
+			XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY);
+	app->present.events = xcb_register_for_special_xge(app->xcb.conn,
+			&xcb_present_id, eid, NULL);
+
+	for (int i = 0; i < ARRAY_SIZE(app->present.pixmaps); i++) {
+		app->present.pixmaps[i] = xcb_generate_id(app->xcb.conn);
+		xcb_create_pixmap(app->xcb.conn, app->xcb.depth,
+				app->present.pixmaps[i],
+				app->xcb.win, app->config.width,
+				app->config.height);
+	}
+
+	/* assume 60Hz until the first two completions */
+	app->present.interval = 1000000000 / 60;
+	app->present.work_begin = app_now();
+}
+
+static void app_wait_present_event(struct app *app)
+{
+	xcb_generic_event_t *event = xcb_wait_for_special_event(app->xcb.conn,
+			app->present.events);
+	if (!event)
+		app_fatal("failed to wait for Present events");
+
+	const xcb_present_generic_event_t *generic = (const void *) event;
+	switch (generic->evtype) {
+	case XCB_PRESENT_EVENT_COMPLETE_NOTIFY: {
+		const xcb_present_complete_notify_event_t *complete =
+			(const void *) event;
+		if (complete->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP)
+			break;
+
+		if (app->present.complete_count) {
+			const uint64_t msc_delta = complete->msc - app->present.msc;
+			if (msc_delta > 1)
+				app->present.missed_count += msc_delta - 1;
+			if (msc_delta) {
+				app->present.interval = (complete->ust -
+						app->present.ust) * 1000 /
+					msc_delta;
+			}
+		}
+
+		app->present.msc = complete->msc;
+		app->present.ust = complete->ust;
+		app->present.complete_count++;
+		app->present.complete_serial = complete->serial;
+
+		/* the latency from PresentPixmap to the frame reaching the
+		 * screen
+		 */
+		const uint64_t submit = app->present.submit_times[
+			complete->serial % ARRAY_SIZE(app->present.submit_times)];
+		const uint64_t ust_ns = complete->ust * 1000;
+		if (ust_ns > submit)
+			app->present.latency_total += ust_ns - submit;
+		break;
+	}
+	case XCB_PRESENT_EVENT_IDLE_NOTIFY: {
+		/* copy presents go idle before they complete */
+		const xcb_present_idle_notify_event_t *idle =
+			(const void *) event;
+		for (int i = 0; i < ARRAY_SIZE(app->present.pixmaps); i++) {
+			if (app->present.pixmaps[i] == idle->pixmap)
+				app->present.busy[i] = false;
+		}
+		break;
+	}
+	default:
+		break;
+	}
+
+	free(event);
+}
+
+static void app_present_x11_present(struct app *app, int output,
+		const void *pixels)
+{
+	const uint64_t begin = app_now();
+	app_poll_xcb(app);
+
+	/* wait only when the ring is exhausted: every pixmap is busy, or as
+	 * many presents as pixmaps have yet to complete
+	 */
+	int idx;
+	while (true) {
+		for (idx = 0; idx < ARRAY_SIZE(app->present.pixmaps); idx++) {
+			if (!app->present.busy[idx])
+				break;
+		}
+		if (idx < ARRAY_SIZE(app->present.pixmaps) &&
+				app->present.serial - app->present.complete_serial <
+				ARRAY_SIZE(app->present.pixmaps))
+			break;
+
+		app_wait_present_event(app);
+	}
+
+	const uint64_t wait_end = app_now();
+	app_put_image(app, app->present.pixmaps[idx], pixels);
+
+	/* one vblank after the last completed or pending frame */
+	uint64_t target_msc = 0;
+	if (app->present.complete_count) {
+		target_msc = app->present.msc + 1;
+		if (app->present.serial != app->present.complete_serial &&
+				target_msc <= app->present.target_msc)
+			target_msc = app->present.target_msc + 1;
+	}
+	app->present.target_msc = target_msc;
+
+	const uint32_t serial = ++app->present.serial;
+	const uint64_t submit = app_now();
+	app->present.submit_times[serial %
+		ARRAY_SIZE(app->present.submit_times)] = submit;
+	xcb_present_pixmap(app->xcb.conn, app->xcb.win,
+			app->present.pixmaps[idx], serial, XCB_NONE, XCB_NONE,
+			0, 0, XCB_NONE, XCB_NONE, XCB_NONE, 0, target_msc, 0, 0,
+			0, NULL);
+	xcb_flush(app->xcb.conn);
+	app->present.busy[idx] = true;
+
+	/* the render and upload time, without the waits, smoothed */
+	const uint64_t work = (begin - app->present.work_begin) +
+		(submit - wait_end);
+	app->present.work = (app->present.work * 7 + work) / 8;
+
+	/* Return just in time for the next frame to make the vblank after this
+	 * one, predicted from the last CompleteNotify.  Leave 1ms of margin.
+	 */
+	if (target_msc) {
+		const uint64_t margin = 1000000;
+		const uint64_t deadline = app->present.ust * 1000 +
+			(target_msc + 1 - app->present.msc) *
+			app->present.interval;
+		if (deadline > app->present.work + margin) {
+			const uint64_t wake = deadline - app->present.work -
+				margin;
+			const uint64_t now = app_now();
+			if (wake > now)
+				usleep((wake - now) / 1000);
+		}
+	}
+
+	app->present.work_begin = app_now();
+}
+
+static void app_report_x11_present(const struct app *app)
+{
+	const int count = app->present.complete_count;
+	printf("x11-present: msc %llu, interval %.2f ms, latency %.2f ms, "
+			"%d missed vblanks\n",
+			(unsigned long long) app->present.msc,
+			app->present.interval / 1e6,
+			count ? app->present.latency_total / 1e6 / count : 0.0,
+			app->present.missed_count);
+}
+
+static void app_init_file(struct app *app)
+{
+	if (!app->config.sink_path)
+		app_fatal("no file sink path");
+
+	/* this blocks until there is a reader when the path is a FIFO */
+	app->file.fd = open(app->config.sink_path,
+			O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (app->file.fd < 0)
+		app_fatal("failed to open file sink");
+}
+
+static void app_write_file(const struct app *app, const void *data,
+		size_t size)
+{
+	const char *ptr = data;
+	size_t rem = size;
+	while (rem) {
+		const ssize_t ret = write(app->file.fd, ptr, rem);
+		if (ret <= 0)
+			app_fatal("failed to write frame");
+		ptr += ret;
+		rem -= ret;
+	}
+}
+
+static void app_present_file(struct app *app, int output,
+		const void *pixels)
+{
+	app_write_file(app, pixels, app->roi_size);
+}
+
+/* only the lowest preview is read */
+static void app_init_preview_file(struct app *app)
+{
+	if (!app->preview.count)
+		app_fatal("preview-file requires previews");
+
+	const int i = app->preview.count - 1;
+	app->read_offset = app->preview.levels[i].offset;
+	app->read_size = (size_t) app->preview.levels[i].width *
+		app->preview.levels[i].height * 4;
+
+	app_init_file(app);
+
+	printf("preview-file: %dx%d, %zu bytes per frame\n",
+			app->preview.levels[i].width,
+			app->preview.levels[i].height, app->read_size);
+}
+
+static void app_present_preview_file(struct app *app, int output,
+		const void *pixels)
+{
+	app_write_file(app, pixels, app->read_size);
+}
+
+static void app_init_checksum(struct app *app)
+{
+	app->checksum.value = 0;
+}
+
+static void app_present_checksum(struct app *app, int output,
+		const void *pixels)
+{
+	/* FNV-1a over 64-bit words */
+	const uint64_t *ptr = pixels;
+	const uint64_t *end = ptr + app->roi_size / sizeof(*ptr);
+	uint64_t hash = 0xcbf29ce484222325ull;
+	while (ptr < end) {
+		hash ^= *ptr++;
+		hash *= 0x100000001b3ull;
+	}
+	/* an ROI of an odd pixel count leaves a pixel */
+	if (app->roi_size % sizeof(*ptr)) {
+		uint32_t last;
+		memcpy(&last, end, sizeof(last));
+		hash ^= last;
+		hash *= 0x100000001b3ull;
+	}
+
+	/* fold in the frame order as well */
+	app->checksum.value = (app->checksum.value ^ hash) * 0x100000001b3ull;
+}
+
+static void app_report_checksum(const struct app *app)
+{
+	printf("checksum %016llx\n", (unsigned long long) app->checksum.value);
+}
+
+static void app_init_null(struct app *app)
+{
+}
+
+static void app_present_null(struct app *app, int output,
+		const void *pixels)
+{
+}
+
+static const struct app_sink app_sinks[] = {
+	{
+		.name = "x11",
+		.needs_cpu_access = true,
+		.reads_pixels = true,
+		.init = app_init_x11,
+		.present = app_present_x11,
+		.report = app_report_x11,
+	},
+	{
+		.name = "x11-shm",
+		.needs_cpu_access = true,
+		.init = app_init_x11_shm,
+		.present = app_present_x11_shm,
+	},
+	{
+		.name = "x11-present",
+		.needs_cpu_access = true,
+		.reads_pixels = true,
+		.init = app_init_x11_present,
+		.present = app_present_x11_present,
+		.report = app_report_x11_present,
+	},
+	{
+		.name = "file",
+		.needs_cpu_access = true,
+		.reads_pixels = true,
+		.takes_path = true,
+		.init = app_init_file,
+		.present = app_present_file,
+	},
+	{
+		.name = "preview-file",
+		.needs_cpu_access = true,
+		.reads_pixels = true,
+		.reads_preview = true,
+		.takes_path = true,
+		.init = app_init_preview_file,
+		.present = app_present_preview_file,
+	},
+	{
+		.name = "checksum",
+		.needs_cpu_access = true,
+		.reads_pixels = true,
+		.init = app_init_checksum,
+		.present = app_present_checksum,
+		.report = app_report_checksum,
+	},
+	{
+		.name = "null",
+		.needs_cpu_access = false,
+		.init = app_init_null,
+		.present = app_present_null,
+	},
+};
+
+static void app_init_readback(struct app *app)
+{
+	app->readback.uncached = calloc(app->config.output_count,
+			sizeof(app->readback.uncached[0]));
+	if (!app->readback.uncached)
+		app_fatal("failed to allocate readback flags");
+
+	/* cached outputs are read in place */
+	enum readback_method method = READBACK_METHOD_PREFETCH;
+	int uncached_count = 0;
+	for (int i = 0; i < app->config.output_count; i++) {
+		const uint32_t mem_flags = app_recv(app);
+		if (readback_pick_method(mem_flags) == READBACK_METHOD_PREFETCH)
+			continue;
+
+		method = readback_pick_method(mem_flags);
+		app->readback.uncached[i] = true;
+		uncached_count++;
+	}
+	if (!uncached_count)
+		return;
+
+	/* enough for the frame, which is larger than the image when its rows
+	 * are padded, or for any preview
+	 */
+	app->readback.stream = readback_get_func(method);
+	app->readback.staging = malloc(app->frame_size > app->img_size ?
+			app->frame_size : app->img_size);
+	if (!app->readback.staging)
+		app_fatal("failed to allocate readback staging");
+
+	printf("readback: %d uncached outputs, copied out with %s\n",
+			uncached_count, readback_method_name(method));
+}
+
+static void app_init_verify(struct app *app)
+{
+	app->verify.func = verify_get_func(convert_detect_isa());
+	app->verify.colors = calloc(app->config.output_count,
+			sizeof(app->verify.colors[0]));
+	if (!app->verify.colors)
+		app_fatal("failed to allocate verify colors");
+
+	printf("verify: every %d rows, %s\n", app->config.verify_row_step,
+			convert_isa_name(convert_detect_isa()));
+}
+
+static void app_init_skip(struct app *app)
+{
+	app->skip.colors = calloc(app->config.output_count,
+			sizeof(app->skip.colors[0]));
+	app->skip.valid = calloc(app->config.output_count,
+			sizeof(app->skip.valid[0]));
+	if (!app->skip.colors || !app->skip.valid)
+		app_fatal("failed to allocate skip colors");
+}
+
+static void app_init_trace(struct app *app)
+{
+	const struct trace_header header = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.width = app->config.width,
+		.height = app->config.height,
+		.output_count = app->config.output_count,
+		.layout = app->config.layout,
+		.row_align = app->config.row_align,
+		.preview_levels = app->config.preview_levels,
+		.pipeline_depth = app->config.pipeline_depth,
+		.batch_size = app->config.batch_size,
+	};
+	if (!trace_writer_init(&app->trace, app->config.record_path, &header))
+		app_fatal("failed to create the trace");
+
+	printf("recording requests to %s\n", app->config.record_path);
+}
+
+/* write the output as a PPM */
+static void app_dump_frame(const struct app *app, int output,
+		const void *pixels, const char *path)
+{
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		printf("verify: failed to open %s\n", path);
+		return;
+	}
+
+	fprintf(fp, "P6\n%d %d\n255\n", app->config.roi.width,
+			app->config.roi.height);
+	const uint8_t *src = pixels;
+	for (size_t i = 0; i < app->roi_size; i += 4) {
+		const uint8_t rgb[3] = { src[i + 2], src[i + 1], src[i] };
+		fwrite(rgb, 1, sizeof(rgb), fp);
+	}
+	fclose(fp);
+
+	printf("verify: dumped output %d to %s\n", output, path);
+}
+
+static void app_verify_frame(struct app *app, int output,
+		const void *pixels)
+{
+	/* rotate the sampled rows from frame to frame */
+	const int step = app->config.verify_row_step;
+	const size_t bad = verify_frame(app->verify.func, pixels,
+			app->config.width, app->config.height,
+			app->config.roi.x, app->config.roi.y,
+			app->config.roi.width, app->config.roi.height,
+			app->verify.colors[output], step,
+			app->verify.row_offset);
+	app->verify.row_offset = (app->verify.row_offset + 1) % step;
+
+	app->verify.frame_count++;
+	if (!bad)
+		return;
+
+	app->verify.bad_frame_count++;
+	app->verify.bad_pixel_count += bad;
+	if (!app->verify.dumped) {
+		app_dump_frame(app, output, pixels, "vkmemfd-bad-frame.ppm");
+		app->verify.dumped = true;
+	}
+}
+
+static bool app_send_attach(const struct app *app, int fd)
+{
+	uint64_t offset = app->attach.offset;
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsg_buf;
+	struct msghdr msg = {
+		.msg_iov = &(struct iovec) {
+			.iov_base = &offset,
+			.iov_len = sizeof(offset),
+		},
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buf.buf,
+		.msg_controllen = sizeof(cmsg_buf.buf),
+	};
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &app->attach.fd, sizeof(int));
+
+	return sendmsg(fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(offset);
+}
+
+static void app_accept_readers(struct app *app)
+{
+	while (true) {
+		const int fd = accept4(app->attach.listen_fd, NULL, NULL,
+				SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0)
+			break;
+
+		struct ucred cred;
+		socklen_t len = sizeof(cred);
+		if (app->attach.reader_count == ARRAY_SIZE(app->attach.readers) ||
+				getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred,
+					&len) < 0 ||
+				!app_send_attach(app, fd)) {
+			close(fd);
+			continue;
+		}
+
+		const int i = app->attach.reader_count++;
+		app->attach.readers[i].fd = fd;
+		app->attach.readers[i].pid = cred.pid;
+		memset(&app->attach.readers[i].report, 0,
+				sizeof(app->attach.readers[i].report));
+		printf("attach: reader %d attached\n", (int) cred.pid);
+	}
+}
+
+/* the readers report to us, and a closed socket is a detached reader */
+static void app_report_attach(struct app *app)
+{
+	app_accept_readers(app);
+
+	for (int i = 0; i < app->attach.reader_count; ) {
+		struct attach_report report;
+		ssize_t ret;
+		while ((ret = recv(app->attach.readers[i].fd, &report,
+						sizeof(report), MSG_DONTWAIT)) ==
+				sizeof(report))
+			app->attach.readers[i].report = report;
+
+		if (ret > 0 || (ret < 0 && errno == EAGAIN)) {
+			i++;
+			continue;
+		}
+
+		printf("attach: reader %d detached\n",
+				(int) app->attach.readers[i].pid);
+		close(app->attach.readers[i].fd);
+		app->attach.readers[i] =
+			app->attach.readers[--app->attach.reader_count];
+	}
+
+	printf("attach: %d readers\n", app->attach.reader_count);
+	for (int i = 0; i < app->attach.reader_count; i++) {
+		const struct attach_report *report = &app->attach.readers[i].report;
+		if (!report->duration)
+			continue;
+
+		const uint64_t attempt_count = report->frame_count +
+			report->retry_count;
+		printf("attach: reader %d: %.1f fps, %.1f%% retries, "
+				"%.1f MB/s\n", (int) app->attach.readers[i].pid,
+				report->frame_count * 1e9 / report->duration,
+				attempt_count ? report->retry_count * 100.0 /
+				attempt_count : 0.0,
+				report->byte_count * 1e3 / report->duration);
+	}
+}
+
+static void app_present_frame(struct app *app, int output)
+{
+	const bool needs_cpu_access = app->config.sink->needs_cpu_access ||
+		app->config.verify_row_step;
+
 	/* The heap coherency is platform-defined.  When it is incoherent, we
 	 * need to simulate vkInvalidateMappedMemoryRanges.
 	 *
 	 * This needs a platform requirement and/or a Vulkan exntesion to be
 	 * properly handled.
 	 */
-	if (!app->config.is_coherent) {
-		const void *ptr = app->mems.outputs[output];
-		const void *end = ptr + app->xcb.img_size;
+	if (!needs_cpu_access) {
+		/* nothing reads the pixels */
+	} else if (app->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		if (dmabuf_sync_start(app->exports.fds[1 + output], false))
+			app_fatal("failed to start output access");
+	} else if (!app->config.is_coherent) {
+		const void *ptr = app->mems.outputs[output] + app->read_offset;
+		const void *end = ptr + app->read_size;
 		while (ptr < end) {
 			__builtin_ia32_clflush(ptr);
 			ptr += 64;
@@ -239,35 +1669,203 @@ static void app_present_frame(const struct app *app, int output)
 		__builtin_ia32_mfence();
 	}
 
+	/* loads from memory that is not cached are slow; copy it out once */
+	const void *pixels = app->mems.outputs[output] + app->read_offset;
+	if (app->readback.uncached[output] &&
+			(app->config.sink->reads_pixels ||
+			 app->config.verify_row_step)) {
+		app->readback.stream(app->readback.staging, pixels,
+				app->read_size);
+		pixels = app->readback.staging;
+	}
+
+	/* the sinks and verification expect tightly packed rows, which the
+	 * previews always are
+	 */
+	if (app->linear && !app->config.sink->reads_preview &&
+			(app->config.sink->reads_pixels ||
+			 app->config.verify_row_step)) {
+		layout_linearize(&app->layout, app->linear, pixels);
+		pixels = app->linear;
+	}
+
+	if (app->config.verify_row_step)
+		app_verify_frame(app, output, pixels);
+
 	/* We could use udmabuf/DRI3/Present to avoid CPU access.  But we
 	 * _want_ CPU access such that we can notice incoherency.
 	 */
-	xcb_put_image(app->xcb.conn, XCB_IMAGE_FORMAT_Z_PIXMAP, app->xcb.win,
-			app->xcb.gc, app->config.width, app->config.height,
-			0, 0, 0, 24, app->xcb.img_size,
-			app->mems.outputs[output]);
-	xcb_flush(app->xcb.conn);
+	app->config.sink->present(app, output, pixels);
 
-	usleep(1000 * 1000 / 60);
+	/* the sink is done with the pixels */
+	if (needs_cpu_access && app->config.heap_type == VKMEMFD_HEAP_EXPORT &&
+			dmabuf_sync_end(app->exports.fds[1 + output], false))
+		app_fatal("failed to end output access");
+
+	/* report once per second */
+	app->stats.frame_count++;
+	const uint64_t now = app_now();
+	if (now - app->stats.begin >= 1000000000) {
+		printf("%s: %.1f fps, %zu bytes per frame\n",
+				app->config.sink->name,
+				app->stats.frame_count * 1e9 /
+				(now - app->stats.begin), app->frame_size);
+		if (app->config.sink->report)
+			app->config.sink->report(app);
+		if (app->config.async) {
+			const unsigned queued = app->config.latest_wins ?
+				atomic_load(&app->async.latest) >= 0 :
+				atomic_load(&app->async.head) -
+				atomic_load(&app->async.tail);
+			printf("async: %d presented, %d dropped, %u queued\n",
+					atomic_load(&app->async.presented_count),
+					atomic_load(&app->async.dropped_count),
+					queued);
+		}
+		if (app->config.verify_row_step) {
+			printf("verify: %d frames, %d bad, %zu bad pixels\n",
+					app->verify.frame_count,
+					app->verify.bad_frame_count,
+					app->verify.bad_pixel_count);
+		}
+		if (app->attach.header)
+			app_report_attach(app);
+
+		app->stats.begin = now;
+		app->stats.frame_count = 0;
+	}
 }
 
-static void app_mainloop(const struct app *app)
+static void app_sem_wait(sem_t *sem)
 {
-	xcb_map_window(app->xcb.conn, app->xcb.win);
+	while (sem_wait(sem) < 0) {
+		if (errno != EINTR)
+			app_fatal("failed to wait semaphore");
+	}
+}
+
+static void *app_present_thread(void *arg)
+{
+	struct app *app = arg;
+
+	while (true) {
+		app_sem_wait(&app->async.ready_count);
+
+		int output;
+		if (app->config.latest_wins) {
+			output = atomic_exchange(&app->async.latest, -1);
+			/* already presented on an earlier wakeup */
+			if (output < 0)
+				continue;
+		} else {
+			const unsigned tail = atomic_load(&app->async.tail);
+			output = app->async.ring[tail % ARRAY_SIZE(app->async.ring)];
+		}
+
+		app_present_frame(app, output);
+
+		atomic_store(&app->async.busy[output], false);
+		pthread_mutex_lock(&app->async.mutex);
+		pthread_cond_broadcast(&app->async.idle);
+		pthread_mutex_unlock(&app->async.mutex);
+
+		atomic_fetch_add(&app->async.presented_count, 1);
+		if (!app->config.latest_wins) {
+			atomic_fetch_add(&app->async.tail, 1);
+			sem_post(&app->async.free_count);
+		}
+	}
+
+	return NULL;
+}
+
+static void app_init_async(struct app *app)
+{
+	app->async.busy = calloc(app->config.output_count,
+			sizeof(app->async.busy[0]));
+	if (!app->async.busy)
+		app_fatal("failed to allocate busy flags");
+
+	if (sem_init(&app->async.free_count, 0,
+				ARRAY_SIZE(app->async.ring)) < 0 ||
+			sem_init(&app->async.ready_count, 0, 0) < 0)
+		app_fatal("failed to init semaphores");
+	if (pthread_mutex_init(&app->async.mutex, NULL) ||
+			pthread_cond_init(&app->async.idle, NULL))
+		app_fatal("failed to init idle condition");
+
+	atomic_init(&app->async.head, 0);
+	atomic_init(&app->async.tail, 0);
+	atomic_init(&app->async.latest, -1);
+	atomic_init(&app->async.presented_count, 0);
+	atomic_init(&app->async.dropped_count, 0);
+
+	if (pthread_create(&app->async.thread, NULL, app_present_thread, app))
+		app_fatal("failed to create present thread");
+}
+
+static void app_queue_frame(struct app *app, int output)
+{
+	atomic_store(&app->async.busy[output], true);
+
+	if (app->config.latest_wins) {
+		const int old = atomic_exchange(&app->async.latest, output);
+		if (old >= 0) {
+			atomic_store(&app->async.busy[old], false);
+			atomic_fetch_add(&app->async.dropped_count, 1);
+		}
+	} else {
+		app_sem_wait(&app->async.free_count);
+
+		const unsigned head = atomic_load(&app->async.head);
+		app->async.ring[head % ARRAY_SIZE(app->async.ring)] = output;
+		atomic_store(&app->async.head, head + 1);
+	}
+
+	sem_post(&app->async.ready_count);
+}
+
+static void app_mainloop(struct app *app)
+{
+	app->stats.begin = app_now();
+
+	if (app->config.async)
+		app_init_async(app);
 
 	int output = 0;
 	int output_inc = 1;
 	int channel = 0;
 	while (true) {
-		if (xcb_poll_for_event(app->xcb.conn))
-			app_fatal("unexpected XCB event");
-
 		float rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
 		rgba[channel] = (float) output /
 			(app->config.output_count - 1);
 
-		app_render_frame(app, output, rgba);
-		app_present_frame(app, output);
+		/* wait for a slot, and for the output to be idle */
+		while (app->inflight.count >= app->config.pipeline_depth ||
+				app->inflight.outputs[output]) {
+			app_flush_requests(app);
+
+			const int done = app_complete_frame(app);
+			if (done < 0)
+				continue;
+
+			if (app->config.async)
+				app_queue_frame(app, done);
+			else
+				app_present_frame(app, done);
+		}
+
+		/* the output may still be queued or being presented */
+		if (app->config.async) {
+			pthread_mutex_lock(&app->async.mutex);
+			while (atomic_load(&app->async.busy[output])) {
+				pthread_cond_wait(&app->async.idle,
+						&app->async.mutex);
+			}
+			pthread_mutex_unlock(&app->async.mutex);
+		}
+
+		app_request_frame(app, output, rgba);
 
 		/* next value/channel */
 		output += output_inc;
@@ -285,7 +1883,14 @@ static void app_mainloop(const struct app *app)
 
 static void app_usage(const struct app *app)
 {
-	printf("Usage: %s [udmabuf] [incoherent]\n", app->config.argv0);
+	printf("Usage: %s [udmabuf|export] [incoherent] [size=WxH] [async|latest] "
+			"[pipeline=N] [deadline=MS] [verify[=N]] "
+			"[upload-threshold=BYTES|calibrate] [skip-unchanged] [batch=N] "
+			"[roi=WxH+X+Y] [linear|pitch=ALIGN|tiled|nv12|i420] "
+			"[preview=DIV[,DIV...]] [attach=PATH] [record=PATH] "
+			"[x11|x11-shm|x11-present|file=PATH|preview-file=PATH|"
+			"checksum|null]\n",
+			app->config.argv0);
 	exit(1);
 }
 
@@ -304,7 +1909,9 @@ int main(int argc, char **argv)
 			 * platform-defined
 			 */
 			.is_coherent = true,
-			.use_udmabuf = false,
+			.heap_type = VKMEMFD_HEAP_MEMFD,
+			.sink = &app_sinks[0],
+			.pipeline_depth = 1,
 		},
 	};
 	struct {
@@ -315,13 +1922,13 @@ int main(int argc, char **argv)
 		int ctrl_in;
 		int ctrl_out;
 		int memfd;
-		bool use_udmabuf;
+		enum vkmemfd_heap_type heap_type;
 	} renderer_args = {
 		.valid = false,
 		.width = app.config.width,
 		.height = app.config.height,
 		.output_count = app.config.output_count,
-		.use_udmabuf = app.config.use_udmabuf,
+		.heap_type = app.config.heap_type,
 	};
 
 	for (int i = 1; i < argc; i++) {
@@ -333,42 +1940,225 @@ int main(int argc, char **argv)
 						&renderer_args.memfd) != 3)
 				app_fatal("invalid renderer args");
 		} else if (!strcmp(argv[i], "udmabuf")) {
-			app.config.use_udmabuf = true;
-			renderer_args.use_udmabuf = true;
+			app.config.heap_type = VKMEMFD_HEAP_UDMABUF;
+			renderer_args.heap_type = VKMEMFD_HEAP_UDMABUF;
+		} else if (!strcmp(argv[i], "export")) {
+			app.config.heap_type = VKMEMFD_HEAP_EXPORT;
+			renderer_args.heap_type = VKMEMFD_HEAP_EXPORT;
 		} else if (!strcmp(argv[i], "memfd")) {
-			app.config.use_udmabuf = false;
-			renderer_args.use_udmabuf = false;
+			app.config.heap_type = VKMEMFD_HEAP_MEMFD;
+			renderer_args.heap_type = VKMEMFD_HEAP_MEMFD;
 		} else if (!strcmp(argv[i], "coherent")) {
 			app.config.is_coherent = true;
 		} else if (!strcmp(argv[i], "incoherent")) {
 			app.config.is_coherent = false;
+		} else if (!strcmp(argv[i], "async")) {
+			app.config.async = true;
+		} else if (!strcmp(argv[i], "latest")) {
+			app.config.async = true;
+			app.config.latest_wins = true;
+		} else if (!strncmp(argv[i], "pipeline=", 9)) {
+			app.config.pipeline_depth = atoi(argv[i] + 9);
+			if (app.config.pipeline_depth <= 0 ||
+					app.config.pipeline_depth > 16)
+				app_usage(&app);
+		} else if (!strncmp(argv[i], "batch=", 6)) {
+			app.config.batch_size = atoi(argv[i] + 6);
+			if (app.config.batch_size <= 0 ||
+					app.config.batch_size > 16)
+				app_usage(&app);
+		} else if (!strncmp(argv[i], "deadline=", 9)) {
+			const double ms = atof(argv[i] + 9);
+			if (ms <= 0.0)
+				app_usage(&app);
+			app.config.deadline = ms * 1000000;
+		} else if (!strcmp(argv[i], "upload-threshold=calibrate")) {
+			app.config.upload_threshold = 0;
+		} else if (!strncmp(argv[i], "upload-threshold=", 17)) {
+			app.config.upload_threshold =
+				strtoull(argv[i] + 17, NULL, 0);
+			if (!app.config.upload_threshold)
+				app_usage(&app);
+		} else if (!strcmp(argv[i], "skip-unchanged")) {
+			app.config.skip_unchanged = true;
+		} else if (!strcmp(argv[i], "verify")) {
+			app.config.verify_row_step = 1;
+		} else if (!strncmp(argv[i], "verify=", 7)) {
+			app.config.verify_row_step = atoi(argv[i] + 7);
+			if (app.config.verify_row_step <= 0)
+				app_usage(&app);
+		} else if (!strcmp(argv[i], "linear")) {
+			app.config.layout = VKMEMFD_OUTPUT_LINEAR;
+		} else if (!strncmp(argv[i], "pitch=", 6)) {
+			app.config.layout = VKMEMFD_OUTPUT_PITCHED;
+			app.config.row_align = atoi(argv[i] + 6);
+			if (app.config.row_align <= 0)
+				app_usage(&app);
+		} else if (!strcmp(argv[i], "tiled")) {
+			app.config.layout = VKMEMFD_OUTPUT_TILED;
+		} else if (!strcmp(argv[i], "nv12")) {
+			app.config.layout = VKMEMFD_OUTPUT_NV12;
+		} else if (!strcmp(argv[i], "i420")) {
+			app.config.layout = VKMEMFD_OUTPUT_I420;
+		} else if (!strncmp(argv[i], "preview=", 8)) {
+			/* powers of two, from 2 to 1 << VKMEMFD_PREVIEW_LEVEL_MAX */
+			const char *str = argv[i] + 8;
+			while (true) {
+				char *end;
+				const long div = strtol(str, &end, 10);
+				if (end == str || div < 2 ||
+						div > (1 << VKMEMFD_PREVIEW_LEVEL_MAX) ||
+						(div & (div - 1)))
+					app_usage(&app);
+				app.config.preview_levels |= 1u << __builtin_ctzl(div);
+
+				if (!*end)
+					break;
+				if (*end != ',')
+					app_usage(&app);
+				str = end + 1;
+			}
+		} else if (!strncmp(argv[i], "attach=", 7)) {
+			app.config.attach_path = argv[i] + 7;
+			if (!*app.config.attach_path)
+				app_usage(&app);
+		} else if (!strncmp(argv[i], "record=", 7)) {
+			app.config.record_path = argv[i] + 7;
+			if (!*app.config.record_path)
+				app_usage(&app);
+		} else if (!strncmp(argv[i], "roi=", 4)) {
+			if (sscanf(argv[i] + 4, "%dx%d+%d+%d",
+						&app.config.roi.width,
+						&app.config.roi.height,
+						&app.config.roi.x,
+						&app.config.roi.y) != 4 ||
+					app.config.roi.width <= 0 ||
+					app.config.roi.height <= 0 ||
+					app.config.roi.x < 0 ||
+					app.config.roi.y < 0)
+				app_usage(&app);
+		} else if (!strncmp(argv[i], "size=", 5)) {
+			/* row bands are put at INT16 dst_y */
+			if (sscanf(argv[i] + 5, "%dx%d", &app.config.width,
+						&app.config.height) != 2 ||
+					app.config.width <= 0 ||
+					app.config.width > UINT16_MAX ||
+					app.config.height <= 0 ||
+					app.config.height > INT16_MAX)
+				app_usage(&app);
+			renderer_args.width = app.config.width;
+			renderer_args.height = app.config.height;
 		} else {
-			app_usage(&app);
+			const char *path = strchr(argv[i], '=');
+			const size_t len = path ? (size_t) (path - argv[i]) :
+				strlen(argv[i]);
+
+			const struct app_sink *sink = NULL;
+			for (size_t j = 0; j < ARRAY_SIZE(app_sinks); j++) {
+				if (strlen(app_sinks[j].name) == len &&
+						!strncmp(argv[i], app_sinks[j].name, len)) {
+					sink = &app_sinks[j];
+					break;
+				}
+			}
+			if (!sink || sink->takes_path != (path != NULL) ||
+					(path && !path[1]))
+				app_usage(&app);
+
+			app.config.sink = sink;
+			app.config.sink_path = path ? path + 1 : NULL;
 		}
 	}
 
+	if (!app.config.roi.width) {
+		app.config.roi.width = app.config.width;
+		app.config.roi.height = app.config.height;
+	} else if (app.config.layout != VKMEMFD_OUTPUT_LINEAR ||
+			app.config.roi.width > app.config.width - app.config.roi.x ||
+			app.config.roi.height > app.config.height -
+			app.config.roi.y) {
+		app_usage(&app);
+	}
+
+	/* verification reads the full outputs in B8G8R8A8 */
+	if (app.config.verify_row_step && (app.config.sink->reads_preview ||
+				layout_is_yuv(app.config.layout)))
+		app_usage(&app);
+
+	/* the conversion works on 8x2 pixels at a time */
+	if (layout_is_yuv(app.config.layout) &&
+			(app.config.width % 8 || app.config.height % 2))
+		app_usage(&app);
+
+	/* readers attach to the memfd */
+	if (app.config.attach_path &&
+			app.config.heap_type == VKMEMFD_HEAP_EXPORT)
+		app_usage(&app);
+
+	/* a batch needs as many requests in flight */
+	if (app.config.pipeline_depth < app.config.batch_size)
+		app.config.pipeline_depth = app.config.batch_size;
+
 	if (renderer_args.valid) {
-		printf("renderer uses %s\n", renderer_args.use_udmabuf ?
-				"udmabuf" : "memfd");
+		printf("renderer uses %s\n",
+				renderer_heap_type_name(renderer_args.heap_type));
 		return renderer(renderer_args.width, renderer_args.height,
 				renderer_args.output_count,
 				renderer_args.ctrl_in, renderer_args.ctrl_out,
 				renderer_args.memfd,
-				renderer_args.use_udmabuf);
+				renderer_args.heap_type, app.config.layout,
+				app.config.row_align, app.config.preview_levels,
+				app.config.skip_unchanged);
 	}
 
 	printf("memfd heap is assumed %s\n", app.config.is_coherent ?
 			"coherent" : "incoherent");
 
+	printf("presenting to %s\n", app.config.sink->name);
+
+	/* the heap writes are the params of one output at a time, so they are
+	 * the only size worth calibrating, and a larger threshold is never
+	 * reached
+	 */
+	if (!app.config.upload_threshold) {
+		app.config.upload_threshold = upload_calibrate(
+				sizeof(struct renderer_params),
+				sizeof(struct renderer_params));
+	}
+	if (app.config.upload_threshold > sizeof(struct renderer_params))
+		app.config.upload_threshold = UPLOAD_NEVER;
+	if (app.config.upload_threshold == UPLOAD_NEVER)
+		printf("upload: streaming stores never used\n");
+	else
+		printf("upload: streaming stores from %zu bytes\n",
+				app.config.upload_threshold);
+
+	app.img_size = (size_t) app.config.width * app.config.height * 4;
+	app.roi_size = (size_t) app.config.roi.width * app.config.roi.height * 4;
+
 	app_init_heap(&app);
 	app_init_renderer(&app);
-	app_init_xcb(&app);
 
 	/* get the heap layout from the renderer */
-	const size_t heap_skip = app_recv(&app);
-	const size_t ubo_size = app_recv(&app);
-	const size_t output_size = app_recv(&app);
-	app_init_memories(&app, heap_skip, ubo_size, output_size);
+	struct vkmemfd_layout layout;
+	if (!vkmemfd_recv_layout(app.renderer.in, &layout))
+		app_fatal("failed to receive the heap layout");
+	app_init_layout(&app, &layout);
+	app_init_yuv(&app, &layout);
+	app_init_preview(&app, &layout);
+	app_init_memories(&app, &layout);
+	app_init_readback(&app);
+	/* the renderer has mapped the heap by now */
+	if (app.config.attach_path)
+		app_init_attach(&app, &layout);
+	if (app.config.verify_row_step)
+		app_init_verify(&app);
+	if (app.config.skip_unchanged)
+		app_init_skip(&app);
+	if (app.config.record_path)
+		app_init_trace(&app);
+
+	app.config.sink->init(&app);
 
 	app_mainloop(&app);
 
@@ -0,0 +1,127 @@
+#include "readback.h"
+
+#include <stdbool.h>
+#include <string.h>
+
+#include <immintrin.h>
+#include <vulkan/vulkan.h>
+
+/* far enough ahead to cover the memory latency */
+#define READBACK_PREFETCH_DISTANCE 512
+
+static void readback_memcpy(void *dst, const void *src, size_t size)
+{
+	memcpy(dst, src, size);
+}
+
+/* SSE2; a cache line at a time */
+
+static void readback_prefetch(void *dst, const void *src, size_t size)
+{
+	const char *s = src;
+	char *d = dst;
+	size_t i = 0;
+	for (; i + 64 <= size; i += 64) {
+		/* prefetches past the end do not fault */
+		_mm_prefetch(s + i + READBACK_PREFETCH_DISTANCE, _MM_HINT_T0);
+
+		const __m128i x0 = _mm_loadu_si128((const __m128i *) (s + i));
+		const __m128i x1 = _mm_loadu_si128((const __m128i *) (s + i + 16));
+		const __m128i x2 = _mm_loadu_si128((const __m128i *) (s + i + 32));
+		const __m128i x3 = _mm_loadu_si128((const __m128i *) (s + i + 48));
+		_mm_storeu_si128((__m128i *) (d + i), x0);
+		_mm_storeu_si128((__m128i *) (d + i + 16), x1);
+		_mm_storeu_si128((__m128i *) (d + i + 32), x2);
+		_mm_storeu_si128((__m128i *) (d + i + 48), x3);
+	}
+	memcpy(d + i, s + i, size - i);
+}
+
+/* SSE4.1; a cache line at a time */
+
+#define READBACK_SSE41 __attribute__((target("sse4.1")))
+
+READBACK_SSE41 static void readback_stream(void *dst, const void *src,
+		size_t size)
+{
+	const char *s = src;
+	char *d = dst;
+
+	/* MOVNTDQA requires 16-byte alignment */
+	size_t i = -(uintptr_t) s & 15;
+	if (i > size)
+		i = size;
+	memcpy(d, s, i);
+
+	/* The four loads of a line are issued together so that they are
+	 * served by one streaming load buffer fill.
+	 */
+	for (; i + 64 <= size; i += 64) {
+		__m128i *p = (__m128i *) (s + i);
+		const __m128i x0 = _mm_stream_load_si128(p);
+		const __m128i x1 = _mm_stream_load_si128(p + 1);
+		const __m128i x2 = _mm_stream_load_si128(p + 2);
+		const __m128i x3 = _mm_stream_load_si128(p + 3);
+		_mm_storeu_si128((__m128i *) (d + i), x0);
+		_mm_storeu_si128((__m128i *) (d + i + 16), x1);
+		_mm_storeu_si128((__m128i *) (d + i + 32), x2);
+		_mm_storeu_si128((__m128i *) (d + i + 48), x3);
+	}
+	memcpy(d + i, s + i, size - i);
+}
+
+const char *readback_method_name(enum readback_method method)
+{
+	switch (method) {
+	case READBACK_METHOD_MEMCPY:
+		return "memcpy";
+	case READBACK_METHOD_PREFETCH:
+		return "prefetch";
+	case READBACK_METHOD_STREAM:
+		return "stream";
+	default:
+		return "unknown";
+	}
+}
+
+static bool readback_method_supported(enum readback_method method)
+{
+	__builtin_cpu_init();
+
+	switch (method) {
+	case READBACK_METHOD_MEMCPY:
+		return true;
+	case READBACK_METHOD_PREFETCH:
+		return __builtin_cpu_supports("sse2");
+	case READBACK_METHOD_STREAM:
+		return __builtin_cpu_supports("sse4.1");
+	default:
+		return false;
+	}
+}
+
+enum readback_method readback_pick_method(uint32_t mem_flags)
+{
+	if (mem_flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT)
+		return READBACK_METHOD_PREFETCH;
+
+	return readback_method_supported(READBACK_METHOD_STREAM) ?
+		READBACK_METHOD_STREAM : READBACK_METHOD_MEMCPY;
+}
+
+readback_func readback_get_func(enum readback_method method)
+{
+	if (!readback_method_supported(method))
+		return NULL;
+
+	switch (method) {
+	case READBACK_METHOD_MEMCPY:
+		return readback_memcpy;
+	case READBACK_METHOD_PREFETCH:
+		return readback_prefetch;
+	case READBACK_METHOD_STREAM:
+		return readback_stream;
+	default:
+		return NULL;
+	}
+}
@@ -0,0 +1,27 @@
+#ifndef READBACK_H
+#define READBACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum readback_method {
+	/* plain memcpy */
+	READBACK_METHOD_MEMCPY,
+	/* SSE2 copy with software prefetches, for cached memory */
+	READBACK_METHOD_PREFETCH,
+	/* MOVNTDQA streaming loads, for write-combined or uncached memory */
+	READBACK_METHOD_STREAM,
+	READBACK_METHOD_COUNT,
+};
+
+typedef void (*readback_func)(void *dst, const void *src, size_t size);
+
+const char *readback_method_name(enum readback_method method);
+
+/* pick a method for memory with the VkMemoryPropertyFlags */
+enum readback_method readback_pick_method(uint32_t mem_flags);
+
+/* return NULL when the method is not supported by the CPU */
+readback_func readback_get_func(enum readback_method method);
+
+#endif /* READBACK_H */
@@ -0,0 +1,244 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "attach.h"
+
+/* A reader attached to the heap of a vkmemfd started with attach=PATH.  It
+ * copies out the latest frame whenever there is a new one, and reports to
+ * vkmemfd every second.
+ */
+struct reader {
+	struct {
+		const char *path;
+		/* between checks for a new frame, in us */
+		int poll_interval;
+	} config;
+
+	int sock;
+
+	struct {
+		int fd;
+		size_t size;
+		const void *base;
+	} heap;
+
+	const struct attach_header *header;
+	void *frame;
+	uint32_t generation;
+
+	/* since the last report */
+	struct attach_report report;
+	uint64_t skipped_count;
+	uint64_t begin;
+};
+
+static void reader_fatal(const char *msg)
+{
+	printf("READER-FATAL: %s\n", msg);
+	abort();
+}
+
+static uint64_t reader_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void reader_connect(struct reader *reader)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	if (strlen(reader->config.path) >= sizeof(addr.sun_path))
+		reader_fatal("attach path too long");
+	strcpy(addr.sun_path, reader->config.path);
+
+	reader->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+	if (reader->sock < 0 || connect(reader->sock,
+				(const struct sockaddr *) &addr,
+				sizeof(addr)) < 0)
+		reader_fatal("failed to connect");
+}
+
+/* receive the heap fd and the offset of the header in the heap */
+static int reader_recv_fd(const struct reader *reader, uint64_t *offset)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsg_buf;
+	struct msghdr msg = {
+		.msg_iov = &(struct iovec) {
+			.iov_base = offset,
+			.iov_len = sizeof(*offset),
+		},
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buf.buf,
+		.msg_controllen = sizeof(cmsg_buf.buf),
+	};
+
+	if (recvmsg(reader->sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(*offset))
+		reader_fatal("failed to receive the heap");
+
+	const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS)
+		reader_fatal("no heap fd received");
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return fd;
+}
+
+static void reader_init_heap(struct reader *reader)
+{
+	uint64_t offset;
+	reader->heap.fd = reader_recv_fd(reader, &offset);
+
+	struct stat st;
+	if (fstat(reader->heap.fd, &st) < 0)
+		reader_fatal("failed to get heap size");
+	reader->heap.size = st.st_size;
+
+	/* the fd is read-only */
+	reader->heap.base = mmap(NULL, reader->heap.size, PROT_READ,
+			MAP_SHARED, reader->heap.fd, 0);
+	if (reader->heap.base == MAP_FAILED)
+		reader_fatal("failed to map heap");
+
+	if (offset > reader->heap.size - sizeof(struct attach_header))
+		reader_fatal("invalid header offset");
+	const struct attach_header *hdr = reader->heap.base + offset;
+	if (hdr->magic != ATTACH_MAGIC ||
+			offset + attach_header_size(hdr->output_count) >
+			reader->heap.size ||
+			hdr->frame_size > hdr->output_stride ||
+			hdr->output_offset + hdr->output_stride *
+			hdr->output_count > reader->heap.size)
+		reader_fatal("invalid header");
+	reader->header = hdr;
+
+	reader->frame = malloc(hdr->frame_size);
+	if (!reader->frame)
+		reader_fatal("failed to allocate frame");
+
+	const int seals = fcntl(reader->heap.fd, F_GET_SEALS);
+	printf("attached to %u outputs of %ux%u, %lu bytes per frame, "
+			"writes %s\n", hdr->output_count, hdr->width,
+			hdr->height, (unsigned long) hdr->frame_size,
+			seals >= 0 && (seals & F_SEAL_FUTURE_WRITE) ?
+			"sealed" : "not sealed");
+}
+
+/* return false when vkmemfd is gone */
+static bool reader_report(struct reader *reader, uint64_t now)
+{
+	struct attach_report *report = &reader->report;
+	report->duration = now - reader->begin;
+
+	const uint64_t attempt_count = report->frame_count +
+		report->retry_count;
+	printf("reader: %.1f fps, %lu skipped, %.1f%% retries, %.1f MB/s\n",
+			report->frame_count * 1e9 / report->duration,
+			(unsigned long) reader->skipped_count,
+			attempt_count ? report->retry_count * 100.0 /
+			attempt_count : 0.0,
+			report->byte_count * 1e3 / report->duration);
+
+	/* a report that does not fit is dropped */
+	const ssize_t ret = send(reader->sock, report, sizeof(*report),
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+	if (ret < 0 && errno != EAGAIN)
+		return false;
+
+	memset(report, 0, sizeof(*report));
+	reader->skipped_count = 0;
+	reader->begin = now;
+
+	return true;
+}
+
+static void reader_mainloop(struct reader *reader)
+{
+	reader->begin = reader_now();
+
+	while (true) {
+		uint32_t generation;
+		switch (attach_read(reader->header, reader->heap.base,
+					reader->frame, reader->generation,
+					&generation)) {
+		case ATTACH_READ_NONE:
+			usleep(reader->config.poll_interval);
+			break;
+		case ATTACH_READ_OK:
+			/* frames completed between our reads are never seen */
+			if (reader->generation && generation > reader->generation + 1)
+				reader->skipped_count += generation -
+					reader->generation - 1;
+			reader->generation = generation;
+			reader->report.frame_count++;
+			reader->report.byte_count += reader->header->frame_size;
+			break;
+		case ATTACH_READ_RETRY:
+			reader->report.retry_count++;
+			break;
+		}
+
+		const uint64_t now = reader_now();
+		if (now - reader->begin >= 1000000000 &&
+				!reader_report(reader, now)) {
+			printf("reader: vkmemfd is gone\n");
+			return;
+		}
+	}
+}
+
+static void reader_usage(const char *argv0)
+{
+	printf("Usage: %s attach=PATH [poll=US]\n", argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct reader reader = {
+		.config = {
+			.poll_interval = 500,
+		},
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "attach=", 7)) {
+			reader.config.path = argv[i] + 7;
+		} else if (!strncmp(argv[i], "poll=", 5)) {
+			reader.config.poll_interval = atoi(argv[i] + 5);
+			if (reader.config.poll_interval < 0)
+				reader_usage(argv[0]);
+		} else {
+			reader_usage(argv[0]);
+		}
+	}
+	if (!reader.config.path || !*reader.config.path)
+		reader_usage(argv[0]);
+
+	reader_connect(&reader);
+	reader_init_heap(&reader);
+	reader_mainloop(&reader);
+
+	return 0;
+}
@@ -0,0 +1,121 @@
+#include "registry.h"
+
+#include <string.h>
+
+#include <unistd.h>
+
+void registry_init(struct registry_header *hdr, uint64_t heap_size,
+		uint64_t begin, uint64_t align)
+{
+	hdr->magic = REGISTRY_MAGIC;
+	hdr->pid = getpid();
+	hdr->heap_size = heap_size;
+	hdr->begin = begin;
+	hdr->align = align;
+	atomic_init(&hdr->seq, 0);
+	hdr->allocation_count = 0;
+}
+
+uint64_t registry_find(const struct registry_header *hdr, uint64_t size)
+{
+	if (hdr->allocation_count >= REGISTRY_ALLOCATION_MAX)
+		return 0;
+
+	/* first fit; the gaps are aligned because the sizes are */
+	uint64_t offset = hdr->begin;
+	for (uint32_t i = 0; i < hdr->allocation_count; i++) {
+		const struct registry_allocation *alloc = &hdr->allocations[i];
+		if (alloc->offset - offset >= size)
+			return offset;
+		offset = alloc->offset + alloc->size;
+	}
+
+	return hdr->heap_size - offset >= size ? offset : 0;
+}
+
+static void registry_begin_update(struct registry_header *hdr)
+{
+	const unsigned seq = atomic_load_explicit(&hdr->seq,
+			memory_order_relaxed);
+
+	atomic_store_explicit(&hdr->seq, seq + 1, memory_order_relaxed);
+	/* the odd seq is visible before the allocations change */
+	atomic_thread_fence(memory_order_release);
+}
+
+static void registry_end_update(struct registry_header *hdr)
+{
+	const unsigned seq = atomic_load_explicit(&hdr->seq,
+			memory_order_relaxed);
+
+	atomic_store_explicit(&hdr->seq, seq + 1, memory_order_release);
+}
+
+void registry_insert(struct registry_header *hdr,
+		const struct registry_allocation *alloc)
+{
+	uint32_t i = 0;
+	while (i < hdr->allocation_count &&
+			hdr->allocations[i].offset < alloc->offset)
+		i++;
+
+	registry_begin_update(hdr);
+	memmove(&hdr->allocations[i + 1], &hdr->allocations[i],
+			sizeof(hdr->allocations[0]) *
+			(hdr->allocation_count - i));
+	hdr->allocations[i] = *alloc;
+	hdr->allocation_count++;
+	registry_end_update(hdr);
+}
+
+bool registry_remove(struct registry_header *hdr, uint64_t memory)
+{
+	uint32_t i = 0;
+	while (i < hdr->allocation_count &&
+			hdr->allocations[i].memory != memory)
+		i++;
+	if (i == hdr->allocation_count)
+		return false;
+
+	registry_begin_update(hdr);
+	hdr->allocation_count--;
+	memmove(&hdr->allocations[i], &hdr->allocations[i + 1],
+			sizeof(hdr->allocations[0]) *
+			(hdr->allocation_count - i));
+	registry_end_update(hdr);
+
+	return true;
+}
+
+const struct registry_allocation *registry_lookup(
+		const struct registry_header *hdr, uint64_t memory)
+{
+	for (uint32_t i = 0; i < hdr->allocation_count; i++) {
+		if (hdr->allocations[i].memory == memory)
+			return &hdr->allocations[i];
+	}
+
+	return NULL;
+}
+
+int registry_read(const struct registry_header *hdr,
+		struct registry_allocation *dst)
+{
+	const unsigned seq = atomic_load_explicit(&hdr->seq,
+			memory_order_acquire);
+	if (seq & 1)
+		return -1;
+
+	/* torn counts are caught below */
+	uint32_t count = hdr->allocation_count;
+	if (count > REGISTRY_ALLOCATION_MAX)
+		count = REGISTRY_ALLOCATION_MAX;
+	memcpy(dst, hdr->allocations, sizeof(dst[0]) * count);
+
+	/* the copy is done before seq is checked again */
+	atomic_thread_fence(memory_order_acquire);
+	if (atomic_load_explicit(&hdr->seq, memory_order_relaxed) != seq)
+		return -1;
+
+	return count;
+}
@@ -0,0 +1,64 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define REGISTRY_MAGIC 0x726d6b76
+#define REGISTRY_ALLOCATION_MAX 4096
+
+/* a memory carved out of the heap */
+struct registry_allocation {
+	uint64_t offset;
+	uint64_t size;
+	/* the VkDeviceMemory, which only means something to its process */
+	uint64_t memory;
+	uint32_t memory_type;
+	/* VkMemoryPropertyFlags of the memory type */
+	uint32_t property_flags;
+};
+
+/* At the start of a heap of the vkmemfd layer.  Only the layer writes it;
+ * other processes map the heap and read the allocations with registry_read.
+ */
+struct registry_header {
+	uint32_t magic;
+	/* of the process that owns the heap */
+	uint32_t pid;
+	uint64_t heap_size;
+	/* the allocations are at offsets that are multiples of align from
+	 * begin, and so are their sizes
+	 */
+	uint64_t begin;
+	uint64_t align;
+	/* odd while the allocations are being updated */
+	atomic_uint seq;
+	uint32_t allocation_count;
+	/* sorted by offset */
+	struct registry_allocation allocations[REGISTRY_ALLOCATION_MAX];
+};
+
+void registry_init(struct registry_header *hdr, uint64_t heap_size,
+		uint64_t begin, uint64_t align);
+
+/* return the offset of the first gap of size bytes, or 0 when there is none
+ * or the registry is full
+ */
+uint64_t registry_find(const struct registry_header *hdr, uint64_t size);
+void registry_insert(struct registry_header *hdr,
+		const struct registry_allocation *alloc);
+/* return false when memory is not in the registry */
+bool registry_remove(struct registry_header *hdr, uint64_t memory);
+/* return the allocation of memory, or NULL when it is not in the registry */
+const struct registry_allocation *registry_lookup(
+		const struct registry_header *hdr, uint64_t memory);
+
+/* Copy the allocations to dst, which has room for REGISTRY_ALLOCATION_MAX of
+ * them, and return their count, or -1 when the layer is updating them.  The
+ * writer is never waited for.
+ */
+int registry_read(const struct registry_header *hdr,
+		struct registry_allocation *dst);
+
+#endif /* REGISTRY_H */
@@ -1,23 +1,41 @@
 #include "renderer.h"
 
+#include <errno.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 
+#include <poll.h>
+#include <sys/ipc.h>
 #include <sys/mman.h>
+#include <sys/shm.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <vulkan/vulkan.h>
 
-#include "udmabuf.h"
+#include "vkmemfd_vulkan.h"
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
 struct buffer {
 	VkBuffer buf;
 	VkDeviceMemory mem;
+	uint32_t mem_type;
+};
+
+/* what a dynamic command buffer was last recorded for */
+struct renderer_dynamic_key {
+	uint32_t rect_count;
+	VkRect2D rects[RENDERER_DAMAGE_MAX];
+	bool has_roi;
+	VkRect2D roi;
 };
 
 struct renderer {
@@ -25,7 +43,11 @@ struct renderer {
 		int width;
 		int height;
 		int output_count;
-		bool use_udmabuf;
+		enum vkmemfd_heap_type heap_type;
+		enum vkmemfd_output_layout layout;
+		int row_align;
+		uint32_t preview_levels;
+		bool keep_contents;
 	} config;
 
 	struct {
@@ -36,10 +58,8 @@ struct renderer {
 	struct {
 		int memfd;
 		size_t size;
-		union {
-			void *base;
-			int udmabuf;
-		};
+		/* NULL for udmabufs */
+		void *base;
 	} heap;
 
 	/* VK device */
@@ -49,13 +69,43 @@ struct renderer {
 	VkDevice dev;
 	VkQueue queue;
 
+	struct {
+		bool conditional_rendering;
+	} ext;
+
+	struct {
+		PFN_vkCmdBeginConditionalRenderingEXT begin;
+		PFN_vkCmdEndConditionalRenderingEXT end;
+	} cond;
+
 	struct {
 		VkDeviceSize base_skip;
 		VkDeviceSize ubo_size;
 		VkDeviceSize output_size;
+		/* each output has its own struct renderer_params in the UBO */
+		VkDeviceSize ubo_stride;
+		/* of the outputs, or of the tiles */
+		VkDeviceSize row_pitch;
+		uint32_t tile_size;
+		/* of YUV outputs */
+		uint32_t plane_count;
+		struct {
+			VkDeviceSize offset;
+			VkDeviceSize row_pitch;
+		} planes[3];
+		/* after the output, in tightly packed rows */
+		uint32_t preview_count;
+		struct {
+			uint32_t level;
+			VkDeviceSize offset;
+			uint32_t width;
+			uint32_t height;
+		} previews[VKMEMFD_PREVIEW_LEVEL_MAX];
 
 		/* by-products */
 
+		/* how the heap is imported, unless the memories are exported */
+		struct vkmemfd_import import;
 		VkExternalMemoryHandleTypeFlagBits handle_type;
 		VkExternalMemoryBufferCreateInfo ext_buffer_info;
 
@@ -85,15 +135,78 @@ struct renderer {
 		VkDescriptorSet set;
 	} desc;
 
+	/* the host view of the params in the UBO, for the skip predicates and
+	 * the damage
+	 */
+	const void *params;
+
+	/* One layer per output when the outputs keep their contents, which
+	 * skipped and damaged frames need.  Otherwise every output is drawn in
+	 * full and the groups share one image.
+	 */
 	struct {
 		VkRenderPass pass;
 
-		VkImage img;
+		/* of the outputs, which share an image with their group */
+		VkImage *imgs;
 		VkDeviceMemory mem;
-		VkImageView view;
-		VkFramebuffer fb;
+		VkImageView *views;
+		VkFramebuffer *fbs;
 	} fb;
 
+	/* Groups of view_count consecutive outputs are the layers of one image.
+	 * A batch with every output of a group, all as full frames drawn
+	 * alike, renders the group in one multiview render pass where each view
+	 * picks its params with gl_ViewIndex.  The outputs after the last
+	 * whole group share an image that is never rendered that way.
+	 */
+	struct {
+		/* 1 without multiview */
+		uint32_t view_count;
+		int group_count;
+
+		VkRenderPass pass;
+		/* one per group */
+		VkImageView *views;
+		VkFramebuffer *fbs;
+		VkCommandBuffer *bufs;
+
+		/* the UBO over the params of a group */
+		VkDescriptorSet set;
+		VkPipelineLayout layout;
+		VkShaderModule vs;
+		VkShaderModule fs;
+		VkPipeline pipeline;
+	} multiview;
+
+	/* the compute pass converting the framebuffer images into YUV outputs */
+	struct {
+		VkSampler sampler;
+		VkDescriptorPool pool;
+		VkDescriptorSetLayout set_layout;
+		/* one per output */
+		VkDescriptorSet *sets;
+		VkPipelineLayout layout;
+		VkShaderModule cs;
+		VkPipeline pipeline;
+	} yuv;
+
+	/* mip levels 1 and below of the framebuffer images, shared by the
+	 * outputs
+	 */
+	struct {
+		uint32_t level_count;
+		VkImage img;
+		VkDeviceMemory mem;
+	} preview;
+
+	/* two per output and then two per group, around the render pass */
+	struct {
+		bool supported;
+		float period;
+		VkQueryPool pool;
+	} timestamp;
+
 	struct {
 		VkPipelineLayout layout;
 		VkShaderModule vs;
@@ -104,7 +217,35 @@ struct renderer {
 	struct {
 		VkCommandPool pool;
 		VkCommandBuffer *bufs;
+		/* re-recorded when the damage rects or the ROI change */
+		VkCommandBuffer *dynamic_bufs;
+		struct renderer_dynamic_key *dynamic_keys;
+		/* enough for the damage rects or the tiles */
+		VkBufferImageCopy *copies;
 	} cmd;
+
+	/* pending requests, ordered by their deadlines */
+	struct {
+		struct vkmemfd_request reqs[16];
+		int count;
+
+		/* running estimate of the time to render a frame, in ns */
+		uint64_t frame_time;
+
+		uint64_t begin;
+		int on_time_count;
+		int late_count;
+		int dropped_count;
+
+		/* running estimates of the GPU time of a render pass, in ns, of
+		 * full frames and of frames with damage or an ROI
+		 */
+		uint64_t render_pass_time;
+		uint64_t partial_pass_time;
+		int partial_count;
+		int skipped_count;
+		uint64_t gpu_time_saved;
+	} sched;
 };
 
 /* generated with vkcube build rules */
@@ -114,6 +255,27 @@ static const uint32_t renderer_vs_code[] = {
 static const uint32_t renderer_fs_code[] = {
 #include "renderer.frag.h"
 };
+static const uint32_t renderer_multiview_vs_code[] = {
+#include "renderer_multiview.vert.h"
+};
+static const uint32_t renderer_multiview_fs_code[] = {
+#include "renderer_multiview.frag.h"
+};
+static const uint32_t renderer_cs_code[] = {
+#include "renderer.comp.h"
+};
+
+/* the push constants of renderer.comp; the offsets and pitches are in words */
+struct renderer_yuv_constants {
+	uint32_t width;
+	uint32_t height;
+	uint32_t y_offset;
+	uint32_t y_pitch;
+	uint32_t u_offset;
+	uint32_t v_offset;
+	uint32_t uv_pitch;
+	uint32_t planar;
+};
 
 static void renderer_fatal(const char *msg)
 {
@@ -129,6 +291,25 @@ static void renderer_vk(VkResult result, const char *msg)
 
 static void renderer_init_heap(struct renderer *renderer, int memfd)
 {
+	if (renderer->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		renderer->heap.memfd = -1;
+		renderer->heap.size = 0;
+		return;
+	}
+
+	if (renderer->config.heap_type == VKMEMFD_HEAP_SYSV) {
+		struct shmid_ds ds;
+		if (shmctl(memfd, IPC_STAT, &ds) < 0)
+			renderer_fatal("failed to get shm size");
+
+		renderer->heap.memfd = -1;
+		renderer->heap.size = ds.shm_segsz;
+		renderer->heap.base = shmat(memfd, NULL, 0);
+		if (renderer->heap.base == (void *) -1)
+			renderer_fatal("failed to attach shm");
+		return;
+	}
+
 	off_t off = lseek(memfd, 0, SEEK_END);
 	if (off < 0)
 		renderer_fatal("failed to get memfd size");
@@ -136,10 +317,9 @@ static void renderer_init_heap(struct renderer *renderer, int memfd)
 	renderer->heap.memfd = memfd;
 	renderer->heap.size = off;
 
-	if (renderer->config.use_udmabuf) {
-		renderer->heap.udmabuf = udmabuf_init();
-		if (renderer->heap.udmabuf < 0)
-			renderer_fatal("failed to initialize udmabuf");
+	/* udmabufs are created from the memfd itself */
+	if (renderer->config.heap_type == VKMEMFD_HEAP_UDMABUF) {
+		renderer->heap.base = NULL;
 	} else {
 		renderer->heap.base = mmap(NULL, off, PROT_READ | PROT_WRITE,
 				MAP_SHARED, renderer->heap.memfd, 0);
@@ -148,6 +328,12 @@ static void renderer_init_heap(struct renderer *renderer, int memfd)
 	}
 }
 
+static bool renderer_is_yuv(const struct renderer *renderer)
+{
+	return renderer->config.layout == VKMEMFD_OUTPUT_NV12 ||
+		renderer->config.layout == VKMEMFD_OUTPUT_I420;
+}
+
 static void renderer_init_vk_instance(struct renderer *renderer)
 {
 	uint32_t version;
@@ -178,6 +364,7 @@ static void renderer_init_vk_physical_device(struct renderer *renderer)
 	vkGetPhysicalDeviceProperties(renderer->physical_dev, &props);
 	if (props.apiVersion < VK_MAKE_VERSION(1, 1, 0))
 		renderer_fatal("no Vulkan 1.1 device support");
+	renderer->timestamp.period = props.limits.timestampPeriod;
 
 	renderer->mem_props = (VkPhysicalDeviceMemoryProperties2) {
 		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2
@@ -187,13 +374,24 @@ static void renderer_init_vk_physical_device(struct renderer *renderer)
 
 static void renderer_init_vk_device(struct renderer *renderer)
 {
+	const bool use_udmabuf = renderer->config.heap_type == VKMEMFD_HEAP_UDMABUF;
+	const bool use_export = renderer->config.heap_type == VKMEMFD_HEAP_EXPORT;
+	const bool use_host_ptr = !use_udmabuf && !use_export;
 	const struct {
 		const char *name;
+		bool wanted;
 		bool required;
+		bool *found;
 	} ext_table[] = {
-		{ "VK_KHR_external_memory_fd", renderer->config.use_udmabuf },
-		{ "VK_EXT_external_memory_dma_buf", renderer->config.use_udmabuf },
-		{ "VK_EXT_external_memory_host", !renderer->config.use_udmabuf },
+		{ "VK_KHR_external_memory_fd", use_udmabuf || use_export, true, NULL },
+		/* opaque fds of exported memories cannot be mapped */
+		{ "VK_EXT_external_memory_dma_buf", use_udmabuf || use_export,
+			true, NULL },
+		{ "VK_EXT_external_memory_host", use_host_ptr, true, NULL },
+		/* skipped outputs are checked on the CPU otherwise */
+		{ "VK_EXT_conditional_rendering",
+			renderer->config.keep_contents, false,
+			&renderer->ext.conditional_rendering },
 		{ NULL },
 	};
 
@@ -212,7 +410,7 @@ static void renderer_init_vk_device(struct renderer *renderer)
 	const char *enabled_names[16];
 	uint32_t enabled_count = 0;
 	for (int i = 0; ext_table[i].name; i++) {
-		if (!ext_table[i].required)
+		if (!ext_table[i].wanted)
 			continue;
 
 		bool found = false;
@@ -222,8 +420,13 @@ static void renderer_init_vk_device(struct renderer *renderer)
 				break;
 			}
 		}
-		if (!found)
-			renderer_fatal("missing extensions");
+		if (ext_table[i].found)
+			*ext_table[i].found = found;
+		if (!found) {
+			if (ext_table[i].required)
+				renderer_fatal("missing extensions");
+			continue;
+		}
 
 		enabled_names[enabled_count++] = ext_table[i].name;
 	}
@@ -238,10 +441,45 @@ static void renderer_init_vk_device(struct renderer *renderer)
 			&queue_count, &queue_props);
 	if (!(queue_props.queueFamilyProperties.queueFlags & VK_QUEUE_GRAPHICS_BIT))
 		renderer_fatal("queue family 0 does not support graphics");
+	renderer->timestamp.supported =
+		queue_props.queueFamilyProperties.timestampValidBits > 0;
+
+	/* multiview is core in Vulkan 1.1 */
+	VkPhysicalDeviceMultiviewFeatures multiview_feats = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_FEATURES,
+	};
+	VkPhysicalDeviceConditionalRenderingFeaturesEXT cond_feats = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_CONDITIONAL_RENDERING_FEATURES_EXT,
+		.pNext = &multiview_feats,
+	};
+	void *feats = renderer->ext.conditional_rendering ?
+		(void *) &cond_feats : (void *) &multiview_feats;
+	vkGetPhysicalDeviceFeatures2(renderer->physical_dev,
+			&(VkPhysicalDeviceFeatures2) {
+				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+				.pNext = feats,
+			});
+	if (renderer->ext.conditional_rendering)
+		renderer->ext.conditional_rendering = cond_feats.conditionalRendering;
+	multiview_feats.multiviewGeometryShader = VK_FALSE;
+	multiview_feats.multiviewTessellationShader = VK_FALSE;
+
+	VkPhysicalDeviceMultiviewProperties multiview_props = {
+		.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MULTIVIEW_PROPERTIES,
+	};
+	vkGetPhysicalDeviceProperties2(renderer->physical_dev,
+			&(VkPhysicalDeviceProperties2) {
+				.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+				.pNext = &multiview_props,
+			});
+	/* narrowed down once the UBO stride is known */
+	renderer->multiview.view_count = multiview_feats.multiview ?
+		multiview_props.maxMultiviewViewCount : 1;
 
 	result = vkCreateDevice(renderer->physical_dev,
 			&(VkDeviceCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+				.pNext = feats,
 				.queueCreateInfoCount = 1,
 				.pQueueCreateInfos = &(VkDeviceQueueCreateInfo) {
 					.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO,
@@ -255,6 +493,17 @@ static void renderer_init_vk_device(struct renderer *renderer)
 	renderer_vk(result, "failed to create device");
 
 	vkGetDeviceQueue(renderer->dev, 0, 0, &renderer->queue);
+
+	if (renderer->ext.conditional_rendering) {
+		renderer->cond.begin = (PFN_vkCmdBeginConditionalRenderingEXT)
+			vkGetDeviceProcAddr(renderer->dev,
+					"vkCmdBeginConditionalRenderingEXT");
+		renderer->cond.end = (PFN_vkCmdEndConditionalRenderingEXT)
+			vkGetDeviceProcAddr(renderer->dev,
+					"vkCmdEndConditionalRenderingEXT");
+		if (!renderer->cond.begin || !renderer->cond.end)
+			renderer_fatal("failed to get conditional rendering commands");
+	}
 }
 
 static void renderer_get_heap_buffer_props(const struct renderer *renderer,
@@ -275,9 +524,15 @@ static void renderer_get_heap_buffer_props(const struct renderer *renderer,
 				.handleType = renderer->heap_layout.handle_type,
 			}, props);
 
-	if (!(props->externalMemoryProperties.externalMemoryFeatures &
-				VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT))
-		renderer_fatal("external memory not importable");
+	if (renderer->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		if (!(props->externalMemoryProperties.externalMemoryFeatures &
+					VK_EXTERNAL_MEMORY_FEATURE_EXPORTABLE_BIT))
+			renderer_fatal("external memory not exportable");
+	} else {
+		if (!(props->externalMemoryProperties.externalMemoryFeatures &
+					VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT))
+			renderer_fatal("external memory not importable");
+	}
 
 	*info = (VkBufferCreateInfo) {
 		.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
@@ -307,8 +562,74 @@ static void renderer_get_heap_buffer_props(const struct renderer *renderer,
 			renderer_fatal("conflicting size requirement from dedicated allocation");
 		*alloc = reqs->memoryRequirements.size - rem + mem_align;
 	} else {
-		*alloc = size;
+		*alloc = reqs->memoryRequirements.size;
+	}
+}
+
+/* The main process maps the exported memory.  It reads outputs and benefits
+ * from cached memory.  It only writes the UBO, for which write-combined memory
+ * is as good.
+ */
+static uint32_t renderer_pick_export_mem_type(const struct renderer *renderer,
+		uint32_t mem_types, bool host_read)
+{
+	const VkPhysicalDeviceMemoryProperties *props =
+		&renderer->mem_props.memoryProperties;
+	int best_type = -1;
+	int best_score = -1;
+
+	for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+		const VkMemoryPropertyFlags flags = props->memoryTypes[i].propertyFlags;
+		if (!(mem_types & (1u << i)) ||
+				!(flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT))
+			continue;
+
+		int score = 0;
+		if (host_read && (flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT))
+			score += 4;
+		if (flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)
+			score += 2;
+		if (!host_read && (flags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
+			score += 1;
+
+		if (best_score < score) {
+			best_score = score;
+			best_type = i;
+		}
+	}
+
+	if (best_type < 0)
+		renderer_fatal("no host-visible memory type");
+
+	return best_type;
+}
+
+/* the first memory type in mem_types with the required flags, preferring one
+ * with the preferred flags as well
+ */
+static uint32_t renderer_find_mem_type(const struct renderer *renderer,
+		uint32_t mem_types, VkMemoryPropertyFlags required,
+		VkMemoryPropertyFlags preferred)
+{
+	const VkPhysicalDeviceMemoryProperties *props =
+		&renderer->mem_props.memoryProperties;
+	int found = -1;
+
+	for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+		const VkMemoryPropertyFlags flags = props->memoryTypes[i].propertyFlags;
+		if (!(mem_types & (1u << i)) || (flags & required) != required)
+			continue;
+
+		if ((flags & preferred) == preferred)
+			return i;
+		if (found < 0)
+			found = i;
 	}
+
+	if (found < 0)
+		renderer_fatal("no suitable memory type");
+
+	return found;
 }
 
 static void renderer_alloc_heap_buffer(const struct renderer *renderer,
@@ -320,76 +641,42 @@ static void renderer_alloc_heap_buffer(const struct renderer *renderer,
 	VkResult result = vkCreateBuffer(renderer->dev, info, NULL, &buf->buf);
 	renderer_vk(result, "failed to create buffer");
 
-	VkImportMemoryFdInfoKHR fd_info = {
-		.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
-		.handleType = renderer->heap_layout.handle_type,
-	};
-	VkImportMemoryHostPointerInfoEXT ptr_info = {
-		.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
-		.handleType = renderer->heap_layout.handle_type,
-	};
-	uint32_t mem_types = reqs->memoryRequirements.memoryTypeBits;
-	void *p_next;
-	if (renderer->config.use_udmabuf) {
-		/* the fd ownership will be transferred to Vulakn */
-		fd_info.fd = udmabuf_create(renderer->heap.udmabuf, renderer->heap.memfd,
-				offset, size);
-		if (fd_info.fd < 0)
-			renderer_fatal("failed to create udmabuf");
-
-		VkMemoryFdPropertiesKHR fd_props = {
-			.sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR
-		};
-		PFN_vkGetMemoryFdPropertiesKHR getter =
-			(PFN_vkGetMemoryFdPropertiesKHR)
-			vkGetDeviceProcAddr(renderer->dev,
-					"vkGetMemoryFdPropertiesKHR");
-		result = getter(renderer->dev, fd_info.handleType, fd_info.fd, &fd_props);
-		renderer_vk(result, "invalid dmabuf");
-
-		mem_types &= fd_props.memoryTypeBits;
-		p_next = &fd_info;
-	} else {
-		ptr_info.pHostPointer = renderer->heap.base + offset;
+	const bool dedicated = props->externalMemoryProperties.externalMemoryFeatures &
+		VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT;
+	const uint32_t mem_types = reqs->memoryRequirements.memoryTypeBits;
+	if (renderer->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		buf->mem_type = renderer_pick_export_mem_type(renderer, mem_types,
+				info->usage & VK_BUFFER_USAGE_TRANSFER_DST_BIT);
 
-		VkMemoryHostPointerPropertiesEXT ptr_props = {
-			.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT
+		VkExportMemoryAllocateInfo export_info = {
+			.sType = VK_STRUCTURE_TYPE_EXPORT_MEMORY_ALLOCATE_INFO,
+			.handleTypes = renderer->heap_layout.handle_type,
 		};
-		PFN_vkGetMemoryHostPointerPropertiesEXT getter =
-			(PFN_vkGetMemoryHostPointerPropertiesEXT)
-			vkGetDeviceProcAddr(renderer->dev,
-					"vkGetMemoryHostPointerPropertiesEXT");
-		result = getter(renderer->dev, ptr_info.handleType,
-				ptr_info.pHostPointer, &ptr_props);
-		renderer_vk(result, "invalid memfd ptr");
-
-		mem_types &= ptr_props.memoryTypeBits;
-		p_next = &ptr_info;
-	}
-
-	if (!mem_types)
-		renderer_fatal("no usable memory type");
-	const uint32_t mem_type = ffs(mem_types) - 1;
-
-	VkMemoryDedicatedAllocateInfo dedicated_info = {
-		.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
-		.buffer = buf->buf,
-	};
-	if (props->externalMemoryProperties.externalMemoryFeatures &
-			VK_EXTERNAL_MEMORY_FEATURE_DEDICATED_ONLY_BIT) {
-		dedicated_info.pNext = p_next;
-		p_next = &dedicated_info;
+		VkMemoryDedicatedAllocateInfo dedicated_info = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+			.pNext = &export_info,
+			.buffer = buf->buf,
+		};
+		const void *p_next = &export_info;
+		if (dedicated)
+			p_next = &dedicated_info;
+
+		result = vkAllocateMemory(renderer->dev,
+				&(VkMemoryAllocateInfo) {
+					.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+					.pNext = p_next,
+					.allocationSize = size,
+					.memoryTypeIndex = buf->mem_type,
+				}, NULL, &buf->mem);
+		renderer_vk(result, "failed to allocate memory");
+	} else {
+		result = vkmemfd_import_memory(&renderer->heap_layout.import,
+				renderer->dev, mem_types,
+				dedicated ? buf->buf : VK_NULL_HANDLE, offset, size,
+				&buf->mem, &buf->mem_type);
+		renderer_vk(result, "failed to import memory");
 	}
 
-	result = vkAllocateMemory(renderer->dev,
-			&(VkMemoryAllocateInfo) {
-				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-				.pNext = p_next,
-				.allocationSize = size,
-				.memoryTypeIndex = mem_type,
-			}, NULL, &buf->mem);
-	renderer_vk(result, "failed to import memory");
-
 	result = vkBindBufferMemory2(renderer->dev, 1,
 			&(VkBindBufferMemoryInfo) {
 				.sType = VK_STRUCTURE_TYPE_BIND_BUFFER_MEMORY_INFO,
@@ -399,30 +686,42 @@ static void renderer_alloc_heap_buffer(const struct renderer *renderer,
 	renderer_vk(result, "failed to bind memory");
 }
 
+/* of two alignments, either of which may be 0 for none */
+static VkDeviceSize renderer_lcm(VkDeviceSize a, VkDeviceSize b)
+{
+	if (!a || !b)
+		return a | b;
+
+	VkDeviceSize x = a, y = b;
+	while (y) {
+		const VkDeviceSize r = x % y;
+		x = y;
+		y = r;
+	}
+	return a / x * b;
+}
+
 static void renderer_init_heap_layout(struct renderer *renderer)
 {
 	VkDeviceSize mem_align;
 
-	if (renderer->config.use_udmabuf) {
-		mem_align = getpagesize();
+	if (renderer->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		/* every buffer has its own memory */
+		mem_align = 1;
 		renderer->heap_layout.base_skip = 0;
 		renderer->heap_layout.handle_type =
 			VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
 	} else {
-		VkPhysicalDeviceExternalMemoryHostPropertiesEXT ext_mem_host_props = {
-			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT
-		};
-		vkGetPhysicalDeviceProperties2(renderer->physical_dev,
-				&(VkPhysicalDeviceProperties2) {
-					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
-					.pNext = &ext_mem_host_props,
-				});
-		mem_align = ext_mem_host_props.minImportedHostPointerAlignment;
-
-		const VkDeviceSize rem = (uintptr_t) renderer->heap.base % mem_align;
-		renderer->heap_layout.base_skip = rem ? mem_align - rem : 0;
+		VkResult result = vkmemfd_import_init(&renderer->heap_layout.import,
+				renderer->physical_dev, renderer->config.heap_type,
+				renderer->heap.memfd, renderer->heap.base);
+		renderer_vk(result, "failed to initialize heap import");
+
+		mem_align = renderer->heap_layout.import.align;
+		renderer->heap_layout.base_skip =
+			renderer->heap_layout.import.base_skip;
 		renderer->heap_layout.handle_type =
-			VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+			renderer->heap_layout.import.handle_type;
 	}
 
 	renderer->heap_layout.ext_buffer_info = (VkExternalMemoryBufferCreateInfo) {
@@ -430,30 +729,155 @@ static void renderer_init_heap_layout(struct renderer *renderer)
 		.handleTypes = renderer->heap_layout.handle_type,
 	};
 
-	/* vec4 */
-	renderer->heap_layout.ubo_used_size = sizeof(float[4]);
+	VkPhysicalDeviceProperties props;
+	vkGetPhysicalDeviceProperties(renderer->physical_dev, &props);
+	/* the multiview shaders index the params in vec4s */
+	const VkDeviceSize ubo_align = renderer_lcm(
+			props.limits.minUniformBufferOffsetAlignment, 16);
+
+	/* a struct renderer_params per output */
+	renderer->heap_layout.ubo_stride =
+		(sizeof(struct renderer_params) + ubo_align - 1) /
+		ubo_align * ubo_align;
+	renderer->heap_layout.ubo_used_size = renderer->heap_layout.ubo_stride *
+		renderer->config.output_count;
 	renderer_get_heap_buffer_props(renderer, renderer->heap_layout.ubo_used_size,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, mem_align,
+			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+			VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+			(renderer->ext.conditional_rendering ?
+			 VK_BUFFER_USAGE_CONDITIONAL_RENDERING_BIT_EXT : 0),
+			mem_align,
 			&renderer->heap_layout.ubo_props,
 			&renderer->heap_layout.ubo_info,
 			&renderer->heap_layout.ubo_reqs,
 			&renderer->heap_layout.ubo_size);
 
 	/* B8G8R8A8 */
-	renderer->heap_layout.output_used_size =
-		renderer->config.width * renderer->config.height * 4;
+	const VkDeviceSize width = renderer->config.width;
+	const VkDeviceSize height = renderer->config.height;
+	switch (renderer->config.layout) {
+	case VKMEMFD_OUTPUT_PITCHED: {
+		/* bufferRowLength is in pixels */
+		const VkDeviceSize align = renderer_lcm(renderer_lcm(
+				props.limits.optimalBufferCopyRowPitchAlignment,
+				renderer->config.row_align), 4);
+
+		renderer->heap_layout.row_pitch =
+			(width * 4 + align - 1) / align * align;
+		renderer->heap_layout.tile_size = 0;
+		renderer->heap_layout.output_used_size =
+			renderer->heap_layout.row_pitch * height;
+		break;
+	}
+	case VKMEMFD_OUTPUT_TILED: {
+		const VkDeviceSize size = VKMEMFD_TILE_SIZE;
+		const VkDeviceSize tile_count = (width + size - 1) / size *
+			((height + size - 1) / size);
+
+		renderer->heap_layout.row_pitch = size * 4;
+		renderer->heap_layout.tile_size = size;
+		renderer->heap_layout.output_used_size =
+			renderer->heap_layout.row_pitch * size * tile_count;
+		break;
+	}
+	case VKMEMFD_OUTPUT_NV12:
+	case VKMEMFD_OUTPUT_I420: {
+		/* the compute pass writes words of 4 pixels of 8x2 blocks */
+		if (width % 8 || height % 2)
+			renderer_fatal("YUV outputs need a width multiple of 8 and an even height");
+
+		const VkDeviceSize y_size = width * height;
+		renderer->heap_layout.row_pitch = width;
+		renderer->heap_layout.tile_size = 0;
+		renderer->heap_layout.planes[0].offset = 0;
+		renderer->heap_layout.planes[0].row_pitch = width;
+		if (renderer->config.layout == VKMEMFD_OUTPUT_NV12) {
+			renderer->heap_layout.plane_count = 2;
+			renderer->heap_layout.planes[1].offset = y_size;
+			renderer->heap_layout.planes[1].row_pitch = width;
+		} else {
+			renderer->heap_layout.plane_count = 3;
+			renderer->heap_layout.planes[1].offset = y_size;
+			renderer->heap_layout.planes[1].row_pitch = width / 2;
+			renderer->heap_layout.planes[2].offset = y_size + y_size / 4;
+			renderer->heap_layout.planes[2].row_pitch = width / 2;
+		}
+		renderer->heap_layout.output_used_size = y_size * 3 / 2;
+		break;
+	}
+	default:
+		renderer->heap_layout.row_pitch = width * 4;
+		renderer->heap_layout.tile_size = 0;
+		renderer->heap_layout.output_used_size = width * height * 4;
+		break;
+	}
+
+	if (renderer->config.preview_levels &
+			~(((1u << VKMEMFD_PREVIEW_LEVEL_MAX) - 1) << 1))
+		renderer_fatal("invalid preview levels");
+	renderer->heap_layout.preview_count = 0;
+	for (uint32_t level = 1; level <= VKMEMFD_PREVIEW_LEVEL_MAX; level++) {
+		if (!(renderer->config.preview_levels & (1u << level)))
+			continue;
+		if (!(width >> level) || !(height >> level))
+			renderer_fatal("preview too small");
+
+		/* start every preview on a cache line */
+		const VkDeviceSize offset =
+			(renderer->heap_layout.output_used_size + 63) / 64 * 64;
+		const uint32_t count = renderer->heap_layout.preview_count++;
+		renderer->heap_layout.previews[count].level = level;
+		renderer->heap_layout.previews[count].offset = offset;
+		renderer->heap_layout.previews[count].width = width >> level;
+		renderer->heap_layout.previews[count].height = height >> level;
+		renderer->heap_layout.output_used_size = offset +
+			(width >> level) * (height >> level) * 4;
+	}
 	renderer_get_heap_buffer_props(renderer, renderer->heap_layout.output_used_size,
-			VK_BUFFER_USAGE_TRANSFER_DST_BIT, mem_align,
+			VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+			(renderer_is_yuv(renderer) ?
+			 VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0),
+			mem_align,
 			&renderer->heap_layout.output_props,
 			&renderer->heap_layout.output_info,
 			&renderer->heap_layout.output_reqs,
 			&renderer->heap_layout.output_size);
 
-	if (renderer->heap_layout.ubo_size + renderer->heap_layout.output_size *
+	if (renderer->config.heap_type != VKMEMFD_HEAP_EXPORT &&
+			renderer->heap_layout.base_skip + renderer->heap_layout.ubo_size +
+			renderer->heap_layout.output_size *
 			renderer->config.output_count > renderer->heap.size)
 		renderer_fatal("heap size too small");
 }
 
+static void renderer_send_fd(const struct renderer *renderer, uint32_t val,
+		int fd)
+{
+	if (!vkmemfd_send_fd(renderer->ctrl.out, val, fd))
+		renderer_fatal("failed to send an fd");
+}
+
+static void renderer_export_heap_buffer(const struct renderer *renderer,
+		const struct buffer *buf)
+{
+	PFN_vkGetMemoryFdKHR getter = (PFN_vkGetMemoryFdKHR)
+		vkGetDeviceProcAddr(renderer->dev, "vkGetMemoryFdKHR");
+
+	int fd;
+	VkResult result = getter(renderer->dev,
+			&(VkMemoryGetFdInfoKHR) {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR,
+				.memory = buf->mem,
+				.handleType = renderer->heap_layout.handle_type,
+			}, &fd);
+	renderer_vk(result, "failed to export memory");
+
+	/* tell the main process whether DMA_BUF_IOCTL_SYNC applies */
+	renderer_send_fd(renderer, renderer->heap_layout.handle_type ==
+			VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, fd);
+	close(fd);
+}
+
 static void renderer_init_heap_buffers(struct renderer *renderer)
 {
 	renderer->outputs = malloc(sizeof(renderer->outputs[0]) *
@@ -477,6 +901,150 @@ static void renderer_init_heap_buffers(struct renderer *renderer)
 				&renderer->heap_layout.output_reqs);
 		offset += renderer->heap_layout.output_size;
 	}
+
+	if (renderer->config.heap_type == VKMEMFD_HEAP_EXPORT) {
+		const VkMemoryType *types = renderer->mem_props.memoryProperties.memoryTypes;
+		const VkMemoryPropertyFlags ubo_flags =
+			types[renderer->ubo.mem_type].propertyFlags;
+		const VkMemoryPropertyFlags output_flags =
+			types[renderer->outputs[0].mem_type].propertyFlags;
+		printf("renderer exports ubo memory type %u (%s, %s) and output "
+				"memory type %u (%s, %s)\n",
+				renderer->ubo.mem_type,
+				(ubo_flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ?
+				"cached" : "uncached",
+				(ubo_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ?
+				"coherent" : "incoherent",
+				renderer->outputs[0].mem_type,
+				(output_flags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ?
+				"cached" : "uncached",
+				(output_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) ?
+				"coherent" : "incoherent");
+
+		renderer_export_heap_buffer(renderer, &renderer->ubo);
+		for (int i = 0; i < renderer->config.output_count; i++)
+			renderer_export_heap_buffer(renderer, &renderer->outputs[i]);
+	}
+}
+
+/* map the params for the host, which reads the damage and skips unchanged
+ * outputs itself without conditional rendering
+ */
+static void renderer_init_params(struct renderer *renderer)
+{
+	void *base;
+
+	switch (renderer->config.heap_type) {
+	case VKMEMFD_HEAP_UDMABUF:
+		base = mmap(NULL, renderer->heap.size, PROT_READ, MAP_SHARED,
+				renderer->heap.memfd, 0);
+		if (base == MAP_FAILED)
+			renderer_fatal("failed to map memfd");
+		base = (char *) base + renderer->heap_layout.base_skip;
+		break;
+	case VKMEMFD_HEAP_EXPORT: {
+		VkResult result = vkMapMemory(renderer->dev, renderer->ubo.mem,
+				0, VK_WHOLE_SIZE, 0, &base);
+		renderer_vk(result, "failed to map ubo memory");
+		break;
+	}
+	default:
+		base = (char *) renderer->heap.base + renderer->heap_layout.base_skip;
+		break;
+	}
+
+	renderer->params = base;
+}
+
+/* the main process has written the params before sending the request */
+static void renderer_read_params(const struct renderer *renderer, int output,
+		struct renderer_params *params)
+{
+	const VkMemoryType *types = renderer->mem_props.memoryProperties.memoryTypes;
+	if (renderer->config.heap_type == VKMEMFD_HEAP_EXPORT &&
+			!(types[renderer->ubo.mem_type].propertyFlags &
+			  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+		VkResult result = vkInvalidateMappedMemoryRanges(renderer->dev, 1,
+				&(VkMappedMemoryRange) {
+					.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+					.memory = renderer->ubo.mem,
+					.size = VK_WHOLE_SIZE,
+				});
+		renderer_vk(result, "failed to invalidate ubo memory");
+	}
+
+	memcpy(params, (const char *) renderer->params +
+			renderer->heap_layout.ubo_stride * output, sizeof(*params));
+}
+
+static VkRect2D renderer_check_rect(const struct renderer *renderer,
+		uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+	const uint32_t width = renderer->config.width;
+	const uint32_t height = renderer->config.height;
+	if (!w || !h || w > width || h > height ||
+			x > width - w || y > height - h)
+		renderer_fatal("invalid rect");
+
+	return (VkRect2D) {
+		.offset = { .x = x, .y = y },
+		.extent = { .width = w, .height = h },
+	};
+}
+
+/* return the number of damage rects, or 0 for the whole output */
+static uint32_t renderer_get_damage(const struct renderer *renderer,
+		const struct renderer_params *params, VkRect2D *rects)
+{
+	if (params->damage_count > RENDERER_DAMAGE_MAX)
+		renderer_fatal("too many damage rects");
+
+	for (uint32_t i = 0; i < params->damage_count; i++) {
+		const VkRect2D rect = renderer_check_rect(renderer,
+				params->damage[i].x, params->damage[i].y,
+				params->damage[i].width,
+				params->damage[i].height);
+
+		/* the copies must not overlap */
+		for (uint32_t j = 0; j < i; j++) {
+			if (rect.offset.x < rects[j].offset.x + rects[j].extent.width &&
+					rects[j].offset.x < rect.offset.x + rect.extent.width &&
+					rect.offset.y < rects[j].offset.y + rects[j].extent.height &&
+					rects[j].offset.y < rect.offset.y + rect.extent.height)
+				renderer_fatal("overlapping damage rects");
+		}
+
+		rects[i] = rect;
+	}
+
+	return params->damage_count;
+}
+
+/* return false when the whole output is copied */
+static bool renderer_get_roi(const struct renderer *renderer,
+		const struct renderer_params *params, VkRect2D *roi)
+{
+	if (!params->roi.width)
+		return false;
+	if (renderer->config.layout != VKMEMFD_OUTPUT_LINEAR)
+		renderer_fatal("ROI requires linear outputs");
+
+	*roi = renderer_check_rect(renderer, params->roi.x, params->roi.y,
+			params->roi.width, params->roi.height);
+
+	return true;
+}
+
+/* the keys have padding, so compare only the fields in use */
+static bool renderer_dynamic_key_equal(const struct renderer_dynamic_key *a,
+		const struct renderer_dynamic_key *b)
+{
+	if (a->rect_count != b->rect_count || a->has_roi != b->has_roi)
+		return false;
+	if (memcmp(a->rects, b->rects, sizeof(a->rects[0]) * a->rect_count))
+		return false;
+
+	return !a->has_roi || !memcmp(&a->roi, &b->roi, sizeof(a->roi));
 }
 
 static void renderer_init_vk_vertex_buffer(struct renderer *renderer)
@@ -526,16 +1094,49 @@ static void renderer_init_vk_vertex_buffer(struct renderer *renderer)
 	vkUnmapMemory(renderer->dev, renderer->vb.mem);
 }
 
+/* Pick the group size.  It is a power of two such that groups tile batches of
+ * power-of-two sizes, and the params of a group fit in renderer_multiview.vert.
+ */
+static void renderer_init_multiview_groups(struct renderer *renderer)
+{
+	const uint32_t max_view_count = renderer->multiview.view_count;
+	const VkDeviceSize max_range = 1024 * sizeof(float[4]);
+
+	uint32_t view_count = 1;
+	while (view_count * 2 <= max_view_count &&
+			view_count * 2 <= ARRAY_SIZE(renderer->sched.reqs) &&
+			view_count * 2 <= (uint32_t) renderer->config.output_count &&
+			view_count * 2 * renderer->heap_layout.ubo_stride <= max_range)
+		view_count *= 2;
+
+	renderer->multiview.view_count = view_count;
+	renderer->multiview.group_count = view_count > 1 ?
+		renderer->config.output_count / view_count : 0;
+
+	if (renderer->multiview.group_count) {
+		printf("renderer: multiview groups of %u outputs\n",
+				renderer->multiview.view_count);
+	}
+}
+
+static uint32_t renderer_fb_layer(const struct renderer *renderer,
+		int output_index)
+{
+	return output_index % renderer->multiview.view_count;
+}
+
 static void renderer_init_vk_descriptor_set(struct renderer *renderer)
 {
+	const bool multiview = renderer->multiview.group_count;
+
 	VkResult result = vkCreateDescriptorPool(renderer->dev,
 			&(VkDescriptorPoolCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
-				.maxSets = 1,
+				.maxSets = 2,
 				.poolSizeCount = 1,
 				.pPoolSizes = &(VkDescriptorPoolSize) {
-					.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
-					.descriptorCount = 1,
+					.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+					.descriptorCount = 2,
 				},
 			}, NULL, &renderer->desc.pool);
 	renderer_vk(result, "failed to create descriptor pool");
@@ -545,9 +1146,11 @@ static void renderer_init_vk_descriptor_set(struct renderer *renderer)
 				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
 				.bindingCount = 1,
 				.pBindings = &(VkDescriptorSetLayoutBinding) {
-					.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+					.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 					.descriptorCount = 1,
-					.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
+					/* the multiview vertex shader reads the colors */
+					.stageFlags = VK_SHADER_STAGE_VERTEX_BIT |
+						VK_SHADER_STAGE_FRAGMENT_BIT,
 				},
 			}, NULL, &renderer->desc.layout);
 	renderer_vk(result, "failed to create descriptor set layout");
@@ -566,28 +1169,65 @@ static void renderer_init_vk_descriptor_set(struct renderer *renderer)
 				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
 				.dstSet = renderer->desc.set,
 				.descriptorCount = 1,
-				.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+				.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+				.pBufferInfo = &(VkDescriptorBufferInfo) {
+					.buffer = renderer->ubo.buf,
+					.range = sizeof(float[4]),
+				},
+			}, 0, NULL);
+
+	if (!multiview)
+		return;
+
+	result = vkAllocateDescriptorSets(renderer->dev,
+			&(VkDescriptorSetAllocateInfo) {
+				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+				.descriptorPool = renderer->desc.pool,
+				.descriptorSetCount = 1,
+				.pSetLayouts = &renderer->desc.layout,
+			}, &renderer->multiview.set);
+	renderer_vk(result, "failed to allocate descriptor set");
+
+	vkUpdateDescriptorSets(renderer->dev, 1,
+			&(VkWriteDescriptorSet) {
+				.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+				.dstSet = renderer->multiview.set,
+				.descriptorCount = 1,
+				.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
 				.pBufferInfo = &(VkDescriptorBufferInfo) {
 					.buffer = renderer->ubo.buf,
-					.range = renderer->heap_layout.ubo_used_size,
+					.range = renderer->heap_layout.ubo_stride *
+						renderer->multiview.view_count,
 				},
 			}, 0, NULL);
 }
 
-static void renderer_init_vk_framebuffer(struct renderer *renderer)
+/* A view_mask of 0 is a plain render pass, and multiview otherwise.  The images
+ * are cleared with vkCmdClearAttachments, which can be skipped by conditional
+ * rendering, and are otherwise loaded.  They stay in TRANSFER_SRC_OPTIMAL
+ * between frames.
+ */
+static VkRenderPass renderer_create_render_pass(const struct renderer *renderer,
+		uint32_t view_mask)
 {
-	const VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
+	const VkRenderPassMultiviewCreateInfo multiview_info = {
+		.sType = VK_STRUCTURE_TYPE_RENDER_PASS_MULTIVIEW_CREATE_INFO,
+		.subpassCount = 1,
+		.pViewMasks = &view_mask,
+	};
 
+	VkRenderPass pass;
 	VkResult result = vkCreateRenderPass(renderer->dev,
 			&(VkRenderPassCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+				.pNext = view_mask ? &multiview_info : NULL,
 				.attachmentCount = 1,
 				.pAttachments = &(VkAttachmentDescription) {
-					.format = format,
+					.format = VK_FORMAT_B8G8R8A8_UNORM,
 					.samples = VK_SAMPLE_COUNT_1_BIT,
-					.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+					.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD,
 					.storeOp = VK_ATTACHMENT_STORE_OP_STORE,
-					.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+					.initialLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 					.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
 				},
 				.subpassCount = 1,
@@ -598,107 +1238,432 @@ static void renderer_init_vk_framebuffer(struct renderer *renderer)
 						.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
 					}
 				},
-			}, NULL, &renderer->fb.pass);
-	renderer_vk(result, "failed to create render pass");
-
-	result = vkCreateImage(renderer->dev,
-			&(VkImageCreateInfo) {
-				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-				.imageType = VK_IMAGE_TYPE_2D,
-				.format = format,
-				.extent = {
-					.width = renderer->config.width,
-					.height = renderer->config.height,
-					.depth = 1,
+				.dependencyCount = 2,
+				.pDependencies = (const VkSubpassDependency[]) {
+					/* wait for the copy of the last frame */
+					{
+						.srcSubpass = VK_SUBPASS_EXTERNAL,
+						.dstSubpass = 0,
+						.srcStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+						.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+						.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+							VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					},
+					/* for the copy and the preview blits */
+					{
+						.srcSubpass = 0,
+						.dstSubpass = VK_SUBPASS_EXTERNAL,
+						.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+						.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT,
+						.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+						.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+					},
 				},
-				.mipLevels = 1,
-				.arrayLayers = 1,
-				.samples = VK_SAMPLE_COUNT_1_BIT,
-				.tiling = VK_IMAGE_TILING_OPTIMAL,
-				.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-				         VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-				 .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-				 .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-			}, NULL, &renderer->fb.img);
-	renderer_vk(result, "failed to create framebuffer image");
-
-	VkMemoryRequirements2 reqs = { .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
-	vkGetImageMemoryRequirements2(renderer->dev,
-			&(VkImageMemoryRequirementsInfo2) {
-				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
-				.image = renderer->fb.img,
-			}, &reqs);
-
-	result = vkAllocateMemory(renderer->dev,
-			&(VkMemoryAllocateInfo) {
-				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
-				.allocationSize = reqs.memoryRequirements.size,
-				.memoryTypeIndex = ffs(reqs.memoryRequirements.memoryTypeBits) - 1,
-			}, NULL, &renderer->fb.mem);
-	renderer_vk(result, "failed to allocate image memory");
+			}, NULL, &pass);
+	renderer_vk(result, "failed to create render pass");
 
-	result = vkBindImageMemory2(renderer->dev, 1,
-			&(VkBindImageMemoryInfo) {
-				.sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
-				.image = renderer->fb.img,
-				.memory = renderer->fb.mem,
-			});
-	renderer_vk(result, "failed to bind image memory");
+	return pass;
+}
 
-	result = vkCreateImageView(renderer->dev,
+static VkImageView renderer_create_fb_view(const struct renderer *renderer,
+		VkImage img, VkImageViewType type, uint32_t layer,
+		uint32_t layer_count)
+{
+	VkImageView view;
+	VkResult result = vkCreateImageView(renderer->dev,
 			&(VkImageViewCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-				.image = renderer->fb.img,
-				.viewType = VK_IMAGE_VIEW_TYPE_2D,
-				.format = format,
+				.image = img,
+				.viewType = type,
+				.format = VK_FORMAT_B8G8R8A8_UNORM,
 				.subresourceRange = {
 					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
 					.levelCount = 1,
-					.layerCount = 1,
+					.baseArrayLayer = layer,
+					.layerCount = layer_count,
 				},
-			}, NULL, &renderer->fb.view);
+			}, NULL, &view);
 	renderer_vk(result, "failed to create framebuffer image view");
 
-	result = vkCreateFramebuffer(renderer->dev,
+	return view;
+}
+
+/* multiview framebuffers have a single layer */
+static VkFramebuffer renderer_create_fb(const struct renderer *renderer,
+		VkRenderPass pass, VkImageView view)
+{
+	VkFramebuffer fb;
+	VkResult result = vkCreateFramebuffer(renderer->dev,
 			&(VkFramebufferCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-				.renderPass = renderer->fb.pass,
+				.renderPass = pass,
 				.attachmentCount = 1,
-				.pAttachments = &renderer->fb.view,
+				.pAttachments = &view,
 				.width = renderer->config.width,
 				.height = renderer->config.height,
 				.layers = 1,
-			}, NULL, &renderer->fb.fb);
+			}, NULL, &fb);
 	renderer_vk(result, "failed to create framebuffer");
+
+	return fb;
 }
 
-static void renderer_init_vk_pipeline(struct renderer *renderer)
+static void renderer_init_vk_framebuffer(struct renderer *renderer)
 {
-	VkResult result = vkCreatePipelineLayout(renderer->dev,
-			&(VkPipelineLayoutCreateInfo) {
-				.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-				.setLayoutCount = 1,
-				.pSetLayouts = &renderer->desc.layout,
-			}, NULL, &renderer->pipeline.layout);
-	renderer_vk(result, "failed to create pipeline layout");
+	const int count = renderer->config.output_count;
+	const uint32_t view_count = renderer->multiview.view_count;
+	const int group_count = renderer->multiview.group_count;
+
+	renderer->fb.pass = renderer_create_render_pass(renderer, 0);
+	if (group_count) {
+		renderer->multiview.pass = renderer_create_render_pass(renderer,
+				(1u << view_count) - 1);
+	}
 
-	result = vkCreateShaderModule(renderer->dev,
-			&(VkShaderModuleCreateInfo) {
-				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-				.codeSize = sizeof(renderer_vs_code),
-				.pCode = renderer_vs_code,
-			}, NULL, &renderer->pipeline.vs);
-	renderer_vk(result, "failed to create vertex shader");
+	renderer->fb.imgs = malloc(sizeof(renderer->fb.imgs[0]) * count);
+	renderer->fb.views = malloc(sizeof(renderer->fb.views[0]) * count);
+	renderer->fb.fbs = malloc(sizeof(renderer->fb.fbs[0]) * count);
+	renderer->multiview.views = malloc(sizeof(renderer->multiview.views[0]) *
+			(group_count + 1));
+	renderer->multiview.fbs = malloc(sizeof(renderer->multiview.fbs[0]) *
+			(group_count + 1));
+	if (!renderer->fb.imgs || !renderer->fb.views || !renderer->fb.fbs ||
+			!renderer->multiview.views || !renderer->multiview.fbs)
+		renderer_fatal("failed to allocate framebuffer arrays");
+
+	/* the images share one allocation; the last one may have fewer
+	 * layers
+	 */
+	const int img_count = renderer->config.keep_contents ?
+		(count + view_count - 1) / view_count : 1;
+	VkImage *imgs = malloc(sizeof(imgs[0]) * img_count);
+	VkDeviceSize *offsets = malloc(sizeof(offsets[0]) * img_count);
+	if (!imgs || !offsets)
+		renderer_fatal("failed to allocate framebuffer images");
+	VkDeviceSize mem_size = 0;
+	uint32_t mem_types = ~0u;
+	VkResult result;
+	for (int i = 0; i < img_count; i++) {
+		const int first = i * view_count;
+		const uint32_t layer_count = count - first < view_count ?
+			count - first : view_count;
+
+		result = vkCreateImage(renderer->dev,
+				&(VkImageCreateInfo) {
+					.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+					.imageType = VK_IMAGE_TYPE_2D,
+					.format = VK_FORMAT_B8G8R8A8_UNORM,
+					.extent = {
+						.width = renderer->config.width,
+						.height = renderer->config.height,
+						.depth = 1,
+					},
+					.mipLevels = 1,
+					.arrayLayers = layer_count,
+					.samples = VK_SAMPLE_COUNT_1_BIT,
+					.tiling = VK_IMAGE_TILING_OPTIMAL,
+					.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+						 VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+						 VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+						 (renderer_is_yuv(renderer) ?
+						  VK_IMAGE_USAGE_SAMPLED_BIT : 0),
+					.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+					.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+				}, NULL, &imgs[i]);
+		renderer_vk(result, "failed to create framebuffer image");
+
+		VkMemoryRequirements2 reqs = { .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+		vkGetImageMemoryRequirements2(renderer->dev,
+				&(VkImageMemoryRequirementsInfo2) {
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+					.image = imgs[i],
+				}, &reqs);
+		const VkDeviceSize align = reqs.memoryRequirements.alignment;
+		offsets[i] = (mem_size + align - 1) / align * align;
+		mem_size = offsets[i] + reqs.memoryRequirements.size;
+		mem_types &= reqs.memoryRequirements.memoryTypeBits;
+	}
+
+	for (int i = 0; i < count; i++)
+		renderer->fb.imgs[i] = imgs[i / view_count % img_count];
+
+	result = vkAllocateMemory(renderer->dev,
+			&(VkMemoryAllocateInfo) {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				.allocationSize = mem_size,
+				.memoryTypeIndex = renderer_find_mem_type(renderer,
+						mem_types, 0,
+						VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+			}, NULL, &renderer->fb.mem);
+	renderer_vk(result, "failed to allocate image memory");
+
+	if (renderer->config.keep_contents) {
+		printf("renderer: %d framebuffer layers in %d images, %.1f MiB\n",
+				count, img_count, (double) mem_size / (1024 * 1024));
+	} else {
+		printf("renderer: outputs share %u framebuffer layers, %.1f MiB\n",
+				count < (int) view_count ? count : view_count,
+				(double) mem_size / (1024 * 1024));
+	}
+
+	for (int i = 0; i < img_count; i++) {
+		result = vkBindImageMemory2(renderer->dev, 1,
+				&(VkBindImageMemoryInfo) {
+					.sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
+					.image = imgs[i],
+					.memory = renderer->fb.mem,
+					.memoryOffset = offsets[i],
+				});
+		renderer_vk(result, "failed to bind image memory");
+	}
+	free(imgs);
+	free(offsets);
+
+	for (int i = 0; i < group_count; i++) {
+		renderer->multiview.views[i] = renderer_create_fb_view(renderer,
+				renderer->fb.imgs[i * view_count],
+				VK_IMAGE_VIEW_TYPE_2D_ARRAY, 0, view_count);
+		renderer->multiview.fbs[i] = renderer_create_fb(renderer,
+				renderer->multiview.pass,
+				renderer->multiview.views[i]);
+	}
+
+	for (int i = 0; i < count; i++) {
+		renderer->fb.views[i] = renderer_create_fb_view(renderer,
+				renderer->fb.imgs[i], VK_IMAGE_VIEW_TYPE_2D,
+				renderer_fb_layer(renderer, i), 1);
+		renderer->fb.fbs[i] = renderer_create_fb(renderer,
+				renderer->fb.pass, renderer->fb.views[i]);
+	}
+}
+
+static void renderer_init_vk_yuv(struct renderer *renderer)
+{
+	const int count = renderer->config.output_count;
+
+	if (!renderer_is_yuv(renderer))
+		return;
+
+	/* texelFetch ignores the sampler state */
+	VkResult result = vkCreateSampler(renderer->dev,
+			&(VkSamplerCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+				.magFilter = VK_FILTER_NEAREST,
+				.minFilter = VK_FILTER_NEAREST,
+				.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+				.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+				.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+				.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+			}, NULL, &renderer->yuv.sampler);
+	renderer_vk(result, "failed to create sampler");
+
+	result = vkCreateDescriptorPool(renderer->dev,
+			&(VkDescriptorPoolCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+				.maxSets = count,
+				.poolSizeCount = 2,
+				.pPoolSizes = (const VkDescriptorPoolSize[]) {
+					{
+						.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+						.descriptorCount = count,
+					},
+					{
+						.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = count,
+					},
+				},
+			}, NULL, &renderer->yuv.pool);
+	renderer_vk(result, "failed to create descriptor pool");
+
+	result = vkCreateDescriptorSetLayout(renderer->dev,
+			&(VkDescriptorSetLayoutCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+				.bindingCount = 2,
+				.pBindings = (const VkDescriptorSetLayoutBinding[]) {
+					{
+						.binding = 0,
+						.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+						.descriptorCount = 1,
+						.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+					{
+						.binding = 1,
+						.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.descriptorCount = 1,
+						.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+					},
+				},
+			}, NULL, &renderer->yuv.set_layout);
+	renderer_vk(result, "failed to create descriptor set layout");
+
+	renderer->yuv.sets = malloc(sizeof(renderer->yuv.sets[0]) * count);
+	if (!renderer->yuv.sets)
+		renderer_fatal("failed to allocate descriptor set array");
+
+	for (int i = 0; i < count; i++) {
+		result = vkAllocateDescriptorSets(renderer->dev,
+				&(VkDescriptorSetAllocateInfo) {
+					.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+					.descriptorPool = renderer->yuv.pool,
+					.descriptorSetCount = 1,
+					.pSetLayouts = &renderer->yuv.set_layout,
+				}, &renderer->yuv.sets[i]);
+		renderer_vk(result, "failed to allocate descriptor set");
+
+		vkUpdateDescriptorSets(renderer->dev, 2,
+				(const VkWriteDescriptorSet[]) {
+					{
+						.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+						.dstSet = renderer->yuv.sets[i],
+						.dstBinding = 0,
+						.descriptorCount = 1,
+						.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+						.pImageInfo = &(VkDescriptorImageInfo) {
+							.sampler = renderer->yuv.sampler,
+							.imageView = renderer->fb.views[i],
+							.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+						},
+					},
+					{
+						.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+						.dstSet = renderer->yuv.sets[i],
+						.dstBinding = 1,
+						.descriptorCount = 1,
+						.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+						.pBufferInfo = &(VkDescriptorBufferInfo) {
+							.buffer = renderer->outputs[i].buf,
+							.range = VK_WHOLE_SIZE,
+						},
+					},
+				}, 0, NULL);
+	}
+
+	result = vkCreatePipelineLayout(renderer->dev,
+			&(VkPipelineLayoutCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+				.setLayoutCount = 1,
+				.pSetLayouts = &renderer->yuv.set_layout,
+				.pushConstantRangeCount = 1,
+				.pPushConstantRanges = &(VkPushConstantRange) {
+					.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+					.size = sizeof(struct renderer_yuv_constants),
+				},
+			}, NULL, &renderer->yuv.layout);
+	renderer_vk(result, "failed to create pipeline layout");
 
 	result = vkCreateShaderModule(renderer->dev,
 			&(VkShaderModuleCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
-				.codeSize = sizeof(renderer_fs_code),
-				.pCode = renderer_fs_code,
-				}, NULL, &renderer->pipeline.fs);
-	renderer_vk(result, "failed to create fragment shader");
+				.codeSize = sizeof(renderer_cs_code),
+				.pCode = renderer_cs_code,
+			}, NULL, &renderer->yuv.cs);
+	renderer_vk(result, "failed to create compute shader");
+
+	result = vkCreateComputePipelines(renderer->dev, VK_NULL_HANDLE, 1,
+			&(VkComputePipelineCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+				.stage = {
+					.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+					.stage = VK_SHADER_STAGE_COMPUTE_BIT,
+					.module = renderer->yuv.cs,
+					.pName = "main",
+				},
+				.layout = renderer->yuv.layout,
+			}, NULL, &renderer->yuv.pipeline);
+	renderer_vk(result, "failed to create compute pipeline");
+}
 
-	result = vkCreateGraphicsPipelines(renderer->dev, VK_NULL_HANDLE, 1,
+static void renderer_init_vk_preview(struct renderer *renderer)
+{
+	const VkFormat format = VK_FORMAT_B8G8R8A8_UNORM;
+
+	/* the previews are blitted down from the level above, up to the lowest
+	 * one asked for
+	 */
+	renderer->preview.level_count = 0;
+	for (uint32_t i = 0; i < renderer->heap_layout.preview_count; i++)
+		renderer->preview.level_count = renderer->heap_layout.previews[i].level;
+	if (!renderer->preview.level_count)
+		return;
+
+	VkFormatProperties format_props;
+	vkGetPhysicalDeviceFormatProperties(renderer->physical_dev, format,
+			&format_props);
+	const VkFormatFeatureFlags features = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+		VK_FORMAT_FEATURE_BLIT_DST_BIT |
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	if ((format_props.optimalTilingFeatures & features) != features)
+		renderer_fatal("no linear blit support");
+
+	/* the chain is regenerated by every frame, so one is enough */
+	VkResult result = vkCreateImage(renderer->dev,
+			&(VkImageCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+				.imageType = VK_IMAGE_TYPE_2D,
+				.format = format,
+				.extent = {
+					.width = renderer->config.width >> 1,
+					.height = renderer->config.height >> 1,
+					.depth = 1,
+				},
+				.mipLevels = renderer->preview.level_count,
+				.arrayLayers = 1,
+				.samples = VK_SAMPLE_COUNT_1_BIT,
+				.tiling = VK_IMAGE_TILING_OPTIMAL,
+				.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+					 VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+				.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+				.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+			}, NULL, &renderer->preview.img);
+	renderer_vk(result, "failed to create preview image");
+
+	VkMemoryRequirements2 reqs = { .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+	vkGetImageMemoryRequirements2(renderer->dev,
+			&(VkImageMemoryRequirementsInfo2) {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+				.image = renderer->preview.img,
+			}, &reqs);
+
+	result = vkAllocateMemory(renderer->dev,
+			&(VkMemoryAllocateInfo) {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				.allocationSize = reqs.memoryRequirements.size,
+				.memoryTypeIndex = renderer_find_mem_type(renderer,
+						reqs.memoryRequirements.memoryTypeBits,
+						0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+			}, NULL, &renderer->preview.mem);
+	renderer_vk(result, "failed to allocate preview memory");
+
+	result = vkBindImageMemory2(renderer->dev, 1,
+			&(VkBindImageMemoryInfo) {
+				.sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
+				.image = renderer->preview.img,
+				.memory = renderer->preview.mem,
+			});
+	renderer_vk(result, "failed to bind preview memory");
+}
+
+static void renderer_init_vk_query_pool(struct renderer *renderer)
+{
+	if (!renderer->timestamp.supported)
+		return;
+
+	VkResult result = vkCreateQueryPool(renderer->dev,
+			&(VkQueryPoolCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+				.queryType = VK_QUERY_TYPE_TIMESTAMP,
+				.queryCount = (renderer->config.output_count +
+						renderer->multiview.group_count) * 2,
+			}, NULL, &renderer->timestamp.pool);
+	renderer_vk(result, "failed to create query pool");
+}
+
+static VkPipeline renderer_create_pipeline(const struct renderer *renderer,
+		VkPipelineLayout layout, VkShaderModule vs, VkShaderModule fs,
+		VkRenderPass pass)
+{
+	VkPipeline pipeline;
+	VkResult result = vkCreateGraphicsPipelines(renderer->dev, VK_NULL_HANDLE, 1,
 			&(VkGraphicsPipelineCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
 				.stageCount = 2,
@@ -706,13 +1671,13 @@ static void renderer_init_vk_pipeline(struct renderer *renderer)
 					{
 						.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 						.stage = VK_SHADER_STAGE_VERTEX_BIT,
-						.module = renderer->pipeline.vs,
+						.module = vs,
 						.pName = "main",
 					},
 					{
 						.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
 						.stage = VK_SHADER_STAGE_FRAGMENT_BIT,
-						.module = renderer->pipeline.fs,
+						.module = fs,
 						.pName = "main",
 					},
 				},
@@ -739,13 +1704,8 @@ static void renderer_init_vk_pipeline(struct renderer *renderer)
 						.width = (float) renderer->config.width,
 						.height = (float) renderer->config.height,
 					},
+					/* set to the damage rects */
 					.scissorCount = 1,
-					.pScissors = &(VkRect2D) {
-						.extent = {
-							.width = renderer->config.width,
-							.height = renderer->config.height,
-						},
-					},
 				},
 				.pRasterizationState = &(VkPipelineRasterizationStateCreateInfo) {
 					.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
@@ -767,16 +1727,422 @@ static void renderer_init_vk_pipeline(struct renderer *renderer)
 							          VK_COLOR_COMPONENT_A_BIT,
 					},
 				},
-				.layout = renderer->pipeline.layout,
-				.renderPass = renderer->fb.pass,
+				.pDynamicState = &(VkPipelineDynamicStateCreateInfo) {
+					.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+					.dynamicStateCount = 1,
+					.pDynamicStates = &(VkDynamicState) {
+						VK_DYNAMIC_STATE_SCISSOR
+					},
+				},
+				.layout = layout,
+				.renderPass = pass,
 				.subpass = 0,
-			}, NULL, &renderer->pipeline.pipeline);
+			}, NULL, &pipeline);
 	renderer_vk(result, "failed to create pipeline");
+
+	return pipeline;
+}
+
+static void renderer_init_vk_pipeline(struct renderer *renderer)
+{
+	VkResult result = vkCreatePipelineLayout(renderer->dev,
+			&(VkPipelineLayoutCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+				.setLayoutCount = 1,
+				.pSetLayouts = &renderer->desc.layout,
+			}, NULL, &renderer->pipeline.layout);
+	renderer_vk(result, "failed to create pipeline layout");
+
+	result = vkCreateShaderModule(renderer->dev,
+			&(VkShaderModuleCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = sizeof(renderer_vs_code),
+				.pCode = renderer_vs_code,
+			}, NULL, &renderer->pipeline.vs);
+	renderer_vk(result, "failed to create vertex shader");
+
+	result = vkCreateShaderModule(renderer->dev,
+			&(VkShaderModuleCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = sizeof(renderer_fs_code),
+				.pCode = renderer_fs_code,
+			}, NULL, &renderer->pipeline.fs);
+	renderer_vk(result, "failed to create fragment shader");
+
+	renderer->pipeline.pipeline = renderer_create_pipeline(renderer,
+			renderer->pipeline.layout, renderer->pipeline.vs,
+			renderer->pipeline.fs, renderer->fb.pass);
+
+	if (!renderer->multiview.group_count)
+		return;
+
+	/* the push constant is ubo_stride in vec4s */
+	result = vkCreatePipelineLayout(renderer->dev,
+			&(VkPipelineLayoutCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+				.setLayoutCount = 1,
+				.pSetLayouts = &renderer->desc.layout,
+				.pushConstantRangeCount = 1,
+				.pPushConstantRanges = &(VkPushConstantRange) {
+					.stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+					.size = sizeof(uint32_t),
+				},
+			}, NULL, &renderer->multiview.layout);
+	renderer_vk(result, "failed to create pipeline layout");
+
+	result = vkCreateShaderModule(renderer->dev,
+			&(VkShaderModuleCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = sizeof(renderer_multiview_vs_code),
+				.pCode = renderer_multiview_vs_code,
+			}, NULL, &renderer->multiview.vs);
+	renderer_vk(result, "failed to create vertex shader");
+
+	result = vkCreateShaderModule(renderer->dev,
+			&(VkShaderModuleCreateInfo) {
+				.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+				.codeSize = sizeof(renderer_multiview_fs_code),
+				.pCode = renderer_multiview_fs_code,
+			}, NULL, &renderer->multiview.fs);
+	renderer_vk(result, "failed to create fragment shader");
+
+	renderer->multiview.pipeline = renderer_create_pipeline(renderer,
+			renderer->multiview.layout, renderer->multiview.vs,
+			renderer->multiview.fs, renderer->multiview.pass);
+}
+
+static VkBufferImageCopy renderer_get_copy(VkDeviceSize offset,
+		uint32_t row_length, const VkRect2D *rect)
+{
+	return (VkBufferImageCopy) {
+		.bufferOffset = offset,
+		.bufferRowLength = row_length,
+		.imageSubresource = {
+			.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+			.layerCount = 1,
+		},
+		.imageOffset = { rect->offset.x, rect->offset.y, 0 },
+		.imageExtent = {
+			.width = rect->extent.width,
+			.height = rect->extent.height,
+			.depth = 1,
+		},
+	};
+}
+
+/* return the number of copy regions for the rects and the output layout */
+static uint32_t renderer_get_copies(const struct renderer *renderer,
+		const VkRect2D *rects, uint32_t rect_count, const VkRect2D *roi,
+		VkBufferImageCopy *copies)
+{
+	const VkDeviceSize pitch = renderer->heap_layout.row_pitch;
+
+	if (roi) {
+		copies[0] = renderer_get_copy(0, roi->extent.width, roi);
+		return 1;
+	}
+
+	if (renderer->config.layout != VKMEMFD_OUTPUT_TILED) {
+		for (uint32_t i = 0; i < rect_count; i++) {
+			const VkDeviceSize offset = pitch * rects[i].offset.y +
+				rects[i].offset.x * 4;
+			copies[i] = renderer_get_copy(offset, pitch / 4, &rects[i]);
+		}
+		return rect_count;
+	}
+
+	/* every tile is copied; the damage only limits the redraw */
+	const uint32_t size = renderer->heap_layout.tile_size;
+	uint32_t count = 0;
+	for (uint32_t y = 0; y < renderer->config.height; y += size) {
+		for (uint32_t x = 0; x < renderer->config.width; x += size) {
+			const VkRect2D tile = {
+				.offset = { .x = x, .y = y },
+				.extent = {
+					.width = renderer->config.width - x < size ?
+						renderer->config.width - x : size,
+					.height = renderer->config.height - y < size ?
+						renderer->config.height - y : size,
+				},
+			};
+			copies[count] = renderer_get_copy(pitch * size * count,
+					size, &tile);
+			copies[count].bufferImageHeight = size;
+			count++;
+		}
+	}
+
+	return count;
+}
+
+static void renderer_preview_barrier(VkCommandBuffer cmd, VkImage img,
+		uint32_t level, uint32_t level_count, VkImageLayout old_layout,
+		VkImageLayout new_layout)
+{
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+			&(VkImageMemoryBarrier) {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				/* including the blits of the last output */
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+				.dstAccessMask = new_layout ==
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL ?
+					VK_ACCESS_TRANSFER_WRITE_BIT :
+					VK_ACCESS_TRANSFER_READ_BIT,
+				.oldLayout = old_layout,
+				.newLayout = new_layout,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = img,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.baseMipLevel = level,
+					.levelCount = level_count,
+					.layerCount = 1,
+				},
+			});
 }
 
+static void renderer_fb_barrier(VkCommandBuffer cmd, VkImage img,
+		uint32_t layer, VkPipelineStageFlags src_stage, VkAccessFlags src_access,
+		VkImageLayout old_layout, VkPipelineStageFlags dst_stage,
+		VkAccessFlags dst_access, VkImageLayout new_layout)
+{
+	vkCmdPipelineBarrier(cmd, src_stage, dst_stage, 0, 0, NULL, 0, NULL, 1,
+			&(VkImageMemoryBarrier) {
+				.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+				.srcAccessMask = src_access,
+				.dstAccessMask = dst_access,
+				.oldLayout = old_layout,
+				.newLayout = new_layout,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.image = img,
+				.subresourceRange = {
+					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+					.levelCount = 1,
+					.baseArrayLayer = layer,
+					.layerCount = 1,
+				},
+			});
+}
+
+/* Convert the whole framebuffer image into the planes of the output.  The
+ * image is sampled in SHADER_READ_ONLY_OPTIMAL and then returned to its
+ * steady layout.
+ */
+static void renderer_build_yuv(const struct renderer *renderer,
+		VkCommandBuffer cmd, int output_index)
+{
+	const VkImage img = renderer->fb.imgs[output_index];
+	const uint32_t layer = renderer_fb_layer(renderer, output_index);
+	const bool planar = renderer->config.layout == VKMEMFD_OUTPUT_I420;
+	const struct renderer_yuv_constants constants = {
+		.width = renderer->config.width,
+		.height = renderer->config.height,
+		.y_offset = renderer->heap_layout.planes[0].offset / 4,
+		.y_pitch = renderer->heap_layout.planes[0].row_pitch / 4,
+		.u_offset = renderer->heap_layout.planes[1].offset / 4,
+		.v_offset = planar ? renderer->heap_layout.planes[2].offset / 4 : 0,
+		.uv_pitch = renderer->heap_layout.planes[1].row_pitch / 4,
+		.planar = planar,
+	};
+
+	/* chained to the external dependency of the render pass, which makes
+	 * the attachment writes visible to the transfer stage
+	 */
+	renderer_fb_barrier(cmd, img, layer,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_ACCESS_SHADER_READ_BIT,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+			renderer->yuv.pipeline);
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE,
+			renderer->yuv.layout, 0, 1,
+			&renderer->yuv.sets[output_index], 0, NULL);
+	vkCmdPushConstants(cmd, renderer->yuv.layout,
+			VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+			&constants);
+	/* 8x8 invocations of 8x2 pixels each */
+	vkCmdDispatch(cmd, (renderer->config.width / 8 + 7) / 8,
+			(renderer->config.height / 2 + 7) / 8, 1);
+
+	/* for the previews and the next frame */
+	renderer_fb_barrier(cmd, img, layer,
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_PIPELINE_STAGE_TRANSFER_BIT,
+			VK_ACCESS_TRANSFER_READ_BIT,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+}
+
+/* Blit the mip chain down from the framebuffer image and copy the previews
+ * after the output.  The whole chain is regenerated every frame, which costs
+ * a third of a full-size blit at most.
+ */
+static void renderer_build_previews(const struct renderer *renderer,
+		VkCommandBuffer cmd, int output_index)
+{
+	const uint32_t level_count = renderer->preview.level_count;
+	const VkImage img = renderer->preview.img;
+
+	renderer_preview_barrier(cmd, img, 0, level_count,
+			VK_IMAGE_LAYOUT_UNDEFINED,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+	for (uint32_t level = 1; level <= level_count; level++) {
+		/* level 0 is the framebuffer image, already a transfer source */
+		const VkImage src = level == 1 ?
+			renderer->fb.imgs[output_index] : img;
+		const uint32_t src_level = level == 1 ? 0 : level - 2;
+		if (level > 1) {
+			renderer_preview_barrier(cmd, img, src_level, 1,
+					VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+		}
+
+		const int32_t src_width = renderer->config.width >> (level - 1);
+		const int32_t src_height = renderer->config.height >> (level - 1);
+		vkCmdBlitImage(cmd, src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+				img, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+				&(VkImageBlit) {
+					.srcSubresource = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = src_level,
+						.baseArrayLayer = level == 1 ?
+							renderer_fb_layer(renderer,
+									output_index) : 0,
+						.layerCount = 1,
+					},
+					.srcOffsets = {
+						{ 0, 0, 0 },
+						{ src_width, src_height, 1 },
+					},
+					.dstSubresource = {
+						.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+						.mipLevel = level - 1,
+						.layerCount = 1,
+					},
+					.dstOffsets = {
+						{ 0, 0, 0 },
+						{ src_width >> 1, src_height >> 1, 1 },
+					},
+				}, VK_FILTER_LINEAR);
+	}
+
+	renderer_preview_barrier(cmd, img, level_count - 1, 1,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	VkBufferImageCopy copies[VKMEMFD_PREVIEW_LEVEL_MAX];
+	for (uint32_t i = 0; i < renderer->heap_layout.preview_count; i++) {
+		const VkRect2D rect = {
+			.extent = {
+				.width = renderer->heap_layout.previews[i].width,
+				.height = renderer->heap_layout.previews[i].height,
+			},
+		};
+		copies[i] = renderer_get_copy(renderer->heap_layout.previews[i].offset,
+				0, &rect);
+		copies[i].imageSubresource.mipLevel =
+			renderer->heap_layout.previews[i].level - 1;
+	}
+	vkCmdCopyImageToBuffer(cmd, img, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			renderer->outputs[output_index].buf,
+			renderer->heap_layout.preview_count, copies);
+}
+
+/* Copy, or convert, the layer of the output after its render pass, and its
+ * previews, and make the output available to the host.
+ */
+static void renderer_build_output(const struct renderer *renderer,
+		VkCommandBuffer cmd, int output_index, VkBufferImageCopy *copies,
+		uint32_t copy_count)
+{
+	const struct buffer *output = &renderer->outputs[output_index];
+
+	if (renderer_is_yuv(renderer)) {
+		renderer_build_yuv(renderer, cmd, output_index);
+	} else {
+		for (uint32_t i = 0; i < copy_count; i++) {
+			copies[i].imageSubresource.baseArrayLayer =
+				renderer_fb_layer(renderer, output_index);
+		}
+		vkCmdCopyImageToBuffer(cmd, renderer->fb.imgs[output_index],
+				VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, output->buf,
+				copy_count, copies);
+	}
+
+	if (renderer->preview.level_count)
+		renderer_build_previews(renderer, cmd, output_index);
+
+	/* Explicit barrier to make sure the transfer, or the conversion, is
+	 * available to the host domain.
+	 */
+	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT |
+			VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
+			&(VkBufferMemoryBarrier) {
+				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT |
+					VK_ACCESS_SHADER_WRITE_BIT,
+				.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+				.buffer = output->buf,
+				.size = VK_WHOLE_SIZE,
+			}, 0, NULL);
+}
+
+/* Only the rects are redrawn and copied when there are any.  Only the ROI is
+ * copied, tightly packed, when there is one.
+ */
 static void renderer_build_command_buffer(struct renderer *renderer,
-		VkCommandBuffer cmd, const struct buffer *output)
+		VkCommandBuffer cmd, int output_index, const VkRect2D *rects,
+		uint32_t rect_count, const VkRect2D *roi)
 {
+	const VkRect2D full_rect = {
+		.extent = {
+			.width = renderer->config.width,
+			.height = renderer->config.height,
+		},
+	};
+	if (!rect_count) {
+		rects = &full_rect;
+		rect_count = 1;
+	}
+
+	VkRect2D area = rects[0];
+	VkClearRect clear_rects[RENDERER_DAMAGE_MAX];
+	for (uint32_t i = 0; i < rect_count; i++) {
+		const VkRect2D *rect = &rects[i];
+
+		const int32_t x1 = rect->offset.x + rect->extent.width;
+		const int32_t y1 = rect->offset.y + rect->extent.height;
+		const int32_t area_x1 = area.offset.x + area.extent.width;
+		const int32_t area_y1 = area.offset.y + area.extent.height;
+		if (area.offset.x > rect->offset.x)
+			area.offset.x = rect->offset.x;
+		if (area.offset.y > rect->offset.y)
+			area.offset.y = rect->offset.y;
+		area.extent.width = (x1 > area_x1 ? x1 : area_x1) - area.offset.x;
+		area.extent.height = (y1 > area_y1 ? y1 : area_y1) - area.offset.y;
+
+		clear_rects[i] = (VkClearRect) {
+			.rect = *rect,
+			.layerCount = 1,
+		};
+	}
+
+	/* YUV outputs are converted as a whole instead */
+	VkBufferImageCopy *copies = renderer->cmd.copies;
+	const uint32_t copy_count = renderer_is_yuv(renderer) ? 0 :
+		renderer_get_copies(renderer, rects, rect_count, roi, copies);
+
 	VkResult result = vkBeginCommandBuffer(cmd,
 			&(VkCommandBufferBeginInfo) {
 				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
@@ -785,8 +2151,10 @@ static void renderer_build_command_buffer(struct renderer *renderer,
 
 	vkCmdBindVertexBuffers(cmd, 0, 1, &renderer->vb.buf, &(VkDeviceSize) { 0 });
 
+	const uint32_t ubo_offset = renderer->heap_layout.ubo_stride * output_index;
 	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
-			renderer->pipeline.layout, 0, 1, &renderer->desc.set, 0, NULL);
+			renderer->pipeline.layout, 0, 1, &renderer->desc.set, 1,
+			&ubo_offset);
 
 	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
 			renderer->pipeline.pipeline);
@@ -803,137 +2171,722 @@ static void renderer_build_command_buffer(struct renderer *renderer,
 	 */
 
 	/* vkQueueSubmit implies a domain operation from the host domain to
-	 * the device domain.  No explicit barrier on UBO is needed.
+	 * the device domain.  No explicit barrier on UBO is needed, including
+	 * for the draw parameters read by the indirect draw and the skip
+	 * predicate read by conditional rendering.
 	 */
 
+	if (renderer->timestamp.supported) {
+		vkCmdResetQueryPool(cmd, renderer->timestamp.pool,
+				output_index * 2, 2);
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				renderer->timestamp.pool, output_index * 2);
+	}
+
 	vkCmdBeginRenderPass(cmd,
 			&(VkRenderPassBeginInfo) {
 				.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
 				.renderPass = renderer->fb.pass,
-				.framebuffer = renderer->fb.fb,
-				.renderArea = {
-					.extent = {
-						.width = renderer->config.width,
-						.height = renderer->config.height,
-					},
-				},
-				.clearValueCount = 1,
-				.pClearValues = &(VkClearValue) {
-					.color = { .float32 = { 0.1f, 0.1f, 0.1f, 1.0f } },
-				},
+				.framebuffer = renderer->fb.fbs[output_index],
+				.renderArea = area,
 			}, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdDraw(cmd, 3, 1, 0, 0);
-	vkCmdEndRenderPass(cmd);
 
-	vkCmdCopyImageToBuffer(cmd, renderer->fb.img,
-			VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, output->buf, 1,
-			&(VkBufferImageCopy) {
-				.imageSubresource = {
-					.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-					.layerCount = 1,
-				},
-				.imageExtent = {
-					.width = renderer->config.width,
-					.height = renderer->config.height,
-					.depth = 1,
+	/* Conditional rendering predicates neither loadOp clears nor copies.
+	 * The clear is an explicit command such that a skipped output keeps
+	 * its image, which is then copied as is.
+	 */
+	if (renderer->ext.conditional_rendering) {
+		renderer->cond.begin(cmd,
+				&(VkConditionalRenderingBeginInfoEXT) {
+					.sType = VK_STRUCTURE_TYPE_CONDITIONAL_RENDERING_BEGIN_INFO_EXT,
+					.buffer = renderer->ubo.buf,
+					.offset = ubo_offset +
+						offsetof(struct renderer_params, skip),
+					.flags = VK_CONDITIONAL_RENDERING_INVERTED_BIT_EXT,
+				});
+	}
+
+	vkCmdClearAttachments(cmd, 1,
+			&(VkClearAttachment) {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.colorAttachment = 0,
+				.clearValue = {
+					.color = { .float32 = RENDERER_CLEAR_COLOR },
 				},
+			}, rect_count, clear_rects);
+	for (uint32_t i = 0; i < rect_count; i++) {
+		vkCmdSetScissor(cmd, 0, 1, &rects[i]);
+		/* the main process owns the draw parameters */
+		vkCmdDrawIndirect(cmd, renderer->ubo.buf, ubo_offset +
+				offsetof(struct renderer_params, draw), 1,
+				sizeof(VkDrawIndirectCommand));
+	}
+
+	if (renderer->ext.conditional_rendering)
+		renderer->cond.end(cmd);
+
+	vkCmdEndRenderPass(cmd);
+
+	if (renderer->timestamp.supported) {
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				renderer->timestamp.pool, output_index * 2 + 1);
+	}
+
+	renderer_build_output(renderer, cmd, output_index, copies, copy_count);
+
+	result = vkEndCommandBuffer(cmd);
+	renderer_vk(result, "failed to end command buffer");
+}
+
+/* Draw every output of the group as a full frame in one multiview render pass,
+ * with the draw of the first one.
+ */
+static void renderer_build_group_command_buffer(struct renderer *renderer,
+		int group)
+{
+	const VkCommandBuffer cmd = renderer->multiview.bufs[group];
+	const uint32_t view_count = renderer->multiview.view_count;
+	const int first = group * view_count;
+	const int query = (renderer->config.output_count + group) * 2;
+	const VkRect2D full_rect = {
+		.extent = {
+			.width = renderer->config.width,
+			.height = renderer->config.height,
+		},
+	};
+
+	VkBufferImageCopy *copies = renderer->cmd.copies;
+	const uint32_t copy_count = renderer_is_yuv(renderer) ? 0 :
+		renderer_get_copies(renderer, &full_rect, 1, NULL, copies);
+
+	VkResult result = vkBeginCommandBuffer(cmd,
+			&(VkCommandBufferBeginInfo) {
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
 			});
+	renderer_vk(result, "failed to begin command buffer");
+
+	vkCmdBindVertexBuffers(cmd, 0, 1, &renderer->vb.buf, &(VkDeviceSize) { 0 });
+
+	const uint32_t ubo_offset = renderer->heap_layout.ubo_stride * first;
+	vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			renderer->multiview.layout, 0, 1, &renderer->multiview.set,
+			1, &ubo_offset);
+	const uint32_t stride = renderer->heap_layout.ubo_stride /
+		sizeof(float[4]);
+	vkCmdPushConstants(cmd, renderer->multiview.layout,
+			VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(stride), &stride);
+
+	vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS,
+			renderer->multiview.pipeline);
+
+	if (renderer->timestamp.supported) {
+		vkCmdResetQueryPool(cmd, renderer->timestamp.pool, query, 2);
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				renderer->timestamp.pool, query);
+	}
 
-	/* Explicit barrier to make sure the transfer is available to the host
-	 * domain.
+	vkCmdBeginRenderPass(cmd,
+			&(VkRenderPassBeginInfo) {
+				.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+				.renderPass = renderer->multiview.pass,
+				.framebuffer = renderer->multiview.fbs[group],
+				.renderArea = full_rect,
+			}, VK_SUBPASS_CONTENTS_INLINE);
+
+	/* the clear and the draw apply to every view; skipped outputs are
+	 * never in a group
 	 */
-	vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
-			VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, 1,
-			&(VkBufferMemoryBarrier) {
-				.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
-				.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
-				.dstAccessMask = VK_ACCESS_HOST_READ_BIT,
-				.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-				.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-				.buffer = output->buf,
-				.size = VK_WHOLE_SIZE,
-			}, 0, NULL);
+	vkCmdClearAttachments(cmd, 1,
+			&(VkClearAttachment) {
+				.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+				.colorAttachment = 0,
+				.clearValue = {
+					.color = { .float32 = RENDERER_CLEAR_COLOR },
+				},
+			}, 1, &(VkClearRect) {
+				.rect = full_rect,
+				.layerCount = 1,
+			});
+	vkCmdSetScissor(cmd, 0, 1, &full_rect);
+	vkCmdDrawIndirect(cmd, renderer->ubo.buf, ubo_offset +
+			offsetof(struct renderer_params, draw), 1,
+			sizeof(VkDrawIndirectCommand));
+
+	vkCmdEndRenderPass(cmd);
+
+	if (renderer->timestamp.supported) {
+		vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+				renderer->timestamp.pool, query + 1);
+	}
+
+	for (uint32_t i = 0; i < view_count; i++)
+		renderer_build_output(renderer, cmd, first + i, copies, copy_count);
 
 	result = vkEndCommandBuffer(cmd);
 	renderer_vk(result, "failed to end command buffer");
 }
 
+/* clear the images once and move them to their steady layout */
+static void renderer_clear_framebuffer(struct renderer *renderer)
+{
+	const int count = renderer->config.output_count;
+	const VkImageSubresourceRange range = {
+		.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+		.levelCount = 1,
+		.layerCount = VK_REMAINING_ARRAY_LAYERS,
+	};
+
+	VkCommandBuffer cmd;
+	VkResult result = vkAllocateCommandBuffers(renderer->dev,
+			&(VkCommandBufferAllocateInfo) {
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+				.commandPool = renderer->cmd.pool,
+				.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+				.commandBufferCount = 1,
+			}, &cmd);
+	renderer_vk(result, "failed to allocate command buffer");
+
+	result = vkBeginCommandBuffer(cmd,
+			&(VkCommandBufferBeginInfo) {
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+				.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+			});
+	renderer_vk(result, "failed to begin command buffer");
+
+	/* the first output of an image clears all of its layers */
+	for (int i = 0; i < count; i++) {
+		if (i && renderer->fb.imgs[i] == renderer->fb.imgs[i - 1])
+			continue;
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+				VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1,
+				&(VkImageMemoryBarrier) {
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+					.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.image = renderer->fb.imgs[i],
+					.subresourceRange = range,
+				});
+
+		vkCmdClearColorImage(cmd, renderer->fb.imgs[i],
+				VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				&(VkClearColorValue) { .float32 = RENDERER_CLEAR_COLOR },
+				1, &range);
+
+		vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+				0, NULL, 0, NULL, 1,
+				&(VkImageMemoryBarrier) {
+					.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+					.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+					.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+						VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+					.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+					.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+					.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+					.image = renderer->fb.imgs[i],
+					.subresourceRange = range,
+				});
+	}
+
+	result = vkEndCommandBuffer(cmd);
+	renderer_vk(result, "failed to end command buffer");
+
+	result = vkQueueSubmit(renderer->queue, 1,
+			&(VkSubmitInfo) {
+				.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+				.commandBufferCount = 1,
+				.pCommandBuffers = &cmd,
+			}, VK_NULL_HANDLE);
+	renderer_vk(result, "failed to submit command buffer");
+
+	result = vkQueueWaitIdle(renderer->queue);
+	renderer_vk(result, "failed to wait queue");
+
+	vkFreeCommandBuffers(renderer->dev, renderer->cmd.pool, 1, &cmd);
+}
+
 static void renderer_init_vk_cmd(struct renderer *renderer)
 {
 	VkResult result = vkCreateCommandPool(renderer->dev,
 			&(VkCommandPoolCreateInfo) {
 				.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+				.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
 				.queueFamilyIndex = 0,
 			}, NULL, &renderer->cmd.pool);
 	renderer_vk(result, "failed to create command pool");
 
 	renderer->cmd.bufs = malloc(sizeof(renderer->cmd.bufs[0]) *
-			renderer->config.output_count);
+			renderer->config.output_count * 2);
 	if (!renderer->cmd.bufs)
 		renderer_vk(result, "failed to create command buffer array");
+	renderer->cmd.dynamic_bufs = renderer->cmd.bufs +
+		renderer->config.output_count;
+
+	/* zeroed keys match no damage rects nor ROI */
+	renderer->cmd.dynamic_keys = calloc(renderer->config.output_count,
+			sizeof(renderer->cmd.dynamic_keys[0]));
+	if (!renderer->cmd.dynamic_keys)
+		renderer_fatal("failed to allocate command buffer keys");
+
+	const int size = VKMEMFD_TILE_SIZE;
+	int copy_count = (renderer->config.width + size - 1) / size *
+		((renderer->config.height + size - 1) / size);
+	if (copy_count < RENDERER_DAMAGE_MAX)
+		copy_count = RENDERER_DAMAGE_MAX;
+	renderer->cmd.copies = malloc(sizeof(renderer->cmd.copies[0]) *
+			copy_count);
+	if (!renderer->cmd.copies)
+		renderer_fatal("failed to allocate copy regions");
 
 	result = vkAllocateCommandBuffers(renderer->dev,
 			&(VkCommandBufferAllocateInfo) {
 				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
 				.commandPool = renderer->cmd.pool,
 				.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
-				.commandBufferCount = renderer->config.output_count,
+				.commandBufferCount = renderer->config.output_count * 2,
 			}, renderer->cmd.bufs);
 	renderer_vk(result, "failed to allocate command buffer");
 
+	renderer_clear_framebuffer(renderer);
+
 	for (int i = 0; i < renderer->config.output_count; i++) {
-		renderer_build_command_buffer(renderer, renderer->cmd.bufs[i],
-				&renderer->outputs[i]);
+		renderer_build_command_buffer(renderer, renderer->cmd.bufs[i], i,
+				NULL, 0, NULL);
 	}
+
+	const int group_count = renderer->multiview.group_count;
+	if (!group_count)
+		return;
+
+	renderer->multiview.bufs = malloc(sizeof(renderer->multiview.bufs[0]) *
+			group_count);
+	if (!renderer->multiview.bufs)
+		renderer_fatal("failed to allocate multiview command buffer array");
+
+	result = vkAllocateCommandBuffers(renderer->dev,
+			&(VkCommandBufferAllocateInfo) {
+				.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+				.commandPool = renderer->cmd.pool,
+				.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+				.commandBufferCount = group_count,
+			}, renderer->multiview.bufs);
+	renderer_vk(result, "failed to allocate command buffer");
+
+	for (int i = 0; i < group_count; i++)
+		renderer_build_group_command_buffer(renderer, i);
+}
+
+/* return false when the main process is gone */
+static bool renderer_recv(const struct renderer *renderer,
+		struct vkmemfd_request *req)
+{
+	if (!vkmemfd_recv_request(renderer->ctrl.in, req)) {
+		if (!errno)
+			return false;
+		renderer_fatal("failed to receive a request");
+	}
+	if (req->output >= renderer->config.output_count)
+		renderer_fatal("invalid output");
+
+	return true;
 }
 
-static uint32_t renderer_recv(const struct renderer *renderer)
+static bool renderer_poll(const struct renderer *renderer)
 {
-	uint32_t val;
-	if (read(renderer->ctrl.in, &val, sizeof(val)) != sizeof(val))
-		renderer_fatal("failed to receive a value");
+	struct pollfd pfd = {
+		.fd = renderer->ctrl.in,
+		.events = POLLIN,
+	};
 
-	return val;
+	return poll(&pfd, 1, 0) > 0;
 }
 
 static void renderer_send(const struct renderer *renderer, uint32_t val)
 {
-	if (write(renderer->ctrl.out, &val, sizeof(val)) != sizeof(val))
+	if (!vkmemfd_send_value(renderer->ctrl.out, val))
 		renderer_fatal("failed to send a value");
 }
 
-static void renderer_render(const struct renderer *renderer, int output)
+static void renderer_reply(const struct renderer *renderer, uint32_t output,
+		bool dropped)
 {
+	if (!vkmemfd_reply(renderer->ctrl.out, output, dropped))
+		renderer_fatal("failed to send a reply");
+}
+
+static void renderer_send_heap_layout(const struct renderer *renderer)
+{
+	struct vkmemfd_layout layout = {
+		.base_skip = renderer->heap_layout.base_skip,
+		.ubo_size = renderer->heap_layout.ubo_size,
+		.output_size = renderer->heap_layout.output_size,
+		.ubo_stride = renderer->heap_layout.ubo_stride,
+		.row_pitch = renderer->heap_layout.row_pitch,
+		.tile_size = renderer->heap_layout.tile_size,
+		.plane_count = renderer->heap_layout.plane_count,
+		.preview_count = renderer->heap_layout.preview_count,
+	};
+	for (uint32_t i = 0; i < layout.plane_count; i++) {
+		layout.planes[i].offset = renderer->heap_layout.planes[i].offset;
+		layout.planes[i].row_pitch =
+			renderer->heap_layout.planes[i].row_pitch;
+	}
+	for (uint32_t i = 0; i < layout.preview_count; i++) {
+		layout.previews[i].offset =
+			renderer->heap_layout.previews[i].offset;
+		layout.previews[i].width = renderer->heap_layout.previews[i].width;
+		layout.previews[i].height =
+			renderer->heap_layout.previews[i].height;
+	}
+
+	if (!vkmemfd_send_layout(renderer->ctrl.out, &layout))
+		renderer_fatal("failed to send the heap layout");
+}
+
+static uint64_t renderer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Whether the full frame of the output can be drawn by the command buffer of
+ * its group, which needs every output of the group to be in the batch with a
+ * full frame and the same draw.
+ */
+static bool renderer_is_grouped(const struct renderer *renderer,
+		const struct vkmemfd_request *reqs,
+		const struct renderer_params *params, const bool *full, int count,
+		int index)
+{
+	const uint32_t view_count = renderer->multiview.view_count;
+	const uint32_t group = reqs[index].output / view_count;
+
+	if (!full[index] || group >= (uint32_t) renderer->multiview.group_count)
+		return false;
+
+	uint32_t member_count = 0;
+	for (int i = 0; i < count; i++) {
+		if (full[i] && reqs[i].output / view_count == group &&
+				!memcmp(&params[i].draw, &params[index].draw,
+					sizeof(params[i].draw)))
+			member_count++;
+	}
+
+	return member_count == view_count;
+}
+
+/* the requests are submitted together and waited for once */
+static void renderer_render(struct renderer *renderer,
+		const struct vkmemfd_request *reqs, int count)
+{
+	struct renderer_params params[ARRAY_SIZE(renderer->sched.reqs)];
+	bool full[ARRAY_SIZE(renderer->sched.reqs)];
+	bool grouped[ARRAY_SIZE(renderer->sched.reqs)];
+	VkCommandBuffer cmds[ARRAY_SIZE(renderer->sched.reqs)];
+	bool skips[ARRAY_SIZE(renderer->sched.reqs)];
+	bool partials[ARRAY_SIZE(renderer->sched.reqs)];
+	int cmd_count = 0;
+
+	for (int i = 0; i < count; i++) {
+		renderer_read_params(renderer, reqs[i].output, &params[i]);
+		/* shared images have the contents of another output */
+		if (!renderer->config.keep_contents) {
+			params[i].skip = 0;
+			params[i].damage_count = 0;
+		}
+		full[i] = !params[i].skip && !params[i].damage_count &&
+			!params[i].roi.width;
+	}
+
+	for (int i = 0; i < count; i++) {
+		const uint32_t output = reqs[i].output;
+
+		grouped[i] = renderer_is_grouped(renderer, reqs, params, full,
+				count, i);
+		partials[i] = false;
+		if (grouped[i]) {
+			/* the first output of the group submits it */
+			skips[i] = false;
+			if (!renderer_fb_layer(renderer, output)) {
+				cmds[cmd_count++] = renderer->multiview.bufs[
+					output / renderer->multiview.view_count];
+			}
+			continue;
+		}
+
+		skips[i] = params[i].skip;
+		if (skips[i])
+			renderer->sched.skipped_count++;
+
+		/* the output still has the contents of its last frame */
+		if (skips[i] && !renderer->ext.conditional_rendering) {
+			renderer->sched.gpu_time_saved +=
+				renderer->sched.render_pass_time;
+			continue;
+		}
+
+		struct renderer_dynamic_key key = { 0 };
+		key.rect_count = renderer_get_damage(renderer, &params[i],
+				key.rects);
+		key.has_roi = renderer_get_roi(renderer, &params[i], &key.roi);
+		partials[i] = key.rect_count || key.has_roi;
+		if (partials[i]) {
+			struct renderer_dynamic_key *last =
+				&renderer->cmd.dynamic_keys[output];
+			if (!renderer_dynamic_key_equal(last, &key)) {
+				renderer_build_command_buffer(renderer,
+						renderer->cmd.dynamic_bufs[output],
+						output, key.rects, key.rect_count,
+						key.has_roi ? &key.roi : NULL);
+				*last = key;
+			}
+			cmds[cmd_count++] = renderer->cmd.dynamic_bufs[output];
+		} else {
+			cmds[cmd_count++] = renderer->cmd.bufs[output];
+		}
+	}
+	if (!cmd_count)
+		return;
+
 	VkResult result = vkQueueSubmit(renderer->queue, 1,
 			&(VkSubmitInfo) {
 				.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
-				.commandBufferCount = 1,
-				.pCommandBuffers = &renderer->cmd.bufs[output],
+				.commandBufferCount = cmd_count,
+				.pCommandBuffers = cmds,
 			}, VK_NULL_HANDLE);
 	renderer_vk(result, "failed to submit command buffer");
 
 	result = vkQueueWaitIdle(renderer->queue);
 	renderer_vk(result, "failed to wait queue");
+
+	if (!renderer->timestamp.supported)
+		return;
+
+	for (int i = 0; i < count; i++) {
+		if (skips[i] && !renderer->ext.conditional_rendering)
+			continue;
+
+		/* the outputs of a group share its render pass */
+		const uint32_t view_count = grouped[i] ?
+			renderer->multiview.view_count : 1;
+		const uint32_t query = grouped[i] ?
+			renderer->config.output_count + reqs[i].output / view_count :
+			reqs[i].output;
+
+		uint64_t ts[2];
+		result = vkGetQueryPoolResults(renderer->dev,
+				renderer->timestamp.pool, query * 2, 2,
+				sizeof(ts), ts, sizeof(ts[0]),
+				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+		renderer_vk(result, "failed to get timestamps");
+
+		const uint64_t time = (ts[1] - ts[0]) *
+			renderer->timestamp.period / view_count;
+		uint64_t *pass_time = partials[i] ?
+			&renderer->sched.partial_pass_time :
+			&renderer->sched.render_pass_time;
+		if (skips[i]) {
+			if (*pass_time > time)
+				renderer->sched.gpu_time_saved += *pass_time - time;
+		} else {
+			*pass_time = *pass_time ? (*pass_time * 7 + time) / 8 : time;
+			if (partials[i])
+				renderer->sched.partial_count++;
+		}
+	}
+}
+
+static void renderer_drop(struct renderer *renderer, uint32_t output)
+{
+	renderer->sched.dropped_count++;
+	renderer_reply(renderer, output, true);
+}
+
+static void renderer_queue_request(struct renderer *renderer,
+		const struct vkmemfd_request *req)
+{
+	/* a newer request for the same output takes the place of the queued
+	 * one, and the two get a single reply
+	 */
+	for (int i = 0; i < renderer->sched.count; i++) {
+		if (renderer->sched.reqs[i].output == req->output) {
+			renderer->sched.reqs[i] = *req;
+			return;
+		}
+	}
+
+	if (renderer->sched.count >= ARRAY_SIZE(renderer->sched.reqs))
+		renderer_fatal("too many pending requests");
+
+	renderer->sched.reqs[renderer->sched.count++] = *req;
+}
+
+/* Dequeue the request with the earliest deadline among those having all of
+ * flags.  The queue is small; a linear search is good enough.
+ */
+static bool renderer_dequeue_request(struct renderer *renderer, uint32_t flags,
+		struct vkmemfd_request *req)
+{
+	int min = -1;
+	for (int i = 0; i < renderer->sched.count; i++) {
+		if ((renderer->sched.reqs[i].flags & flags) != flags)
+			continue;
+		/* no deadline sorts last */
+		if (min < 0 || renderer->sched.reqs[i].deadline - 1 <
+				renderer->sched.reqs[min].deadline - 1)
+			min = i;
+	}
+	if (min < 0)
+		return false;
+
+	*req = renderer->sched.reqs[min];
+	renderer->sched.reqs[min] = renderer->sched.reqs[--renderer->sched.count];
+
+	return true;
+}
+
+static void renderer_report(struct renderer *renderer)
+{
+	const uint64_t now = renderer_now();
+	if (now - renderer->sched.begin < 1000000000)
+		return;
+
+	/* stay quiet unless there are deadlines or drops */
+	if (renderer->sched.on_time_count || renderer->sched.late_count ||
+			renderer->sched.dropped_count) {
+		printf("renderer: %d on time, %d late, %d dropped, "
+				"%.3f ms per frame\n",
+				renderer->sched.on_time_count,
+				renderer->sched.late_count,
+				renderer->sched.dropped_count,
+				renderer->sched.frame_time / 1e6);
+	}
+	if (renderer->sched.partial_count) {
+		printf("renderer: %d partial frames, %.3f ms per render pass, "
+				"%.3f ms for full frames\n",
+				renderer->sched.partial_count,
+				renderer->sched.partial_pass_time / 1e6,
+				renderer->sched.render_pass_time / 1e6);
+	}
+	if (renderer->sched.skipped_count) {
+		printf("renderer: %d skipped, %.3f ms of GPU time saved%s\n",
+				renderer->sched.skipped_count,
+				renderer->sched.gpu_time_saved / 1e6,
+				renderer->timestamp.supported ? "" :
+				" (no timestamps)");
+	}
+
+	renderer->sched.begin = now;
+	renderer->sched.on_time_count = 0;
+	renderer->sched.late_count = 0;
+	renderer->sched.dropped_count = 0;
+	renderer->sched.partial_count = 0;
+	renderer->sched.skipped_count = 0;
+	renderer->sched.gpu_time_saved = 0;
 }
 
-static void renderer_mainloop(const struct renderer *renderer)
+static void renderer_mainloop(struct renderer *renderer)
 {
+	renderer->sched.begin = renderer_now();
+
 	while (true) {
-		const int output = renderer_recv(renderer);
-		renderer_render(renderer, output);
-		renderer_send(renderer, output);
+		struct vkmemfd_request req;
+
+		/* block only when there is nothing to do */
+		if (!renderer->sched.count) {
+			if (!renderer_recv(renderer, &req))
+				break;
+			renderer_queue_request(renderer, &req);
+		}
+		while (renderer->sched.count < ARRAY_SIZE(renderer->sched.reqs) &&
+				renderer_poll(renderer)) {
+			if (!renderer_recv(renderer, &req))
+				return;
+			renderer_queue_request(renderer, &req);
+		}
+
+		/* batched requests are submitted together */
+		struct vkmemfd_request batch[ARRAY_SIZE(renderer->sched.reqs)];
+		int batch_count = 0;
+		renderer_dequeue_request(renderer, 0, &batch[batch_count++]);
+		if (batch[0].flags & VKMEMFD_REQUEST_BATCH) {
+			while (renderer_dequeue_request(renderer,
+						VKMEMFD_REQUEST_BATCH,
+						&batch[batch_count]))
+				batch_count++;
+		}
+
+		/* frame_time is per output */
+		const uint64_t begin = renderer_now();
+		const uint64_t expected = begin +
+			renderer->sched.frame_time * batch_count;
+		int render_count = 0;
+		for (int i = 0; i < batch_count; i++) {
+			if (batch[i].deadline && expected > batch[i].deadline)
+				renderer_drop(renderer, batch[i].output);
+			else
+				batch[render_count++] = batch[i];
+		}
+
+		if (render_count) {
+			renderer_render(renderer, batch, render_count);
+
+			const uint64_t end = renderer_now();
+			const uint64_t time = (end - begin) / render_count;
+			renderer->sched.frame_time = renderer->sched.frame_time ?
+				(renderer->sched.frame_time * 7 + time) / 8 : time;
+
+			for (int i = 0; i < render_count; i++) {
+				if (batch[i].deadline && end > batch[i].deadline)
+					renderer->sched.late_count++;
+				else if (batch[i].deadline)
+					renderer->sched.on_time_count++;
+
+				renderer_reply(renderer, batch[i].output, false);
+			}
+		}
+
+		renderer_report(renderer);
+	}
+}
+
+const char *renderer_heap_type_name(enum vkmemfd_heap_type heap_type)
+{
+	switch (heap_type) {
+	case VKMEMFD_HEAP_MEMFD:
+		return "memfd";
+	case VKMEMFD_HEAP_UDMABUF:
+		return "udmabuf";
+	case VKMEMFD_HEAP_SYSV:
+		return "sysv";
+	case VKMEMFD_HEAP_EXPORT:
+		return "export";
+	default:
+		return "unknown";
 	}
 }
 
 int renderer(int width, int height, int output_count, int ctrl_in,
-		int ctrl_out, int memfd, bool use_udmabuf)
+		int ctrl_out, int memfd, enum vkmemfd_heap_type heap_type,
+		enum vkmemfd_output_layout layout, int row_align,
+		uint32_t preview_levels, bool keep_contents)
 {
 	struct renderer renderer = {
 		.config = {
 			.width = width,
 			.height = height,
 			.output_count = output_count,
-			.use_udmabuf = use_udmabuf,
+			.heap_type = heap_type,
+			.layout = layout,
+			.row_align = row_align,
+			.preview_levels = preview_levels,
+			.keep_contents = keep_contents,
 		},
 		.ctrl = {
 			.in = ctrl_in,
@@ -947,15 +2900,25 @@ int renderer(int width, int height, int output_count, int ctrl_in,
 	renderer_init_vk_device(&renderer);
 	renderer_init_heap_layout(&renderer);
 
-	/* send the heap layout */
-	renderer_send(&renderer, renderer.heap_layout.base_skip);
-	renderer_send(&renderer, renderer.heap_layout.ubo_size);
-	renderer_send(&renderer, renderer.heap_layout.output_size);
+	renderer_send_heap_layout(&renderer);
 
 	renderer_init_heap_buffers(&renderer);
+	renderer_init_params(&renderer);
+
+	/* send the memory property flags of the outputs */
+	const VkMemoryType *types = renderer.mem_props.memoryProperties.memoryTypes;
+	for (int i = 0; i < output_count; i++) {
+		renderer_send(&renderer,
+				types[renderer.outputs[i].mem_type].propertyFlags);
+	}
+
 	renderer_init_vk_vertex_buffer(&renderer);
+	renderer_init_multiview_groups(&renderer);
 	renderer_init_vk_descriptor_set(&renderer);
 	renderer_init_vk_framebuffer(&renderer);
+	renderer_init_vk_yuv(&renderer);
+	renderer_init_vk_preview(&renderer);
+	renderer_init_vk_query_pool(&renderer);
 	renderer_init_vk_pipeline(&renderer);
 	renderer_init_vk_cmd(&renderer);
 
@@ -2,8 +2,72 @@
 #define RENDERER_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
+#include "vkmemfd.h"
+
+/* every output is cleared to this color and has a triangle drawn in the UBO
+ * color, with the vertices at (-1, -1), (0, 1), and (1, -1) in NDC
+ */
+#define RENDERER_CLEAR_COLOR { 0.1f, 0.1f, 0.1f, 1.0f }
+
+/* the most damage rects per frame */
+#define RENDERER_DAMAGE_MAX 8
+
+/* Every output has one of these at ubo_stride apart in the UBO, written by the
+ * main process before it requests the output.
+ */
+struct renderer_params {
+	float color[4];
+	/* a VkDrawIndirectCommand, with first_instance being 0 */
+	struct {
+		uint32_t vertex_count;
+		uint32_t instance_count;
+		uint32_t first_vertex;
+		uint32_t first_instance;
+	} draw;
+	/* nonzero when the output is unchanged and need not be rendered again */
+	uint32_t skip;
+	/* When nonzero, only these rects of the output are redrawn and copied,
+	 * and the rest keeps the contents of the last frame.  The rects must
+	 * not overlap.
+	 */
+	uint32_t damage_count;
+	struct {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+		uint32_t height;
+	} damage[RENDERER_DAMAGE_MAX];
+	/* When width is nonzero, only this rect of the output is copied, tightly
+	 * packed at the start of the output, and the damage rects only limit
+	 * what is redrawn.  Only VKMEMFD_OUTPUT_LINEAR supports ROIs.
+	 */
+	struct {
+		uint32_t x;
+		uint32_t y;
+		uint32_t width;
+		uint32_t height;
+	} roi;
+};
+
+const char *renderer_heap_type_name(enum vkmemfd_heap_type heap_type);
+
+/* The renderer sends the heap layout with vkmemfd_send_layout, then the fds of
+ * the memories in VKMEMFD_HEAP_EXPORT, each with whether it is a dma-buf, then
+ * the VkMemoryPropertyFlags of each output, and then serves the requests.
+ *
+ * memfd is a shmid when heap_type is VKMEMFD_HEAP_SYSV, and is ignored when
+ * heap_type is VKMEMFD_HEAP_EXPORT.  ctrl_out must be a unix socket when
+ * heap_type is VKMEMFD_HEAP_EXPORT.  row_align is the alignment of the row
+ * pitch in VKMEMFD_OUTPUT_PITCHED, and is ignored otherwise.  Bit N of
+ * preview_levels asks for a preview of mip level N, from 1 to
+ * VKMEMFD_PREVIEW_LEVEL_MAX.  Unless keep_contents is set, the outputs share
+ * their framebuffer image, and the skip words and damage rects are ignored.
+ */
 int renderer(int width, int height, int output_count, int ctrl_in,
-		int ctrl_out, int memfd, bool use_udmabuf);
+		int ctrl_out, int memfd, enum vkmemfd_heap_type heap_type,
+		enum vkmemfd_output_layout layout, int row_align,
+		uint32_t preview_levels, bool keep_contents);
 
 #endif /* RENDERER_H */
@@ -0,0 +1,25 @@
+0x07230203,0x00010000,0x000d0007,0x0000000d,
+0x00000000,0x00020011,0x00000001,0x0006000b,
+0x00000001,0x4c534c47,0x6474732e,0x3035342e,
+0x00000000,0x0003000e,0x00000000,0x00000001,
+0x0007000f,0x00000004,0x00000008,0x6e69616d,
+0x00000000,0x0000000a,0x0000000b,0x00030010,
+0x00000008,0x00000007,0x00030003,0x00000002,
+0x000001cc,0x00040005,0x00000008,0x6e69616d,
+0x00000000,0x00050005,0x0000000a,0x5f74756f,
+0x6f6c6f63,0x00000072,0x00040005,0x0000000b,
+0x6f6c6f63,0x00000072,0x00040047,0x0000000a,
+0x0000001e,0x00000000,0x00030047,0x0000000b,
+0x0000000e,0x00040047,0x0000000b,0x0000001e,
+0x00000000,0x00020013,0x00000002,0x00030021,
+0x00000003,0x00000002,0x00030016,0x00000004,
+0x00000020,0x00040017,0x00000005,0x00000004,
+0x00000004,0x00040020,0x00000006,0x00000003,
+0x00000005,0x00040020,0x00000007,0x00000001,
+0x00000005,0x0004003b,0x00000006,0x0000000a,
+0x00000003,0x0004003b,0x00000007,0x0000000b,
+0x00000001,0x00050036,0x00000002,0x00000008,
+0x00000000,0x00000003,0x000200f8,0x00000009,
+0x0004003d,0x00000005,0x0000000c,0x0000000b,
+0x0003003e,0x0000000a,0x0000000c,0x000100fd,
+0x00010038
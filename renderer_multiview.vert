@@ -0,0 +1,20 @@
+#version 460 core
+#extension GL_EXT_multiview : require
+
+layout(std140, set = 0, binding = 0) uniform block {
+    uniform vec4 colors[1024];
+};
+
+/* the params of the outputs are this many vec4s apart */
+layout(push_constant) uniform constants {
+    uint stride;
+};
+
+layout(location = 0) in vec2 in_pos;
+layout(location = 0) flat out vec4 color;
+
+void main()
+{
+    gl_Position = vec4(in_pos, 0.0, 1.0);
+    color = colors[uint(gl_ViewIndex) * stride];
+}
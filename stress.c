@@ -0,0 +1,673 @@
+#include <ctype.h>
+#include <dirent.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <xcb/xcb.h>
+
+#include "renderer.h"
+
+/* bucket i counts frames that took [2^i, 2^(i+1)) us */
+#define STRESS_HIST_BUCKETS 24
+
+/* filled in by the instances in shared memory */
+struct stress_result {
+	bool ok;
+	int frame_count;
+	uint64_t begin;
+	uint64_t end;
+	uint64_t max;
+	uint64_t hist[STRESS_HIST_BUCKETS];
+
+	/* allocated pages of the memfd heap */
+	size_t heap_resident;
+	/* from the DRM fdinfo of the renderer, or 0 */
+	size_t device_memory;
+};
+
+struct stress {
+	struct {
+		int width;
+		int height;
+		int output_count;
+		int frame_count;
+		int instance_count;
+		int cpu_count;
+		bool x11;
+		size_t heap_size;
+	} config;
+
+	struct stress_result *results;
+
+	/* every instance writes a byte when it is set up */
+	int ready[2];
+	/* closed to start all instances at once */
+	int start[2];
+};
+
+/* one main/renderer pair, in its own process */
+struct stress_instance {
+	const struct stress *stress;
+	int index;
+	struct stress_result *result;
+
+	int heap_fd;
+	void *heap_base;
+
+	struct {
+		pid_t pid;
+		int in;
+		int out;
+	} renderer;
+
+	struct {
+		xcb_connection_t *conn;
+		xcb_window_t win;
+		xcb_gcontext_t gc;
+		int band_height;
+	} xcb;
+
+	void *ubo;
+	size_t ubo_stride;
+	const void **outputs;
+
+	size_t img_size;
+	void *staging;
+
+	/* whether the ready byte has been written */
+	bool is_ready;
+};
+
+static void stress_fatal(const char *msg)
+{
+	printf("STRESS-FATAL: %s\n", msg);
+	abort();
+}
+
+static uint64_t stress_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static bool stress_init_heap(struct stress_instance *inst)
+{
+	const size_t heap_size = inst->stress->config.heap_size;
+
+	inst->heap_fd = memfd_create("vkmemfd-stress",
+			MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (inst->heap_fd < 0)
+		return false;
+	if (ftruncate(inst->heap_fd, heap_size) < 0)
+		return false;
+
+	inst->heap_base = mmap(NULL, heap_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, inst->heap_fd, 0);
+	if (inst->heap_base == MAP_FAILED) {
+		inst->heap_base = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+static bool stress_init_renderer(struct stress_instance *inst)
+{
+	int pipes[2];
+	int socks[2];
+
+	if (pipe(pipes) < 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0)
+		return false;
+
+	inst->renderer.in = socks[0];
+	inst->renderer.out = pipes[1];
+
+	fflush(stdout);
+
+	inst->renderer.pid = fork();
+	if (inst->renderer.pid < 0)
+		return false;
+
+	if (inst->renderer.pid > 0) {
+		close(pipes[0]);
+		close(socks[1]);
+		return true;
+	}
+
+	close(inst->renderer.in);
+	close(inst->renderer.out);
+
+	const struct stress *stress = inst->stress;
+	_exit(renderer(stress->config.width, stress->config.height,
+				stress->config.output_count, pipes[0], socks[1],
+				inst->heap_fd, VKMEMFD_HEAP_MEMFD,
+				VKMEMFD_OUTPUT_LINEAR, 0, 0, false));
+}
+
+static bool stress_recv(const struct stress_instance *inst, uint32_t *val)
+{
+	return vkmemfd_recv_value(inst->renderer.in, val);
+}
+
+static bool stress_init_memories(struct stress_instance *inst)
+{
+	const struct stress *stress = inst->stress;
+
+	/* the row pitch and the tile size of linear outputs are implied, and
+	 * there are no planes nor previews
+	 */
+	struct vkmemfd_layout layout;
+	if (!vkmemfd_recv_layout(inst->renderer.in, &layout))
+		return false;
+
+	const size_t heap_skip = layout.base_skip;
+	const size_t ubo_size = layout.ubo_size;
+	const size_t output_size = layout.output_size;
+	inst->ubo_stride = layout.ubo_stride;
+	if (inst->ubo_stride < sizeof(struct renderer_params) ||
+			ubo_size < inst->ubo_stride * stress->config.output_count ||
+			output_size < inst->img_size)
+		return false;
+
+	inst->outputs = malloc(sizeof(inst->outputs[0]) *
+			stress->config.output_count);
+	inst->staging = malloc(inst->img_size);
+	if (!inst->outputs || !inst->staging)
+		stress_fatal("failed to allocate instance memories");
+
+	void *ptr = inst->heap_base + heap_skip;
+	inst->ubo = ptr;
+	ptr += ubo_size;
+	for (int i = 0; i < stress->config.output_count; i++) {
+		inst->outputs[i] = ptr;
+		ptr += output_size;
+	}
+
+	if (ptr - inst->heap_base > stress->config.heap_size)
+		return false;
+
+	/* the memory property flags of the outputs; the outputs are read in
+	 * place either way
+	 */
+	for (int i = 0; i < stress->config.output_count; i++) {
+		uint32_t mem_flags;
+		if (!stress_recv(inst, &mem_flags))
+			return false;
+	}
+
+	return true;
+}
+
+static bool stress_init_xcb(struct stress_instance *inst)
+{
+	const struct stress *stress = inst->stress;
+
+	inst->xcb.conn = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(inst->xcb.conn))
+		return false;
+
+	const xcb_setup_t *setup = xcb_get_setup(inst->xcb.conn);
+	const xcb_screen_t *screen = xcb_setup_roots_iterator(setup).data;
+
+	/* the outputs are put as they are; run Xvfb with a 24-bit screen */
+	if (screen->root_depth != 24 ||
+			setup->image_byte_order != XCB_IMAGE_ORDER_LSB_FIRST)
+		return false;
+
+	const size_t max_size =
+		(size_t) xcb_get_maximum_request_length(inst->xcb.conn) * 4;
+	const size_t stride = (size_t) stress->config.width * 4;
+	if (max_size < 28 + stride)
+		return false;
+	inst->xcb.band_height = (max_size - 28) / stride;
+	if (inst->xcb.band_height > stress->config.height)
+		inst->xcb.band_height = stress->config.height;
+
+	inst->xcb.win = xcb_generate_id(inst->xcb.conn);
+	xcb_create_window(inst->xcb.conn, XCB_COPY_FROM_PARENT, inst->xcb.win,
+			screen->root, 0, 0, stress->config.width,
+			stress->config.height, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+			screen->root_visual, 0, NULL);
+
+	inst->xcb.gc = xcb_generate_id(inst->xcb.conn);
+	xcb_create_gc(inst->xcb.conn, inst->xcb.gc, inst->xcb.win, 0, NULL);
+
+	xcb_map_window(inst->xcb.conn, inst->xcb.win);
+	xcb_flush(inst->xcb.conn);
+
+	return true;
+}
+
+static bool stress_render_frame(const struct stress_instance *inst, int output,
+		const float rgba[4])
+{
+	const struct renderer_params params = {
+		.color = { rgba[0], rgba[1], rgba[2], rgba[3] },
+		.draw = {
+			.vertex_count = 3,
+			.instance_count = 1,
+		},
+	};
+	memcpy(inst->ubo + inst->ubo_stride * output, &params, sizeof(params));
+
+	const struct vkmemfd_request req = { .output = output };
+	if (!vkmemfd_submit(inst->renderer.out, &req, 1))
+		return false;
+
+	uint32_t val;
+	return vkmemfd_wait(inst->renderer.in, &val) && val == output;
+}
+
+/* consume the output the way a main process would */
+static bool stress_present_frame(const struct stress_instance *inst, int output)
+{
+	const struct stress *stress = inst->stress;
+
+	if (!inst->xcb.conn) {
+		memcpy(inst->staging, inst->outputs[output], inst->img_size);
+		return true;
+	}
+
+	const size_t stride = (size_t) stress->config.width * 4;
+	xcb_void_cookie_t cookie = { 0 };
+	for (int y = 0; y < stress->config.height; y += inst->xcb.band_height) {
+		int h = stress->config.height - y;
+		if (h > inst->xcb.band_height)
+			h = inst->xcb.band_height;
+
+		cookie = xcb_put_image_checked(inst->xcb.conn,
+				XCB_IMAGE_FORMAT_Z_PIXMAP, inst->xcb.win,
+				inst->xcb.gc, stress->config.width, h, 0, y, 0,
+				24, stride * h,
+				(const uint8_t *) inst->outputs[output] +
+				stride * y);
+	}
+
+	/* include the X server in the latency */
+	xcb_generic_error_t *err = xcb_request_check(inst->xcb.conn, cookie);
+	if (err) {
+		free(err);
+		return false;
+	}
+
+	return true;
+}
+
+static size_t stress_parse_fdinfo_size(const char *val)
+{
+	char *end;
+	size_t size = strtoull(val, &end, 10);
+
+	while (isspace((unsigned char) *end))
+		end++;
+	if (!strncmp(end, "KiB", 3))
+		size <<= 10;
+	else if (!strncmp(end, "MiB", 3))
+		size <<= 20;
+	else if (!strncmp(end, "GiB", 3))
+		size <<= 30;
+
+	return size;
+}
+
+/* Sum the drm-total-* (or the older drm-memory-*) keys of every DRM client
+ * of the process.  Clients reached through dup'ed fds are counted once.
+ */
+static size_t stress_query_device_memory(pid_t pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/fdinfo", (int) pid);
+
+	DIR *dir = opendir(path);
+	if (!dir)
+		return 0;
+
+	unsigned long long client_ids[16];
+	int client_count = 0;
+	size_t total = 0;
+
+	const struct dirent *ent;
+	while ((ent = readdir(dir))) {
+		if (ent->d_name[0] == '.')
+			continue;
+
+		char name[320];
+		snprintf(name, sizeof(name), "%s/%s", path, ent->d_name);
+		FILE *fp = fopen(name, "r");
+		if (!fp)
+			continue;
+
+		bool seen = false;
+		size_t client_total = 0;
+		size_t client_memory = 0;
+		char line[256];
+		while (fgets(line, sizeof(line), fp)) {
+			unsigned long long id;
+			if (sscanf(line, "drm-client-id: %llu", &id) == 1) {
+				for (int i = 0; i < client_count; i++) {
+					if (client_ids[i] == id)
+						seen = true;
+				}
+				if (!seen && client_count < 16)
+					client_ids[client_count++] = id;
+				continue;
+			}
+
+			const char *val = strchr(line, ':');
+			if (!val)
+				continue;
+			if (!strncmp(line, "drm-total-", 10))
+				client_total += stress_parse_fdinfo_size(val + 1);
+			else if (!strncmp(line, "drm-memory-", 11))
+				client_memory += stress_parse_fdinfo_size(val + 1);
+		}
+		fclose(fp);
+
+		if (!seen)
+			total += client_total ? client_total : client_memory;
+	}
+	closedir(dir);
+
+	return total;
+}
+
+static void stress_record(struct stress_result *result, uint64_t latency)
+{
+	int bucket = 0;
+	for (uint64_t us = latency / 1000; us > 1 &&
+			bucket < STRESS_HIST_BUCKETS - 1; us >>= 1)
+		bucket++;
+
+	result->hist[bucket]++;
+	if (result->max < latency)
+		result->max = latency;
+	result->frame_count++;
+}
+
+static bool stress_run_instance(struct stress_instance *inst)
+{
+	const struct stress *stress = inst->stress;
+
+	if (stress->config.x11 && !stress_init_xcb(inst))
+		return false;
+	if (!stress_init_heap(inst) || !stress_init_renderer(inst) ||
+			!stress_init_memories(inst))
+		return false;
+
+	/* warm up before the clock starts */
+	const float black[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	for (int i = 0; i < stress->config.output_count; i++) {
+		if (!stress_render_frame(inst, i, black))
+			return false;
+	}
+
+	inst->is_ready = true;
+	if (write(stress->ready[1], "", 1) != 1)
+		return false;
+	char c;
+	if (read(stress->start[0], &c, 1) != 0)
+		return false;
+
+	inst->result->begin = stress_now();
+	for (int i = 0; i < stress->config.frame_count; i++) {
+		const int output = i % stress->config.output_count;
+		float rgba[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		rgba[(i + inst->index) % 3] = stress->config.output_count > 1 ?
+			(float) output / (stress->config.output_count - 1) : 1.0f;
+
+		const uint64_t begin = stress_now();
+		if (!stress_render_frame(inst, output, rgba) ||
+				!stress_present_frame(inst, output))
+			return false;
+		stress_record(inst->result, stress_now() - begin);
+	}
+	inst->result->end = stress_now();
+
+	struct stat st;
+	if (!fstat(inst->heap_fd, &st))
+		inst->result->heap_resident = (size_t) st.st_blocks * 512;
+	inst->result->device_memory =
+		stress_query_device_memory(inst->renderer.pid);
+
+	return true;
+}
+
+static void stress_instance(const struct stress *stress, int index)
+{
+	struct stress_instance inst = {
+		.stress = stress,
+		.index = index,
+		.result = &stress->results[index],
+		.heap_fd = -1,
+		.img_size = (size_t) stress->config.width *
+			stress->config.height * 4,
+	};
+
+	close(stress->ready[0]);
+	close(stress->start[1]);
+
+	inst.result->ok = stress_run_instance(&inst);
+	if (!inst.is_ready) {
+		/* do not hold up the others when failing before the start */
+		if (write(stress->ready[1], "", 1) != 1)
+			_exit(1);
+	}
+
+	if (inst.renderer.pid > 0) {
+		/* the renderer exits when the control pipe is closed */
+		close(inst.renderer.in);
+		close(inst.renderer.out);
+		waitpid(inst.renderer.pid, NULL, 0);
+	}
+	if (inst.xcb.conn)
+		xcb_disconnect(inst.xcb.conn);
+
+	_exit(inst.result->ok ? 0 : 1);
+}
+
+static double stress_percentile_ms(const uint64_t *hist, uint64_t count,
+		double p)
+{
+	const uint64_t target = count * p;
+	uint64_t sum = 0;
+	int bucket;
+	for (bucket = 0; bucket < STRESS_HIST_BUCKETS - 1; bucket++) {
+		sum += hist[bucket];
+		if (sum > target)
+			break;
+	}
+
+	/* the upper bound of the bucket */
+	return (double) (2ull << bucket) / 1000.0;
+}
+
+static void stress_report(const struct stress *stress)
+{
+	uint64_t hist[STRESS_HIST_BUCKETS] = { 0 };
+	uint64_t frame_count = 0;
+	uint64_t begin = UINT64_MAX;
+	uint64_t end = 0;
+	uint64_t max = 0;
+	size_t heap_resident = 0;
+	size_t device_memory = 0;
+
+	printf("%-8s %8s %10s %10s %10s %10s %12s %12s\n", "instance",
+			"frames", "fps", "p50 (ms)", "p99 (ms)", "max (ms)",
+			"heap (MiB)", "device (MiB)");
+	for (int i = 0; i < stress->config.instance_count; i++) {
+		const struct stress_result *result = &stress->results[i];
+		if (!result->ok) {
+			printf("%-8d %8s\n", i, "failed");
+			continue;
+		}
+
+		printf("%-8d %8d %10.1f %10.3f %10.3f %10.3f %12.1f %12.1f\n",
+				i, result->frame_count,
+				result->frame_count * 1e9 /
+				(result->end - result->begin),
+				stress_percentile_ms(result->hist,
+					result->frame_count, 0.50),
+				stress_percentile_ms(result->hist,
+					result->frame_count, 0.99),
+				result->max / 1e6,
+				result->heap_resident / 1048576.0,
+				result->device_memory / 1048576.0);
+
+		for (int b = 0; b < STRESS_HIST_BUCKETS; b++)
+			hist[b] += result->hist[b];
+		frame_count += result->frame_count;
+		if (begin > result->begin)
+			begin = result->begin;
+		if (end < result->end)
+			end = result->end;
+		if (max < result->max)
+			max = result->max;
+		heap_resident += result->heap_resident;
+		device_memory += result->device_memory;
+	}
+
+	if (!frame_count)
+		return;
+
+	printf("%-8s %8" PRIu64 " %10.1f %10.3f %10.3f %10.3f %12.1f %12.1f\n",
+			"total", frame_count, frame_count * 1e9 / (end - begin),
+			stress_percentile_ms(hist, frame_count, 0.50),
+			stress_percentile_ms(hist, frame_count, 0.99),
+			max / 1e6, heap_resident / 1048576.0,
+			device_memory / 1048576.0);
+
+	printf("\nlatency histogram (all instances)\n");
+	for (int b = 0; b < STRESS_HIST_BUCKETS; b++) {
+		if (!hist[b])
+			continue;
+		printf("  < %10.3f ms %10" PRIu64 " %6.2f%%\n",
+				(double) (2ull << b) / 1000.0, hist[b],
+				hist[b] * 100.0 / frame_count);
+	}
+}
+
+static void stress_pin_cpus(int cpu_count)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i = 0; i < cpu_count; i++)
+		CPU_SET(i, &set);
+
+	/* inherited by the instances and their renderers */
+	if (sched_setaffinity(0, sizeof(set), &set) < 0)
+		stress_fatal("failed to set CPU affinity");
+}
+
+static void stress_usage(const char *argv0)
+{
+	printf("Usage: %s [instances=K] [frames=N] [size=WxH] [cpus=N] [x11]\n",
+			argv0);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct stress stress = {
+		.config = {
+			.width = 600,
+			.height = 600,
+			.output_count = 4,
+			.frame_count = 1000,
+			.instance_count = 4,
+		},
+	};
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "instances=", 10)) {
+			stress.config.instance_count = atoi(argv[i] + 10);
+			if (stress.config.instance_count <= 0)
+				stress_usage(argv[0]);
+		} else if (!strncmp(argv[i], "frames=", 7)) {
+			stress.config.frame_count = atoi(argv[i] + 7);
+			if (stress.config.frame_count <= 0)
+				stress_usage(argv[0]);
+		} else if (!strncmp(argv[i], "size=", 5)) {
+			if (sscanf(argv[i] + 5, "%dx%d", &stress.config.width,
+						&stress.config.height) != 2 ||
+					stress.config.width <= 0 ||
+					stress.config.height <= 0)
+				stress_usage(argv[0]);
+		} else if (!strncmp(argv[i], "cpus=", 5)) {
+			stress.config.cpu_count = atoi(argv[i] + 5);
+			if (stress.config.cpu_count <= 0 ||
+					stress.config.cpu_count > CPU_SETSIZE)
+				stress_usage(argv[0]);
+		} else if (!strcmp(argv[i], "x11")) {
+			stress.config.x11 = true;
+		} else {
+			stress_usage(argv[0]);
+		}
+	}
+
+	/* leave room for the alignment of every buffer */
+	stress.config.heap_size = ((size_t) stress.config.width *
+			stress.config.height * 4 + 65536) *
+		(stress.config.output_count + 1);
+
+	if (stress.config.cpu_count)
+		stress_pin_cpus(stress.config.cpu_count);
+
+	stress.results = mmap(NULL, sizeof(stress.results[0]) *
+			stress.config.instance_count, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (stress.results == MAP_FAILED)
+		stress_fatal("failed to allocate results");
+
+	if (pipe(stress.ready) < 0 || pipe(stress.start) < 0)
+		stress_fatal("failed to create pipes");
+
+	/* a dead renderer is reported rather than fatal */
+	signal(SIGPIPE, SIG_IGN);
+
+	pid_t *pids = malloc(sizeof(*pids) * stress.config.instance_count);
+	if (!pids)
+		stress_fatal("failed to allocate pids");
+
+	fflush(stdout);
+	for (int i = 0; i < stress.config.instance_count; i++) {
+		pids[i] = fork();
+		if (pids[i] < 0)
+			stress_fatal("failed to fork an instance");
+		if (!pids[i])
+			stress_instance(&stress, i);
+	}
+	close(stress.ready[1]);
+	close(stress.start[0]);
+
+	for (int i = 0; i < stress.config.instance_count; i++) {
+		char c;
+		if (read(stress.ready[0], &c, 1) != 1)
+			break;
+	}
+	close(stress.start[1]);
+
+	for (int i = 0; i < stress.config.instance_count; i++)
+		waitpid(pids[i], NULL, 0);
+
+	stress_report(&stress);
+
+	free(pids);
+
+	return 0;
+}
@@ -0,0 +1,181 @@
+#include "trace.h"
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* color, draw, skip, and damage_count come before the damage rects */
+#define TRACE_PARAMS_HEAD offsetof(struct renderer_params, damage)
+
+bool trace_writer_init(struct trace_writer *writer, const char *path,
+		const struct trace_header *header)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->output_count = header->output_count;
+
+	writer->params = calloc(header->output_count,
+			sizeof(writer->params[0]));
+	writer->valid = calloc(header->output_count,
+			sizeof(writer->valid[0]));
+	if (!writer->params || !writer->valid) {
+		trace_writer_fini(writer);
+		return false;
+	}
+
+	writer->fp = fopen(path, "wb");
+	if (!writer->fp) {
+		trace_writer_fini(writer);
+		return false;
+	}
+
+	if (fwrite(header, sizeof(*header), 1, writer->fp) != 1 ||
+			fflush(writer->fp)) {
+		trace_writer_fini(writer);
+		return false;
+	}
+
+	return true;
+}
+
+void trace_writer_fini(struct trace_writer *writer)
+{
+	if (writer->fp)
+		fclose(writer->fp);
+	free(writer->params);
+	free(writer->valid);
+	memset(writer, 0, sizeof(*writer));
+}
+
+bool trace_write(struct trace_writer *writer, uint64_t now,
+		const struct vkmemfd_request *req,
+		const struct renderer_params *params)
+{
+	if (req->output >= (uint32_t) writer->output_count)
+		return false;
+
+	/* the first request starts the clock; later delays are rounded
+	 * without drifting
+	 */
+	uint64_t delay = 0;
+	if (writer->last_time) {
+		delay = (now - writer->last_time) / 1000;
+		if (delay > UINT32_MAX)
+			delay = UINT32_MAX;
+		writer->last_time += delay * 1000;
+	} else {
+		writer->last_time = now;
+		writer->flush_time = now;
+	}
+
+	uint64_t deadline = 0;
+	if (req->deadline) {
+		deadline = req->deadline > now ?
+			(req->deadline - now + 999) / 1000 : 1;
+		if (deadline > UINT32_MAX)
+			deadline = UINT32_MAX;
+	}
+
+	const uint32_t damage_count = params->damage_count <
+		RENDERER_DAMAGE_MAX ? params->damage_count :
+		RENDERER_DAMAGE_MAX;
+
+	struct renderer_params *last = &writer->params[req->output];
+	const bool changed = !writer->valid[req->output] ||
+		memcmp(last, params, sizeof(*params));
+
+	const struct trace_record rec = {
+		.delay = delay,
+		.deadline = deadline,
+		.output = req->output,
+		.flags = (req->flags & ~TRACE_RECORD_PARAMS) |
+			(changed ? TRACE_RECORD_PARAMS : 0),
+	};
+	if (fwrite(&rec, sizeof(rec), 1, writer->fp) != 1)
+		return false;
+
+	if (changed) {
+		if (fwrite(params, TRACE_PARAMS_HEAD, 1, writer->fp) != 1 ||
+				fwrite(params->damage, sizeof(params->damage[0]),
+					damage_count, writer->fp) != damage_count ||
+				fwrite(&params->roi, sizeof(params->roi), 1,
+					writer->fp) != 1)
+			return false;
+
+		*last = *params;
+		writer->valid[req->output] = true;
+	}
+
+	if (now - writer->flush_time >= 1000000000) {
+		if (fflush(writer->fp))
+			return false;
+		writer->flush_time = now;
+	}
+
+	return true;
+}
+
+bool trace_reader_init(struct trace_reader *reader, const char *path)
+{
+	memset(reader, 0, sizeof(*reader));
+
+	reader->fp = fopen(path, "rb");
+	if (!reader->fp)
+		return false;
+
+	const struct trace_header *hdr = &reader->header;
+	if (fread(&reader->header, sizeof(reader->header), 1,
+				reader->fp) != 1 ||
+			hdr->magic != TRACE_MAGIC ||
+			hdr->version != TRACE_VERSION ||
+			!hdr->width || !hdr->height || !hdr->output_count ||
+			hdr->output_count > UINT16_MAX) {
+		trace_reader_fini(reader);
+		return false;
+	}
+
+	reader->params = calloc(hdr->output_count, sizeof(reader->params[0]));
+	if (!reader->params) {
+		trace_reader_fini(reader);
+		return false;
+	}
+
+	return true;
+}
+
+void trace_reader_fini(struct trace_reader *reader)
+{
+	if (reader->fp)
+		fclose(reader->fp);
+	free(reader->params);
+	memset(reader, 0, sizeof(*reader));
+}
+
+bool trace_read(struct trace_reader *reader, struct trace_request *req)
+{
+	struct trace_record rec;
+	if (fread(&rec, sizeof(rec), 1, reader->fp) != 1 ||
+			rec.output >= reader->header.output_count)
+		return false;
+
+	struct renderer_params *params = &reader->params[rec.output];
+	if (rec.flags & TRACE_RECORD_PARAMS) {
+		struct renderer_params tmp = { 0 };
+		if (fread(&tmp, TRACE_PARAMS_HEAD, 1, reader->fp) != 1 ||
+				tmp.damage_count > RENDERER_DAMAGE_MAX ||
+				fread(tmp.damage, sizeof(tmp.damage[0]),
+					tmp.damage_count, reader->fp) !=
+				tmp.damage_count ||
+				fread(&tmp.roi, sizeof(tmp.roi), 1,
+					reader->fp) != 1)
+			return false;
+		*params = tmp;
+	}
+
+	req->delay = (uint64_t) rec.delay * 1000;
+	req->deadline = (uint64_t) rec.deadline * 1000;
+	req->output = rec.output;
+	req->flags = rec.flags & ~TRACE_RECORD_PARAMS;
+	req->params = *params;
+
+	return true;
+}
@@ -0,0 +1,91 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "renderer.h"
+
+#define TRACE_MAGIC 0x746d6b76
+#define TRACE_VERSION 1
+
+/* set in the flags of a record followed by packed renderer_params */
+#define TRACE_RECORD_PARAMS (1u << 15)
+
+/* At the start of a trace, describing the session it was recorded in.  Traces
+ * are written as the structs are laid out in memory, in host byte order, and
+ * only replay on a host with the same ABI.
+ */
+struct trace_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t output_count;
+	/* enum vkmemfd_output_layout, with its row_align and preview_levels */
+	uint32_t layout;
+	uint32_t row_align;
+	uint32_t preview_levels;
+	uint32_t pipeline_depth;
+	uint32_t batch_size;
+};
+
+/* One per request.  The params of an output are only recorded when they differ
+ * from its last ones; they are packed without the unused damage rects.
+ */
+struct trace_record {
+	/* since the last request, in us */
+	uint32_t delay;
+	/* relative to the request, in us, or 0 for none */
+	uint32_t deadline;
+	uint16_t output;
+	/* VKMEMFD_REQUEST_* and TRACE_RECORD_PARAMS */
+	uint16_t flags;
+};
+
+/* a request read back from a trace */
+struct trace_request {
+	uint64_t delay;
+	uint64_t deadline;
+	uint32_t output;
+	uint32_t flags;
+	struct renderer_params params;
+};
+
+struct trace_writer {
+	FILE *fp;
+	int output_count;
+	/* in ns */
+	uint64_t last_time;
+	uint64_t flush_time;
+	/* the last params of each output */
+	struct renderer_params *params;
+	bool *valid;
+};
+
+struct trace_reader {
+	FILE *fp;
+	struct trace_header header;
+	struct renderer_params *params;
+};
+
+bool trace_writer_init(struct trace_writer *writer, const char *path,
+		const struct trace_header *header);
+void trace_writer_fini(struct trace_writer *writer);
+
+/* Record a request made at now, in ns.  The trace is flushed about once per
+ * second so that it survives the process being killed.
+ */
+bool trace_write(struct trace_writer *writer, uint64_t now,
+		const struct vkmemfd_request *req,
+		const struct renderer_params *params);
+
+/* return false when the file is not a trace */
+bool trace_reader_init(struct trace_reader *reader, const char *path);
+void trace_reader_fini(struct trace_reader *reader);
+
+/* return false at the end of the trace, which may end with a torn record */
+bool trace_read(struct trace_reader *reader, struct trace_request *req);
+
+#endif /* TRACE_H */
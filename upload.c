@@ -0,0 +1,111 @@
+#include "upload.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <immintrin.h>
+#include <sys/mman.h>
+
+void upload_copy(void *dst, const void *src, size_t size)
+{
+	memcpy(dst, src, size);
+}
+
+/* SSE2; a cache line at a time */
+
+void upload_stream(void *dst, const void *src, size_t size)
+{
+	const char *s = src;
+	char *d = dst;
+
+	/* MOVNTDQ requires 16-byte alignment */
+	size_t i = -(uintptr_t) d & 15;
+	if (i > size)
+		i = size;
+	memcpy(d, s, i);
+
+	/* write whole lines so that the write-combining buffers are flushed
+	 * full
+	 */
+	for (; i + 64 <= size; i += 64) {
+		const __m128i x0 = _mm_loadu_si128((const __m128i *) (s + i));
+		const __m128i x1 = _mm_loadu_si128((const __m128i *) (s + i + 16));
+		const __m128i x2 = _mm_loadu_si128((const __m128i *) (s + i + 32));
+		const __m128i x3 = _mm_loadu_si128((const __m128i *) (s + i + 48));
+		_mm_stream_si128((__m128i *) (d + i), x0);
+		_mm_stream_si128((__m128i *) (d + i + 16), x1);
+		_mm_stream_si128((__m128i *) (d + i + 32), x2);
+		_mm_stream_si128((__m128i *) (d + i + 48), x3);
+	}
+	memcpy(d + i, s + i, size - i);
+
+	_mm_sfence();
+}
+
+void upload(void *dst, const void *src, size_t size, size_t threshold)
+{
+	if (size >= threshold)
+		upload_stream(dst, src, size);
+	else
+		upload_copy(dst, src, size);
+}
+
+static uint64_t upload_cpu_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+double upload_measure(void *dst, const void *src, size_t size, bool stream)
+{
+	/* about 256MB in total */
+	const int iters = 1 + (256 << 20) / size;
+
+	/* warm up */
+	upload(dst, src, size, stream ? 0 : SIZE_MAX);
+
+	const uint64_t begin = upload_cpu_now();
+	for (int i = 0; i < iters; i++)
+		upload(dst, src, size, stream ? 0 : SIZE_MAX);
+	const uint64_t end = upload_cpu_now();
+
+	return (double) (end - begin) / ((double) size * iters / (1 << 20));
+}
+
+size_t upload_calibrate(size_t min_size, size_t max_size)
+{
+	if (!min_size)
+		min_size = 64;
+	if (max_size < min_size)
+		max_size = min_size;
+
+	/* a shared mapping like the heap */
+	void *dst = mmap(NULL, max_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	void *src = malloc(max_size);
+	if (dst == MAP_FAILED || !src) {
+		if (dst != MAP_FAILED)
+			munmap(dst, max_size);
+		free(src);
+		return UPLOAD_NEVER;
+	}
+	memset(src, 0x5a, max_size);
+
+	/* never stream unless it wins */
+	size_t threshold = UPLOAD_NEVER;
+	for (size_t size = min_size; size <= max_size; size *= 2) {
+		if (upload_measure(dst, src, size, true) <=
+				upload_measure(dst, src, size, false)) {
+			threshold = size;
+			break;
+		}
+	}
+
+	munmap(dst, max_size);
+	free(src);
+
+	return threshold;
+}
@@ -0,0 +1,31 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* a threshold no write reaches */
+#define UPLOAD_NEVER SIZE_MAX
+
+/* ordinary stores */
+void upload_copy(void *dst, const void *src, size_t size);
+
+/* MOVNTDQ non-temporal stores, followed by an sfence such that the data is
+ * globally visible before any later store, e.g., a doorbell
+ */
+void upload_stream(void *dst, const void *src, size_t size);
+
+/* stream when size is at least threshold */
+void upload(void *dst, const void *src, size_t size, size_t threshold);
+
+/* CPU time in ns per MB to upload size bytes, repeatedly to the same dst */
+double upload_measure(void *dst, const void *src, size_t size, bool stream);
+
+/* Return the smallest power-of-two multiple of min_size, up to max_size, at
+ * which streaming stores are cheaper, or UPLOAD_NEVER when they never are.
+ * The sizes should span those of the writes that matter.
+ */
+size_t upload_calibrate(size_t min_size, size_t max_size);
+
+#endif /* UPLOAD_H */
@@ -0,0 +1,192 @@
+#include "verify.h"
+
+#include <math.h>
+
+#include <immintrin.h>
+
+#include "renderer.h"
+
+static uint8_t verify_unorm8(float val)
+{
+	if (val <= 0.0f)
+		return 0;
+	if (val >= 1.0f)
+		return 255;
+	return (uint8_t) (val * 255.0f + 0.5f);
+}
+
+uint32_t verify_pack_color(const float rgba[4])
+{
+	return (uint32_t) verify_unorm8(rgba[3]) << 24 |
+		(uint32_t) verify_unorm8(rgba[0]) << 16 |
+		(uint32_t) verify_unorm8(rgba[1]) << 8 |
+		verify_unorm8(rgba[2]);
+}
+
+/* scalar */
+
+static size_t verify_span_scalar(const void *pixels, uint32_t expected,
+		size_t count)
+{
+	const uint32_t *p = pixels;
+	size_t bad = 0;
+	for (size_t i = 0; i < count; i++) {
+		for (int c = 0; c < 32; c += 8) {
+			const int a = (p[i] >> c) & 0xff;
+			const int b = (expected >> c) & 0xff;
+			if (a - b > 1 || b - a > 1) {
+				bad++;
+				break;
+			}
+		}
+	}
+	return bad;
+}
+
+/* SSE2; 4 pixels at a time */
+
+static size_t verify_span_sse2(const void *pixels, uint32_t expected,
+		size_t count)
+{
+	const uint32_t *p = pixels;
+	const __m128i e = _mm_set1_epi32(expected);
+	const __m128i one = _mm_set1_epi8(1);
+	const __m128i zero = _mm_setzero_si128();
+	/* counts good pixels in each lane */
+	__m128i good_count = zero;
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const __m128i x = _mm_loadu_si128((const __m128i *) (p + i));
+		const __m128i diff = _mm_or_si128(_mm_subs_epu8(x, e),
+				_mm_subs_epu8(e, x));
+		/* a pixel is good when all of its bytes are within 1 */
+		const __m128i good = _mm_cmpeq_epi32(_mm_subs_epu8(diff, one),
+				zero);
+		good_count = _mm_sub_epi32(good_count, good);
+	}
+
+	uint32_t lanes[4];
+	_mm_storeu_si128((__m128i *) lanes, good_count);
+	const size_t bad = i - ((size_t) lanes[0] + lanes[1] + lanes[2] +
+			lanes[3]);
+	return bad + verify_span_scalar(p + i, expected, count - i);
+}
+
+/* AVX2; 8 pixels at a time */
+
+#define VERIFY_AVX2 __attribute__((target("avx2")))
+
+VERIFY_AVX2 static size_t verify_span_avx2(const void *pixels,
+		uint32_t expected, size_t count)
+{
+	const uint32_t *p = pixels;
+	const __m256i e = _mm256_set1_epi32(expected);
+	const __m256i one = _mm256_set1_epi8(1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i good_count = zero;
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		const __m256i x = _mm256_loadu_si256((const __m256i *) (p + i));
+		const __m256i diff = _mm256_or_si256(_mm256_subs_epu8(x, e),
+				_mm256_subs_epu8(e, x));
+		const __m256i good = _mm256_cmpeq_epi32(
+				_mm256_subs_epu8(diff, one), zero);
+		good_count = _mm256_sub_epi32(good_count, good);
+	}
+
+	uint32_t lanes[8];
+	_mm256_storeu_si256((__m256i *) lanes, good_count);
+	size_t bad = i;
+	for (int l = 0; l < 8; l++)
+		bad -= lanes[l];
+	return bad + verify_span_sse2(p + i, expected, count - i);
+}
+
+/* AVX-512; 16 pixels at a time */
+
+#define VERIFY_AVX512 __attribute__((target("avx512f,avx512bw,popcnt")))
+
+VERIFY_AVX512 static size_t verify_span_avx512(const void *pixels,
+		uint32_t expected, size_t count)
+{
+	const uint32_t *p = pixels;
+	const __m512i e = _mm512_set1_epi32(expected);
+	const __m512i one = _mm512_set1_epi8(1);
+	size_t bad = 0;
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16) {
+		const __m512i x = _mm512_loadu_si512(p + i);
+		const __m512i diff = _mm512_or_si512(_mm512_subs_epu8(x, e),
+				_mm512_subs_epu8(e, x));
+		bad += __builtin_popcount(_mm512_test_epi32_mask(
+					_mm512_subs_epu8(diff, one),
+					_mm512_set1_epi32(-1)));
+	}
+	return bad + verify_span_avx2(p + i, expected, count - i);
+}
+
+static const verify_func verify_funcs[CONVERT_ISA_COUNT] = {
+	[CONVERT_ISA_SCALAR] = verify_span_scalar,
+	[CONVERT_ISA_SSE2] = verify_span_sse2,
+	[CONVERT_ISA_AVX2] = verify_span_avx2,
+	[CONVERT_ISA_AVX512] = verify_span_avx512,
+};
+
+verify_func verify_get_func(enum convert_isa isa)
+{
+	if (isa >= CONVERT_ISA_COUNT || !convert_isa_supported(isa))
+		return NULL;
+
+	return verify_funcs[isa];
+}
+
+/* the leftmost pixel whose center is at or right of the NDC x */
+static int verify_ndc_to_x(double ndc, int width)
+{
+	return (int) ceil((ndc + 1.0) * width / 2.0 - 0.5);
+}
+
+static size_t verify_span(verify_func func, const uint32_t *row, int width,
+		int begin, int end, uint32_t expected)
+{
+	if (begin < 0)
+		begin = 0;
+	if (end > width)
+		end = width;
+
+	return begin < end ? func(row + begin, expected, end - begin) : 0;
+}
+
+size_t verify_frame(verify_func func, const void *pixels, int width,
+		int height, int x, int y, int crop_width, int crop_height,
+		uint32_t color, int row_step, int row_offset)
+{
+	const uint32_t clear = verify_pack_color(
+			(const float[4]) RENDERER_CLEAR_COLOR);
+	size_t bad = 0;
+
+	for (int row_y = row_offset; row_y < crop_height; row_y += row_step) {
+		const uint32_t *row = (const uint32_t *) pixels +
+			(size_t) crop_width * row_y;
+
+		/* the edges go from (-1, -1) and (1, -1) to (0, 1) */
+		const double t = ((2.0 * (y + row_y) + 1.0) / height) / 2.0;
+		int left = verify_ndc_to_x(-1.0 + t, width);
+		int right = verify_ndc_to_x(1.0 - t, width);
+		if (left > width)
+			left = width;
+		if (right < left)
+			right = left;
+
+		/* skip a pixel on each side of each edge */
+		left -= x;
+		right -= x;
+		bad += verify_span(func, row, crop_width, 0, left - 1, clear);
+		bad += verify_span(func, row, crop_width, left + 1, right - 1,
+				color);
+		bad += verify_span(func, row, crop_width, right + 1, crop_width,
+				clear);
+	}
+
+	return bad;
+}
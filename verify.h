@@ -0,0 +1,29 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "convert.h"
+
+/* return the number of B8G8R8A8 pixels that differ from the expected value by
+ * more than 1 in any channel, to allow for UNORM rounding
+ */
+typedef size_t (*verify_func)(const void *pixels, uint32_t expected,
+		size_t count);
+
+uint32_t verify_pack_color(const float rgba[4]);
+
+/* return NULL when the ISA is not supported by the CPU */
+verify_func verify_get_func(enum convert_isa isa);
+
+/* Check every row_step-th row, starting from row_offset, of the crop_width x
+ * crop_height region at (x, y) of a width x height output rendered with the
+ * color.  The pixels are the region tightly packed.  The pixels on the
+ * triangle edges are skipped.  Return the number of bad pixels.
+ */
+size_t verify_frame(verify_func func, const void *pixels, int width,
+		int height, int x, int y, int crop_width, int crop_height,
+		uint32_t color, int row_step, int row_offset);
+
+#endif /* VERIFY_H */
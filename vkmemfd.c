@@ -0,0 +1,254 @@
+#include "vkmemfd.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+bool vkmemfd_heap_create(struct vkmemfd_heap *heap, const char *name,
+		size_t size)
+{
+	heap->fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	heap->base = MAP_FAILED;
+	heap->size = size;
+	if (heap->fd < 0)
+		return false;
+
+	/* udmabuf requires F_SEAL_SHRINK */
+	if (ftruncate(heap->fd, size) < 0 ||
+			fcntl(heap->fd, F_ADD_SEALS, F_SEAL_SHRINK |
+				F_SEAL_GROW) < 0) {
+		vkmemfd_heap_destroy(heap);
+		return false;
+	}
+
+	heap->base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+			heap->fd, 0);
+	if (heap->base == MAP_FAILED) {
+		vkmemfd_heap_destroy(heap);
+		return false;
+	}
+
+	return true;
+}
+
+bool vkmemfd_heap_seal(const struct vkmemfd_heap *heap, bool future_write)
+{
+	return fcntl(heap->fd, F_ADD_SEALS, F_SEAL_SEAL |
+			(future_write ? F_SEAL_FUTURE_WRITE : 0)) == 0;
+}
+
+int vkmemfd_heap_open_read_only(const struct vkmemfd_heap *heap)
+{
+	/* a new open file description, unlike dup */
+	char path[32];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", heap->fd);
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+void vkmemfd_heap_destroy(struct vkmemfd_heap *heap)
+{
+	const int err = errno;
+
+	if (heap->base != MAP_FAILED)
+		munmap(heap->base, heap->size);
+	if (heap->fd >= 0)
+		close(heap->fd);
+	heap->fd = -1;
+	heap->base = MAP_FAILED;
+
+	errno = err;
+}
+
+static bool vkmemfd_write(int fd, const void *data, size_t size)
+{
+	const ssize_t ret = write(fd, data, size);
+	if (ret >= 0 && (size_t) ret != size)
+		errno = EPIPE;
+
+	return ret >= 0 && (size_t) ret == size;
+}
+
+/* errno is 0 when the other end went away cleanly */
+static bool vkmemfd_read(int fd, void *data, size_t size)
+{
+	while (size) {
+		const ssize_t ret = read(fd, data, size);
+		if (ret <= 0) {
+			if (!ret)
+				errno = 0;
+			return false;
+		}
+
+		data = (char *) data + ret;
+		size -= ret;
+	}
+
+	return true;
+}
+
+bool vkmemfd_send_layout(int fd, const struct vkmemfd_layout *layout)
+{
+	if (layout->plane_count > ARRAY_SIZE(layout->planes) ||
+			layout->preview_count > ARRAY_SIZE(layout->previews)) {
+		errno = EINVAL;
+		return false;
+	}
+
+	/* in one write; the wire format has no padding */
+	uint32_t vals[6 + 1 + 2 * ARRAY_SIZE(layout->planes) + 1 +
+		3 * ARRAY_SIZE(layout->previews)];
+	int count = 0;
+
+	vals[count++] = layout->base_skip;
+	vals[count++] = layout->ubo_size;
+	vals[count++] = layout->output_size;
+	vals[count++] = layout->ubo_stride;
+	vals[count++] = layout->row_pitch;
+	vals[count++] = layout->tile_size;
+	vals[count++] = layout->plane_count;
+	for (uint32_t i = 0; i < layout->plane_count; i++) {
+		vals[count++] = layout->planes[i].offset;
+		vals[count++] = layout->planes[i].row_pitch;
+	}
+	vals[count++] = layout->preview_count;
+	for (uint32_t i = 0; i < layout->preview_count; i++) {
+		vals[count++] = layout->previews[i].offset;
+		vals[count++] = layout->previews[i].width;
+		vals[count++] = layout->previews[i].height;
+	}
+
+	return vkmemfd_write(fd, vals, sizeof(vals[0]) * count);
+}
+
+bool vkmemfd_recv_layout(int fd, struct vkmemfd_layout *layout)
+{
+	uint32_t vals[7];
+	if (!vkmemfd_read(fd, vals, sizeof(vals)))
+		return false;
+
+	layout->base_skip = vals[0];
+	layout->ubo_size = vals[1];
+	layout->output_size = vals[2];
+	layout->ubo_stride = vals[3];
+	layout->row_pitch = vals[4];
+	layout->tile_size = vals[5];
+	layout->plane_count = vals[6];
+	if (layout->plane_count > ARRAY_SIZE(layout->planes)) {
+		errno = EINVAL;
+		return false;
+	}
+	if (layout->plane_count && !vkmemfd_read(fd, layout->planes,
+				sizeof(layout->planes[0]) * layout->plane_count))
+		return false;
+
+	if (!vkmemfd_recv_value(fd, &layout->preview_count))
+		return false;
+	if (layout->preview_count > ARRAY_SIZE(layout->previews)) {
+		errno = EINVAL;
+		return false;
+	}
+	if (layout->preview_count && !vkmemfd_read(fd, layout->previews,
+				sizeof(layout->previews[0]) *
+				layout->preview_count))
+		return false;
+
+	return true;
+}
+
+bool vkmemfd_send_value(int fd, uint32_t val)
+{
+	return vkmemfd_write(fd, &val, sizeof(val));
+}
+
+bool vkmemfd_recv_value(int fd, uint32_t *val)
+{
+	return vkmemfd_read(fd, val, sizeof(*val));
+}
+
+bool vkmemfd_send_fd(int sock, uint32_t val, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsg_buf;
+	struct msghdr msg = {
+		.msg_iov = &(struct iovec) {
+			.iov_base = &val,
+			.iov_len = sizeof(val),
+		},
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buf.buf,
+		.msg_controllen = sizeof(cmsg_buf.buf),
+	};
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	return sendmsg(sock, &msg, MSG_NOSIGNAL) == sizeof(val);
+}
+
+int vkmemfd_recv_fd(int sock, uint32_t *val)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} cmsg_buf;
+	struct msghdr msg = {
+		.msg_iov = &(struct iovec) {
+			.iov_base = val,
+			.iov_len = sizeof(*val),
+		},
+		.msg_iovlen = 1,
+		.msg_control = cmsg_buf.buf,
+		.msg_controllen = sizeof(cmsg_buf.buf),
+	};
+
+	if (recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != sizeof(*val))
+		return -1;
+
+	const struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+			cmsg->cmsg_type != SCM_RIGHTS) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	int fd;
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+
+	return fd;
+}
+
+bool vkmemfd_submit(int fd, const struct vkmemfd_request *reqs, int count)
+{
+	return vkmemfd_write(fd, reqs, sizeof(*reqs) * count);
+}
+
+bool vkmemfd_wait(int fd, uint32_t *reply)
+{
+	return vkmemfd_read(fd, reply, sizeof(*reply));
+}
+
+bool vkmemfd_recv_request(int fd, struct vkmemfd_request *req)
+{
+	/* requests are smaller than PIPE_BUF and are never split */
+	return vkmemfd_read(fd, req, sizeof(*req));
+}
+
+bool vkmemfd_reply(int fd, uint32_t output, bool dropped)
+{
+	return vkmemfd_send_value(fd, output |
+			(dropped ? VKMEMFD_REPLY_DROPPED : 0));
+}
@@ -0,0 +1,167 @@
+#ifndef VKMEMFD_H
+#define VKMEMFD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* the only symbols the shared library exports */
+#define VKMEMFD_EXPORT __attribute__((visibility("default")))
+
+/* libvkmemfd shares memories between a main process and a renderer process.
+ * The main process creates a heap and hands it to the renderer, which imports
+ * regions of it into its VkDevice (see vkmemfd_vulkan.h) and tells the main
+ * process where they are.  The main process then requests frames, which the
+ * renderer renders into its regions and replies.  The control protocol runs
+ * over two fds: one from the main process to the renderer, and one back,
+ * which must be a unix socket for fds to be passed.
+ *
+ * Functions returning bool return false with errno set on failure, which is
+ * usually the other end being gone.
+ */
+
+enum vkmemfd_heap_type {
+	/* the heap is an mmapped fd (memfd or shm_open) imported as host
+	 * pointers
+	 */
+	VKMEMFD_HEAP_MEMFD,
+	/* the heap is a memfd imported as udmabufs */
+	VKMEMFD_HEAP_UDMABUF,
+	/* the heap is a SysV shm segment imported as host pointers */
+	VKMEMFD_HEAP_SYSV,
+	/* there is no heap; the renderer allocates and exports the memories
+	 * and sends the fds back
+	 */
+	VKMEMFD_HEAP_EXPORT,
+};
+
+enum vkmemfd_output_layout {
+	/* rows of width * 4 bytes */
+	VKMEMFD_OUTPUT_LINEAR,
+	/* rows padded to a row pitch */
+	VKMEMFD_OUTPUT_PITCHED,
+	/* VKMEMFD_TILE_SIZE x VKMEMFD_TILE_SIZE tiles in row-major order,
+	 * each stored contiguously; the tiles on the right and bottom edges are
+	 * padded
+	 */
+	VKMEMFD_OUTPUT_TILED,
+	/* BT.601 limited-range YUV 4:2:0, converted by a compute pass: a Y plane
+	 * and an interleaved UV plane
+	 */
+	VKMEMFD_OUTPUT_NV12,
+	/* as VKMEMFD_OUTPUT_NV12, but with separate U and V planes */
+	VKMEMFD_OUTPUT_I420,
+};
+
+#define VKMEMFD_TILE_SIZE 64
+
+/* Previews are mip levels 1 to VKMEMFD_PREVIEW_LEVEL_MAX of an output, each
+ * downscaled by 2 from the level above it and stored in tightly packed rows
+ * after the output.
+ */
+#define VKMEMFD_PREVIEW_LEVEL_MAX 8
+
+/* a request from the main process to render an output */
+struct vkmemfd_request {
+	uint32_t output;
+	/* VKMEMFD_REQUEST_* */
+	uint32_t flags;
+	/* CLOCK_MONOTONIC ns by which the output is wanted, or 0 for none */
+	uint64_t deadline;
+};
+
+/* The request may be submitted together with the other queued requests that
+ * have this flag, and is replied when all of them are done.
+ */
+#define VKMEMFD_REQUEST_BATCH (1u << 0)
+
+/* Every request is replied with its output, except that a request for an
+ * output whose last request is still queued replaces it, and the two get a
+ * single reply.  This bit is set when the request was dropped because it
+ * could not make its deadline.
+ */
+#define VKMEMFD_REPLY_DROPPED (1u << 31)
+
+/* a memfd that can be neither shrunk nor grown, mapped shared */
+struct vkmemfd_heap {
+	int fd;
+	void *base;
+	size_t size;
+};
+
+/* The heap is not sealed against further seals until vkmemfd_heap_seal, so
+ * that future writes can be sealed once every writer has mapped it.
+ */
+VKMEMFD_EXPORT bool vkmemfd_heap_create(struct vkmemfd_heap *heap,
+		const char *name, size_t size);
+/* seal the heap, and its future writes too when future_write is set; the
+ * existing mappings stay writable
+ */
+VKMEMFD_EXPORT bool vkmemfd_heap_seal(const struct vkmemfd_heap *heap,
+		bool future_write);
+/* return a read-only fd of the heap, or -1 */
+VKMEMFD_EXPORT int vkmemfd_heap_open_read_only(const struct vkmemfd_heap *heap);
+VKMEMFD_EXPORT void vkmemfd_heap_destroy(struct vkmemfd_heap *heap);
+
+/* The heap layout the renderer picked: base_skip bytes from the start of the
+ * heap, the UBO of ubo_size bytes with a slot every ubo_stride bytes, and then
+ * the outputs of output_size bytes each.  The row pitch is of the tiles when
+ * the outputs are tiled, and of the Y plane when they are YUV.  Only YUV
+ * outputs have planes, at offsets in the outputs, and the previews are after
+ * the outputs in their regions.
+ */
+struct vkmemfd_layout {
+	uint32_t base_skip;
+	uint32_t ubo_size;
+	uint32_t output_size;
+	uint32_t ubo_stride;
+	uint32_t row_pitch;
+	/* or 0 */
+	uint32_t tile_size;
+
+	uint32_t plane_count;
+	struct {
+		uint32_t offset;
+		uint32_t row_pitch;
+	} planes[3];
+
+	uint32_t preview_count;
+	struct {
+		uint32_t offset;
+		uint32_t width;
+		uint32_t height;
+	} previews[VKMEMFD_PREVIEW_LEVEL_MAX];
+};
+
+/* by the renderer, and by the main process; out of range counts are EINVAL */
+VKMEMFD_EXPORT bool vkmemfd_send_layout(int fd,
+		const struct vkmemfd_layout *layout);
+VKMEMFD_EXPORT bool vkmemfd_recv_layout(int fd, struct vkmemfd_layout *layout);
+
+/* single values, such as the VkMemoryPropertyFlags of the outputs */
+VKMEMFD_EXPORT bool vkmemfd_send_value(int fd, uint32_t val);
+VKMEMFD_EXPORT bool vkmemfd_recv_value(int fd, uint32_t *val);
+
+/* a value along with an fd, which the sender keeps; return the received fd,
+ * which is close-on-exec, or -1
+ */
+VKMEMFD_EXPORT bool vkmemfd_send_fd(int sock, uint32_t val, int fd);
+VKMEMFD_EXPORT int vkmemfd_recv_fd(int sock, uint32_t *val);
+
+/* Send requests from the main process.  Up to 16 requests at once are smaller
+ * than PIPE_BUF and are never split.
+ */
+VKMEMFD_EXPORT bool vkmemfd_submit(int fd, const struct vkmemfd_request *reqs,
+		int count);
+/* wait for the reply to a request: its output, with VKMEMFD_REPLY_DROPPED
+ * set when it was dropped
+ */
+VKMEMFD_EXPORT bool vkmemfd_wait(int fd, uint32_t *reply);
+
+/* Receive a request in the renderer.  Return false when the main process is
+ * gone, with errno 0 when it went away cleanly.
+ */
+VKMEMFD_EXPORT bool vkmemfd_recv_request(int fd, struct vkmemfd_request *req);
+VKMEMFD_EXPORT bool vkmemfd_reply(int fd, uint32_t output, bool dropped);
+
+#endif /* VKMEMFD_H */
@@ -0,0 +1,166 @@
+#include "vkmemfd_vulkan.h"
+
+#include <strings.h>
+
+#include <unistd.h>
+
+#include "udmabuf.h"
+
+VkResult vkmemfd_import_init(struct vkmemfd_import *import,
+		VkPhysicalDevice physical_dev, enum vkmemfd_heap_type heap_type,
+		int memfd, void *base)
+{
+	const struct vkmemfd_dispatch dispatch = {
+		.get_physical_device_properties2 = vkGetPhysicalDeviceProperties2,
+		.get_device_proc_addr = vkGetDeviceProcAddr,
+		.allocate_memory = vkAllocateMemory,
+	};
+
+	return vkmemfd_import_init_dispatch(import, &dispatch, physical_dev,
+			heap_type, memfd, base);
+}
+
+VkResult vkmemfd_import_init_dispatch(struct vkmemfd_import *import,
+		const struct vkmemfd_dispatch *dispatch,
+		VkPhysicalDevice physical_dev, enum vkmemfd_heap_type heap_type,
+		int memfd, void *base)
+{
+	*import = (struct vkmemfd_import) {
+		.heap_type = heap_type,
+		.memfd = memfd,
+		.base = base,
+		.udmabuf = -1,
+		.dispatch = *dispatch,
+	};
+
+	switch (heap_type) {
+	case VKMEMFD_HEAP_MEMFD:
+	case VKMEMFD_HEAP_SYSV: {
+		VkPhysicalDeviceExternalMemoryHostPropertiesEXT ext_mem_host_props = {
+			.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT
+		};
+		dispatch->get_physical_device_properties2(physical_dev,
+				&(VkPhysicalDeviceProperties2) {
+					.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+					.pNext = &ext_mem_host_props,
+				});
+		import->align = ext_mem_host_props.minImportedHostPointerAlignment;
+		if (!import->align)
+			return VK_ERROR_FEATURE_NOT_PRESENT;
+
+		const VkDeviceSize rem = (uintptr_t) base % import->align;
+		import->base_skip = rem ? import->align - rem : 0;
+		import->handle_type =
+			VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+		return VK_SUCCESS;
+	}
+	case VKMEMFD_HEAP_UDMABUF:
+		import->udmabuf = udmabuf_init();
+		if (import->udmabuf < 0)
+			return VK_ERROR_FEATURE_NOT_PRESENT;
+
+		import->align = getpagesize();
+		import->base_skip = 0;
+		import->handle_type =
+			VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+		return VK_SUCCESS;
+	default:
+		return VK_ERROR_FEATURE_NOT_PRESENT;
+	}
+}
+
+void vkmemfd_import_fini(struct vkmemfd_import *import)
+{
+	if (import->udmabuf >= 0)
+		close(import->udmabuf);
+	import->udmabuf = -1;
+}
+
+VkResult vkmemfd_import_memory(const struct vkmemfd_import *import,
+		VkDevice dev, uint32_t mem_types, VkBuffer dedicated,
+		VkDeviceSize offset, VkDeviceSize size, VkDeviceMemory *mem,
+		uint32_t *mem_type)
+{
+	VkImportMemoryFdInfoKHR fd_info = {
+		.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+		.handleType = import->handle_type,
+		.fd = -1,
+	};
+	VkImportMemoryHostPointerInfoEXT ptr_info = {
+		.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT,
+		.handleType = import->handle_type,
+	};
+	void *p_next;
+	VkResult result;
+
+	if ((offset - import->base_skip) % import->align ||
+			size % import->align)
+		return VK_ERROR_INVALID_EXTERNAL_HANDLE;
+
+	if (import->heap_type == VKMEMFD_HEAP_UDMABUF) {
+		/* the fd ownership will be transferred to Vulkan */
+		fd_info.fd = udmabuf_create(import->udmabuf, import->memfd,
+				offset, size);
+		if (fd_info.fd < 0)
+			return VK_ERROR_INVALID_EXTERNAL_HANDLE;
+
+		VkMemoryFdPropertiesKHR fd_props = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR
+		};
+		PFN_vkGetMemoryFdPropertiesKHR getter =
+			(PFN_vkGetMemoryFdPropertiesKHR)
+			import->dispatch.get_device_proc_addr(dev,
+					"vkGetMemoryFdPropertiesKHR");
+		result = getter ? getter(dev, fd_info.handleType, fd_info.fd,
+				&fd_props) : VK_ERROR_EXTENSION_NOT_PRESENT;
+
+		mem_types &= fd_props.memoryTypeBits;
+		p_next = &fd_info;
+	} else {
+		ptr_info.pHostPointer = (char *) import->base + offset;
+
+		VkMemoryHostPointerPropertiesEXT ptr_props = {
+			.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT
+		};
+		PFN_vkGetMemoryHostPointerPropertiesEXT getter =
+			(PFN_vkGetMemoryHostPointerPropertiesEXT)
+			import->dispatch.get_device_proc_addr(dev,
+					"vkGetMemoryHostPointerPropertiesEXT");
+		result = getter ? getter(dev, ptr_info.handleType,
+				ptr_info.pHostPointer, &ptr_props) :
+			VK_ERROR_EXTENSION_NOT_PRESENT;
+
+		mem_types &= ptr_props.memoryTypeBits;
+		p_next = &ptr_info;
+	}
+
+	if (result == VK_SUCCESS && !mem_types)
+		result = VK_ERROR_INVALID_EXTERNAL_HANDLE;
+	if (result != VK_SUCCESS) {
+		if (fd_info.fd >= 0)
+			close(fd_info.fd);
+		return result;
+	}
+
+	*mem_type = ffs(mem_types) - 1;
+
+	VkMemoryDedicatedAllocateInfo dedicated_info = {
+		.sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+		.pNext = p_next,
+		.buffer = dedicated,
+	};
+	if (dedicated != VK_NULL_HANDLE)
+		p_next = &dedicated_info;
+
+	result = import->dispatch.allocate_memory(dev,
+			&(VkMemoryAllocateInfo) {
+				.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+				.pNext = p_next,
+				.allocationSize = size,
+				.memoryTypeIndex = *mem_type,
+			}, NULL, mem);
+	if (result != VK_SUCCESS && fd_info.fd >= 0)
+		close(fd_info.fd);
+
+	return result;
+}
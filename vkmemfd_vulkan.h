@@ -0,0 +1,65 @@
+#ifndef VKMEMFD_VULKAN_H
+#define VKMEMFD_VULKAN_H
+
+#include <vulkan/vulkan.h>
+
+#include "vkmemfd.h"
+
+/* The entry points the imports call.  vkmemfd_import_init uses those of the
+ * loader, while a layer passes those of the next layer down.
+ */
+struct vkmemfd_dispatch {
+	PFN_vkGetPhysicalDeviceProperties2 get_physical_device_properties2;
+	PFN_vkGetDeviceProcAddr get_device_proc_addr;
+	PFN_vkAllocateMemory allocate_memory;
+};
+
+/* How the regions of a heap are imported into a VkDevice.  Host pointers, for
+ * VKMEMFD_HEAP_MEMFD and VKMEMFD_HEAP_SYSV, need VK_EXT_external_memory_host
+ * enabled on the device, and udmabufs, for VKMEMFD_HEAP_UDMABUF, need
+ * VK_KHR_external_memory_fd and VK_EXT_external_memory_dma_buf.
+ */
+struct vkmemfd_import {
+	enum vkmemfd_heap_type heap_type;
+	/* the memfd for udmabufs, and where the heap is mapped for host
+	 * pointers
+	 */
+	int memfd;
+	void *base;
+	/* /dev/udmabuf, or -1 */
+	int udmabuf;
+
+	/* for VkExternalMemoryBufferCreateInfo and friends */
+	VkExternalMemoryHandleTypeFlagBits handle_type;
+	/* of the offsets and sizes of the regions */
+	VkDeviceSize align;
+	/* from the start of the heap to the first aligned offset */
+	VkDeviceSize base_skip;
+
+	struct vkmemfd_dispatch dispatch;
+};
+
+/* VKMEMFD_HEAP_EXPORT has no heap and is VK_ERROR_FEATURE_NOT_PRESENT, as is
+ * a missing /dev/udmabuf.
+ */
+VKMEMFD_EXPORT VkResult vkmemfd_import_init(struct vkmemfd_import *import,
+		VkPhysicalDevice physical_dev, enum vkmemfd_heap_type heap_type,
+		int memfd, void *base);
+VKMEMFD_EXPORT VkResult vkmemfd_import_init_dispatch(
+		struct vkmemfd_import *import,
+		const struct vkmemfd_dispatch *dispatch,
+		VkPhysicalDevice physical_dev, enum vkmemfd_heap_type heap_type,
+		int memfd, void *base);
+VKMEMFD_EXPORT void vkmemfd_import_fini(struct vkmemfd_import *import);
+
+/* Import the size bytes at offset in the heap as memory of the first of
+ * mem_types that can hold them, dedicated to the buffer unless it is
+ * VK_NULL_HANDLE.  The offset must be base_skip plus a multiple of
+ * import->align, and the size a multiple of it.
+ */
+VKMEMFD_EXPORT VkResult vkmemfd_import_memory(
+		const struct vkmemfd_import *import, VkDevice dev,
+		uint32_t mem_types, VkBuffer dedicated, VkDeviceSize offset,
+		VkDeviceSize size, VkDeviceMemory *mem, uint32_t *mem_type);
+
+#endif /* VKMEMFD_VULKAN_H */